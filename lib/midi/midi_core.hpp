@@ -34,6 +34,9 @@ enum class ControlChange : uint8_t {
   GENERAL_PURPOSE_3 = 18,
   GENERAL_PURPOSE_4 = 19,
 
+  // Continuous Controllers LSB (32-63)
+  DATA_ENTRY_LSB = 38,
+
   // Switches (64-69)
   DAMPER_PEDAL = 64, // Sustain
   PORTAMENTO_SWITCH = 65,
@@ -113,6 +116,9 @@ struct MidiStatus {
   static constexpr bool is_status(uint8_t v) { return v & 0x80; }
   static constexpr MidiStatus min() { return 0; }
 
+  // Sent 24 times per quarter note by whatever sets the tempo
+  static constexpr uint8_t timing_clock = 0xF8;
+
   inline operator std::string() const { return std::to_string(value); }
 };
 
@@ -171,6 +177,17 @@ struct MidiChannelMessage {
     };
   }
 
+  /// Bend from -8192 to 8191, zero being the center
+  static constexpr MidiChannelMessage pitch_bend(uint8_t ch, int16_t value) {
+    const uint16_t raw = value + 8192;
+    return {
+        .type = MidiMessageType::PitchBend,
+        .channel = ch,
+        .data0 = static_cast<uint8_t>(raw & 0x7F),
+        .data1 = static_cast<uint8_t>(raw >> 7),
+    };
+  }
+
   static constexpr MidiChannelMessage
   control_change(uint8_t ch, ControlChange number, uint8_t value) {
     return {
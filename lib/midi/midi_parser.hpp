@@ -7,6 +7,7 @@
 
 namespace teslasynth::midi {
 using ChannelMessageCallback = std::function<void(const MidiChannelMessage &)>;
+using RealtimeCallback = std::function<void(MidiStatus)>;
 
 class MidiParser {
   MidiChannelNumber _current_status_channel;
@@ -14,9 +15,15 @@ class MidiParser {
   MidiData _data0;
   bool _has_status = false, _waiting_for_data = false, _has_data = false;
   ChannelMessageCallback _on_channel_message;
+  RealtimeCallback _on_realtime;
 
 public:
-  MidiParser(ChannelMessageCallback on_channel_message);
+  /**
+   * @param on_realtime called with system realtime messages, which may come
+   * in between the bytes of other messages
+   */
+  MidiParser(ChannelMessageCallback on_channel_message,
+             RealtimeCallback on_realtime = nullptr);
   void feed(const uint8_t *input, size_t len);
   MidiStatus status() const {
     return MidiStatus(_current_status_type, _current_status_channel);
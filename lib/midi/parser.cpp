@@ -4,8 +4,9 @@
 
 namespace teslasynth::midi {
 
-MidiParser::MidiParser(ChannelMessageCallback on_channel_message)
-    : _on_channel_message(on_channel_message) {}
+MidiParser::MidiParser(ChannelMessageCallback on_channel_message,
+                       RealtimeCallback on_realtime)
+    : _on_channel_message(on_channel_message), _on_realtime(on_realtime) {}
 
 void MidiParser::feed(const uint8_t *input, size_t len) {
   for (size_t i = 0; i < len; i++) {
@@ -20,7 +21,8 @@ void MidiParser::feed(const uint8_t *input, size_t len) {
             _current_status_type != MidiMessageType::AfterTouchChannel;
         _has_data = false;
       } else if (status.is_system_realtime()) {
-
+        if (_on_realtime)
+          _on_realtime(status);
       } else if (status.is_system()) {
         _has_status = false;
       }
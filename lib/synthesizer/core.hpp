@@ -1,45 +1,125 @@
 #pragma once
 
+#if __has_include("sdkconfig.h")
+#include "sdkconfig.h"
+#endif
+
 #include <cmath>
 #include <cstdint>
 #include <limits>
 #include <optional>
 #include <stdint.h>
 #include <string>
+#include <type_traits>
+
+#ifndef CONFIG_TESLASYNTH_TICK_RATE_HZ
+#define CONFIG_TESLASYNTH_TICK_RATE_HZ 1000000
+#endif
 
 namespace teslasynth::core {
 
-template <typename T = uint64_t> class SimpleDuration {
-  T _value;
+/// Resolution of the timebase the whole pipeline runs at
+constexpr uint32_t tick_rate = CONFIG_TESLASYNTH_TICK_RATE_HZ;
+constexpr uint32_t micros_rate = 1'000'000;
+
+/**
+ * Converts a number of ticks from one tick rate to another.
+ * Rates are known at compile time, so this is a no-op for equal rates and a
+ * single multiplication or division when one rate is a multiple of the other.
+ */
+template <uint32_t FROM, uint32_t TO, typename T>
+constexpr T rescale(const T v) {
+  if constexpr (FROM == TO)
+    return v;
+  else if constexpr (TO % FROM == 0)
+    return v * (TO / FROM);
+  else if constexpr (FROM % TO == 0)
+    return v / (FROM / TO);
+  else
+    return static_cast<T>(static_cast<uint64_t>(v) * TO / FROM);
+}
+
+/**
+ * Like rescale, for a value that is converted to T. Scaling up to a finer rate
+ * gives the largest T instead of wrapping when the value doesn't fit.
+ */
+template <uint32_t FROM, uint32_t TO, typename T, typename U>
+constexpr T rescale_saturated(const U v) {
+  constexpr T limit = std::numeric_limits<T>::max();
+  if constexpr (TO <= FROM)
+    return static_cast<T>(rescale<FROM, TO, U>(v));
+  else if constexpr (TO % FROM == 0)
+    return v > limit / (TO / FROM) ? limit : static_cast<T>(v * (TO / FROM));
+  else {
+    const uint64_t scaled = static_cast<uint64_t>(v) * TO / FROM;
+    return scaled > limit ? limit : static_cast<T>(scaled);
+  }
+}
+
+template <typename T = uint64_t, uint32_t HZ = tick_rate> class SimpleDuration;
 
-  static constexpr uint32_t _coef_milli = 1000;
-  static constexpr uint32_t _coef_sec = 1000 * _coef_milli;
+namespace detail {
+/**
+ * Rate and value type two durations are converted to before combining them.
+ * Durations at different rates are widened, so the finer rate can't overflow.
+ */
+template <typename T, uint32_t HZ, typename U, uint32_t R> struct common_ticks {
+  static constexpr uint32_t rate = HZ > R ? HZ : R;
+  using type = std::conditional_t<HZ == R, std::common_type_t<T, U>,
+                                  std::common_type_t<T, U, uint32_t>>;
+
+  static constexpr type lhs(const SimpleDuration<T, HZ> &a) {
+    return rescale<HZ, rate, type>(a.ticks());
+  }
+  static constexpr type rhs(const SimpleDuration<U, R> &b) {
+    return rescale<R, rate, type>(b.ticks());
+  }
+};
+} // namespace detail
+
+/**
+ * A duration counted in ticks of HZ.
+ *
+ * Durations with different tick rates can be mixed freely, conversions are
+ * resolved at compile time. Literals are in microseconds and get converted
+ * to the pipeline's tick rate where they are used. Converting to a finer rate
+ * saturates, and so do the factories: a 16-bit duration holds about 6.5ms at
+ * 10MHz and 1.6ms at 40MHz.
+ */
+template <typename T, uint32_t HZ> class SimpleDuration {
+  T _value;
 
   explicit constexpr SimpleDuration(T v) : _value(v) {}
 
 public:
+  static constexpr uint32_t rate = HZ;
+
   constexpr SimpleDuration() : _value(0) {}
 
-  template <typename U,
+  template <typename U, uint32_t R,
             typename = std::enable_if_t<std::is_convertible<U, T>::value>>
-  constexpr SimpleDuration(const SimpleDuration<U> &other)
-      : _value(static_cast<T>(other.micros())) {
+  constexpr SimpleDuration(const SimpleDuration<U, R> &other)
+      : _value(rescale_saturated<R, HZ, T>(other.ticks())) {
     static_assert(sizeof(U) <= sizeof(T),
                   "Cannot convert SimpleDuration<U> to smaller "
                   "SimpleDuration<T>: potential overflow");
   }
 
-  static constexpr SimpleDuration micros(T v) { return SimpleDuration(v); }
+  static constexpr SimpleDuration ticks(T v) { return SimpleDuration(v); }
+  static constexpr SimpleDuration micros(T v) {
+    return SimpleDuration(rescale_saturated<micros_rate, HZ, T>(v));
+  }
   static constexpr SimpleDuration millis(T v) {
-    return SimpleDuration(v * _coef_milli);
+    return SimpleDuration(rescale_saturated<1000, HZ, T>(v));
   }
   static constexpr SimpleDuration seconds(T v) {
-    return SimpleDuration(v * _coef_sec);
+    return SimpleDuration(rescale_saturated<1, HZ, T>(v));
   }
 
-  constexpr T micros() const { return _value; }
-  constexpr T millis() const { return _value / _coef_milli; }
-  constexpr T seconds() const { return _value / _coef_sec; }
+  constexpr T ticks() const { return _value; }
+  constexpr T micros() const { return rescale<HZ, micros_rate>(_value); }
+  constexpr T millis() const { return rescale<HZ, 1000>(_value); }
+  constexpr T seconds() const { return rescale<HZ, 1>(_value); }
 
   inline static constexpr SimpleDuration zero() {
     return SimpleDuration(static_cast<T>(0));
@@ -48,17 +128,21 @@ public:
     return SimpleDuration(std::numeric_limits<T>::max());
   }
 
-  template <typename U>
-  constexpr auto operator+(const SimpleDuration<U> &b) const {
-    using R = std::common_type_t<T, U>;
-    return SimpleDuration<R>::micros(_value + b.micros());
+  template <typename U, uint32_t R>
+  constexpr auto operator+(const SimpleDuration<U, R> &b) const {
+    using C = detail::common_ticks<T, HZ, U, R>;
+    return SimpleDuration<typename C::type, C::rate>::ticks(C::lhs(*this) +
+                                                            C::rhs(b));
   }
 
-  template <typename U>
+  template <typename U, uint32_t R>
   constexpr std::optional<SimpleDuration>
-  operator-(const SimpleDuration<U> &b) const {
-    if (_value >= b.micros())
-      return SimpleDuration<T>(_value - b.micros());
+  operator-(const SimpleDuration<U, R> &b) const {
+    using C = detail::common_ticks<T, HZ, U, R>;
+    const auto a = C::lhs(*this), c = C::rhs(b);
+    if (a >= c)
+      return SimpleDuration<T, HZ>(
+          static_cast<T>(rescale<C::rate, HZ>(a - c)));
     else
       return {};
   }
@@ -79,42 +163,51 @@ public:
     return *this;
   }
 
-  template <typename U>
-  constexpr bool operator<(const SimpleDuration<U> &b) const {
-    return _value < b.micros();
+  template <typename U, uint32_t R>
+  constexpr bool operator<(const SimpleDuration<U, R> &b) const {
+    using C = detail::common_ticks<T, HZ, U, R>;
+    return C::lhs(*this) < C::rhs(b);
   }
 
-  template <typename U>
-  constexpr bool operator>(const SimpleDuration<U> &b) const {
-    return _value > b.micros();
+  template <typename U, uint32_t R>
+  constexpr bool operator>(const SimpleDuration<U, R> &b) const {
+    using C = detail::common_ticks<T, HZ, U, R>;
+    return C::lhs(*this) > C::rhs(b);
   }
 
-  template <typename U>
-  constexpr bool operator==(const SimpleDuration<U> &b) const {
-    return _value == b.micros();
+  template <typename U, uint32_t R>
+  constexpr bool operator==(const SimpleDuration<U, R> &b) const {
+    using C = detail::common_ticks<T, HZ, U, R>;
+    return C::lhs(*this) == C::rhs(b);
   }
-  template <typename U>
-  constexpr bool operator!=(const SimpleDuration<U> &b) const {
-    return _value != b.micros();
+  template <typename U, uint32_t R>
+  constexpr bool operator!=(const SimpleDuration<U, R> &b) const {
+    using C = detail::common_ticks<T, HZ, U, R>;
+    return C::lhs(*this) != C::rhs(b);
   }
 
-  template <typename U>
-  constexpr bool operator<=(const SimpleDuration<U> &b) const {
-    return _value <= b.micros();
+  template <typename U, uint32_t R>
+  constexpr bool operator<=(const SimpleDuration<U, R> &b) const {
+    using C = detail::common_ticks<T, HZ, U, R>;
+    return C::lhs(*this) <= C::rhs(b);
   }
-  template <typename U>
-  constexpr bool operator>=(const SimpleDuration<U> &b) const {
-    return _value >= b.micros();
+  template <typename U, uint32_t R>
+  constexpr bool operator>=(const SimpleDuration<U, R> &b) const {
+    using C = detail::common_ticks<T, HZ, U, R>;
+    return C::lhs(*this) >= C::rhs(b);
   }
   constexpr bool is_zero() const { return _value == 0; }
 
   inline operator std::string() const {
-    if (_value > _coef_sec) {
-      return std::to_string(_value / static_cast<float>(_coef_sec)) + "S";
-    } else if (_value > _coef_milli) {
-      return std::to_string(_value / static_cast<float>(_coef_milli)) + "ms";
-    } else {
+    const float us = _value * (static_cast<float>(micros_rate) / HZ);
+    if (us > micros_rate) {
+      return std::to_string(us / micros_rate) + "S";
+    } else if (us > 1000) {
+      return std::to_string(us / 1000) + "ms";
+    } else if constexpr (HZ == micros_rate) {
       return std::to_string(_value) + "us";
+    } else {
+      return std::to_string(us) + "us";
     }
   }
 };
@@ -124,6 +217,90 @@ typedef SimpleDuration<uint64_t> Duration64;
 typedef SimpleDuration<uint32_t> Duration32;
 typedef SimpleDuration<uint16_t> Duration16;
 
+/// Microsecond based durations, for settings that must not depend on the
+/// tick rate the pipeline is built with.
+typedef SimpleDuration<uint16_t, micros_rate> Micros16;
+typedef SimpleDuration<uint16_t, 1000> Millis16;
+
+/**
+ * A point on a wrapping 32-bit timeline, counted in ticks.
+ *
+ * Keeps per-pulse clock arithmetic in 32 bits. Instants are ordered by
+ * serial number arithmetic, which holds across the wraparound as long as
+ * the instants being compared are less than half the timeline apart: about
+ * 35 minutes at 1MHz, 3.5 minutes at 10MHz and 53 seconds at 40MHz. The
+ * pipeline only compares instants a pulse or a render window apart, so
+ * sessions can be as long as they like at any tick rate. Durations convert
+ * implicitly, as an offset from the start of the timeline, and 64-bit time
+ * is only recovered at the edges.
+ */
+class Instant final {
+  uint32_t _value = 0;
+
+  explicit constexpr Instant(uint32_t v) : _value(v) {}
+
+public:
+  constexpr Instant() {}
+  template <typename T, uint32_t R>
+  constexpr Instant(const SimpleDuration<T, R> &since_origin)
+      : _value(static_cast<uint32_t>(Duration(since_origin).ticks())) {}
+
+  static constexpr Instant ticks(uint32_t v) { return Instant(v); }
+  constexpr uint32_t ticks() const { return _value; }
+
+  template <typename T, uint32_t R>
+  constexpr Instant operator+(const SimpleDuration<T, R> &d) const {
+    return Instant(_value + Duration32(d).ticks());
+  }
+  template <typename T, uint32_t R>
+  constexpr Instant operator-(const SimpleDuration<T, R> &d) const {
+    return Instant(_value - Duration32(d).ticks());
+  }
+  Instant &operator+=(const Duration32 &d) {
+    _value += d.ticks();
+    return *this;
+  }
+
+  /// Time elapsed since b, if b is not later than this
+  constexpr std::optional<Duration32> operator-(const Instant &b) const {
+    if (*this < b)
+      return {};
+    return Duration32::ticks(_value - b._value);
+  }
+
+  constexpr bool operator<(const Instant &b) const { return diff(b) < 0; }
+  constexpr bool operator>(const Instant &b) const { return diff(b) > 0; }
+  constexpr bool operator<=(const Instant &b) const { return diff(b) <= 0; }
+  constexpr bool operator>=(const Instant &b) const { return diff(b) >= 0; }
+  constexpr bool operator==(const Instant &b) const {
+    return _value == b._value;
+  }
+  constexpr bool operator!=(const Instant &b) const {
+    return _value != b._value;
+  }
+
+  /**
+   * Recovers the full time of this instant, given a reference time that is
+   * less than half the timeline away from it.
+   */
+  constexpr Duration extend(const Duration &reference) const {
+    const int32_t d = diff(Instant(reference));
+    if (d < 0 && static_cast<uint64_t>(-static_cast<int64_t>(d)) >
+                     reference.ticks())
+      return Duration::zero();
+    return Duration::ticks(reference.ticks() + d);
+  }
+
+  inline operator std::string() const {
+    return std::string(Duration32::ticks(_value));
+  }
+
+private:
+  constexpr int32_t diff(const Instant &b) const {
+    return static_cast<int32_t>(_value - b._value);
+  }
+};
+
 namespace {
 template <unsigned long long V> struct smallest_uint {
   using type = std::conditional_t<
@@ -155,17 +332,17 @@ template <char C, char... Cs> struct digits_to_value<C, Cs...> {
 template <char... Cs> constexpr auto operator""_us() {
   constexpr unsigned long long v = digits_to_value<Cs...>::value;
   using T = typename smallest_uint<v>::type;
-  return SimpleDuration<T>::micros(v);
+  return SimpleDuration<T, micros_rate>::micros(v);
 }
 template <char... Cs> constexpr auto operator""_ms() {
   constexpr unsigned long long v = digits_to_value<Cs...>::value * 1000;
   using T = typename smallest_uint<v>::type;
-  return SimpleDuration<T>::micros(v);
+  return SimpleDuration<T, micros_rate>::micros(v);
 }
 template <char... Cs> constexpr auto operator""_s() {
   constexpr unsigned long long v = digits_to_value<Cs...>::value * 1000'000;
   using T = typename smallest_uint<v>::type;
-  return SimpleDuration<T>::micros(v);
+  return SimpleDuration<T, micros_rate>::micros(v);
 }
 
 class Hertz {
@@ -202,7 +379,7 @@ public:
   constexpr bool operator>=(const Hertz &b) const { return _value >= b._value; }
   constexpr bool is_zero() const { return _value == 0; }
   constexpr Duration32 period() const {
-    return Duration32::micros(1e6 / _value);
+    return Duration32::ticks(tick_rate / _value);
   }
 
   inline operator std::string() const {
@@ -1,6 +1,9 @@
 #include "envelope.hpp"
 #include "core.hpp"
+#include <algorithm>
+#include <array>
 #include <cmath>
+#include <cstddef>
 #include <optional>
 
 using namespace teslasynth::core;
@@ -9,65 +12,81 @@ namespace teslasynth::synth {
 
 // -log_e(0.001)
 constexpr float logfactor = 6.907755278982137;
+constexpr size_t exp_steps = 256;
 
-Curve::Curve(EnvelopeLevel start, EnvelopeLevel target, Duration32 total,
-             CurveType type)
-    : _target(target), _type(type), _total(total), _current(start) {
-  const auto t = total.micros();
-  if (t <= 0) {
-    _target_reached = true;
-    _current = target;
-  } else
-    switch (type) {
-    case Exp:
-      _state.tau = (float)t / logfactor;
-      break;
-    case Lin:
-      _state.slope = (target - start) / t;
-      break;
-    case Const:
-      _target_reached = true;
-      _current = target;
-      break;
-    }
+// e^-x, constexpr unlike expf
+constexpr double exp_neg(double x) {
+  double term = 1, sum = 1;
+  for (int n = 1; n < 40; n++) {
+    term *= x / n;
+    sum += term;
+  }
+  return 1 / sum;
+}
+
+// Exp curve shape, fraction of the way covered on a fixed grid over its length
+constexpr std::array<float, exp_steps + 1> exp_shape = [] {
+  std::array<float, exp_steps + 1> table{};
+  for (size_t i = 0; i <= exp_steps; i++)
+    table[i] = 1 - exp_neg(logfactor * i / exp_steps);
+  return table;
+}();
+
+EnvelopeLevel Segment::at(Duration32 elapsed) const {
+  const float x = elapsed.ticks() * rate;
+  float shape = x;
+  if (type == Exp) {
+    const float pos = std::min(x, 1.f) * exp_steps;
+    const size_t i = std::min<size_t>(pos, exp_steps - 1);
+    shape = exp_shape[i] + (exp_shape[i + 1] - exp_shape[i]) * (pos - i);
+  }
+  return EnvelopeLevel(start + (target - start) * shape);
 }
-Curve::Curve(EnvelopeLevel constant)
-    : _target(constant), _type(Const), _current(constant),
-      _target_reached(true) {}
 
 std::optional<Duration32> Curve::will_reach_target(const Duration32 &dt) const {
-  if (_type != Const)
-    return (dt + _elapsed) - _total;
+  if (_segment.type != Const)
+    return (dt + _elapsed) - _segment.length;
   else
     return dt;
 }
 
 EnvelopeLevel Curve::update(Duration32 delta) {
-  if (_target_reached || _type == Const) {
+  if (_target_reached) {
     // noop
-  } else if (_elapsed + delta >= _total) {
+  } else if (_elapsed + delta >= _segment.length) {
     _target_reached = true;
-    _elapsed = _total;
-    _current = _target;
+    _elapsed = _segment.length;
+    _current = _segment.target;
   } else {
-    const auto dt = delta.micros();
-    if (_type == Exp)
-      _current += (_target - _current) * (1 - expf(-(float)dt / _state.tau));
-    else if (_type == Lin)
-      _current += _state.slope * dt;
-
     _elapsed += delta;
-    _target_reached = _current == _target || _elapsed >= _total;
+    _current = _segment.at(_elapsed);
+    _target_reached = _current == _segment.target;
   }
   return _current;
 }
 
+Envelope::Envelope(const CompiledEnvelope &stages, float attack_scale,
+                   float release_scale)
+    : _stages(&stages), _release_scale(release_scale),
+      _current(stages.attack.scaled(attack_scale)), _stage(Attack) {}
+
 Envelope::Envelope(ADSR configs)
-    : _configs(configs),
-      _current(configs.type == Const ? Curve(configs.sustain)
-                                     : Curve(EnvelopeLevel(0), EnvelopeLevel(1),
-                                             configs.attack, configs.type)),
-      _stage(Attack) {}
+    : _owned(CompiledEnvelope(configs)), _stages(&*_owned),
+      _current(_owned->attack), _stage(Attack) {}
+
+Envelope::Envelope(const Envelope &b)
+    : _owned(b._owned), _stages(_owned ? &*_owned : b._stages),
+      _release_scale(b._release_scale), _current(b._current),
+      _stage(b._stage) {}
+
+Envelope &Envelope::operator=(const Envelope &b) {
+  _owned = b._owned;
+  _stages = _owned ? &*_owned : b._stages;
+  _release_scale = b._release_scale;
+  _current = b._current;
+  _stage = b._stage;
+  return *this;
+}
 
 Envelope::Envelope(EnvelopeLevel level) : Envelope(ADSR::constant(level)) {}
 
@@ -77,18 +96,16 @@ Duration32 Envelope::progress(Duration32 delta, bool on) {
   while (dt && (!remained.is_zero() || !on)) {
     switch (_stage) {
     case Attack:
-      _current = Curve(EnvelopeLevel(1), _configs.sustain, _configs.decay,
-                       _configs.type);
+      _current = Curve(_stages->decay);
       _stage = Decay;
       break;
     case Decay:
-      _current = Curve(_configs.sustain);
+      _current = Curve(_stages->sustain);
       _stage = Sustain;
       break;
     case Sustain:
       if (!on) {
-        _current = Curve(_configs.sustain, EnvelopeLevel(0), _configs.release,
-                         _configs.type);
+        _current = Curve(_stages->release.scaled(_release_scale));
         _stage = Release;
       } else {
         dt = 0_us;
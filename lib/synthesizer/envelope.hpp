@@ -52,8 +52,9 @@ public:
   }
   float operator-(const EnvelopeLevel &b) const { return _value - b._value; }
 
-  template <typename T>
-  constexpr SimpleDuration<T> operator*(const SimpleDuration<T> &b) const {
+  template <typename T, uint32_t R>
+  constexpr SimpleDuration<T, R>
+  operator*(const SimpleDuration<T, R> &b) const {
     return b * _value;
   }
   constexpr EnvelopeLevel operator*(const EnvelopeLevel &b) const {
@@ -132,32 +133,81 @@ struct ADSR {
   }
 };
 
-union CurveState {
-  float tau;   // Exp
-  float slope; // Lin
+/**
+ * A curve from one level to another, with what it needs while playing worked
+ * out ahead. Exp curves cover 99.9% of the way before snapping to the target.
+ */
+struct Segment {
+  EnvelopeLevel start, target;
+  Duration32 length;
+  CurveType type;
+  float rate; // Fraction of the curve covered per tick
+
+  constexpr Segment(EnvelopeLevel start, EnvelopeLevel target,
+                    Duration32 length, CurveType type)
+      : start(start), target(target), length(length), type(type),
+        rate(type != Const && length.ticks() > 0 ? 1.f / length.ticks()
+                                                 : 0) {}
+  constexpr explicit Segment(EnvelopeLevel constant)
+      : Segment(constant, constant, Duration32::zero(), Const) {}
+
+  /// The same curve, taking `factor` times as long
+  constexpr Segment scaled(float factor) const {
+    return factor == 1 ? *this : Segment(start, target, length * factor, type);
+  }
+
+  /// Level after `elapsed`, which must be less than the length
+  EnvelopeLevel at(Duration32 elapsed) const;
 };
 
 class Curve {
-  EnvelopeLevel _target;
-  CurveType _type;
-  Duration32 _total;
-
+  Segment _segment;
   Duration32 _elapsed;
   EnvelopeLevel _current;
-  CurveState _state;
-  bool _target_reached = false;
+  bool _target_reached;
 
 public:
-  Curve(EnvelopeLevel start, EnvelopeLevel target, Duration32 total,
-        CurveType type);
-  Curve(EnvelopeLevel constant);
+  constexpr Curve(const Segment &segment)
+      : _segment(segment), _current(segment.start),
+        _target_reached(segment.rate == 0) {
+    if (_target_reached)
+      _current = segment.target;
+  }
+  constexpr Curve(EnvelopeLevel start, EnvelopeLevel target, Duration32 total,
+                  CurveType type)
+      : Curve(Segment(start, target, total, type)) {}
+  constexpr Curve(EnvelopeLevel constant) : Curve(Segment(constant)) {}
   EnvelopeLevel update(Duration32 delta);
   bool is_target_reached() const { return _target_reached; }
   std::optional<Duration32> will_reach_target(const Duration32 &dt) const;
 };
 
+/**
+ * The stages of an ADSR, prepared once per instrument so starting a note or
+ * moving to the next stage is a copy.
+ */
+struct CompiledEnvelope {
+  Segment attack, decay, release;
+  EnvelopeLevel sustain;
+
+  constexpr CompiledEnvelope(const ADSR &adsr)
+      : attack(adsr.type == Const
+                   ? Segment(adsr.sustain)
+                   : Segment(EnvelopeLevel(0), EnvelopeLevel(1), adsr.attack,
+                             adsr.type)),
+        decay(EnvelopeLevel(1), adsr.sustain, adsr.decay, adsr.type),
+        release(adsr.sustain, EnvelopeLevel(0), adsr.release, adsr.type),
+        sustain(adsr.sustain) {}
+};
+
+/**
+ * Plays the stages of an envelope. Stages compiled ahead are referenced and
+ * must outlive the envelope, envelopes made from an ADSR keep their own.
+ */
 class Envelope {
-  ADSR _configs;
+  std::optional<CompiledEnvelope> _owned;
+  const CompiledEnvelope *_stages;
+  float _release_scale = 1;
   Curve _current;
 
   Duration32 progress(Duration32 delta, bool on);
@@ -165,8 +215,13 @@ class Envelope {
 public:
   enum Stage { Attack, Decay, Sustain, Release, Off };
 
+  /// Attack and release take `attack_scale` and `release_scale` times as long
+  Envelope(const CompiledEnvelope &stages, float attack_scale = 1,
+           float release_scale = 1);
   Envelope(ADSR configs);
   Envelope(EnvelopeLevel level);
+  Envelope(const Envelope &b);
+  Envelope &operator=(const Envelope &b);
   EnvelopeLevel update(Duration32 delta, bool on);
   Stage stage() const { return _stage; }
   bool is_off() const { return _stage == Off; }
@@ -10,17 +10,21 @@ using namespace teslasynth::core;
 struct Instrument {
   ADSR envelope;
   Vibrato vibrato;
+  Tremolo tremolo = Tremolo::none();
+  // Derived from the envelope when the instrument is created
+  CompiledEnvelope compiled = CompiledEnvelope(envelope);
 
   constexpr bool operator==(Instrument b) const {
-    return envelope == b.envelope && vibrato == b.vibrato;
-  }
-  constexpr bool operator!=(Instrument b) const {
-    return envelope != b.envelope || vibrato != b.vibrato;
+    return envelope == b.envelope && vibrato == b.vibrato &&
+           tremolo == b.tremolo;
   }
+  constexpr bool operator!=(Instrument b) const { return !(*this == b); }
 
   inline operator std::string() const {
     std::string stream = "envelope " + std::string(envelope) + " vibrato " +
                          std::string(vibrato);
+    if (tremolo.depth > EnvelopeLevel::zero())
+      stream += " tremolo " + std::string(tremolo);
     return stream;
   }
 };
@@ -1,4 +1,5 @@
 #include "lfo.hpp"
+#include <array>
 #include <cmath>
 
 namespace teslasynth::synth {
@@ -6,8 +7,41 @@ using namespace teslasynth::core;
 
 constexpr float _2pi = 6.2831853071795864769;
 
-Hertz Vibrato::offset(const Duration &now) {
-  return depth * sinf(freq * _2pi * (now.micros() / 1e6f));
+Hertz Vibrato::offset() const { return depth * sinf(phase); }
+
+void Vibrato::advance(Duration32 period) {
+  const float t = period.ticks() / static_cast<float>(Duration32::rate);
+  phase = fmodf(phase + freq * _2pi * t, _2pi);
+}
+
+// Raised cosine, from none of the depth at phase zero to all of it halfway
+static const std::array<uint16_t, 1 << Lfo::table_bits> wave = [] {
+  std::array<uint16_t, 1 << Lfo::table_bits> table;
+  for (size_t i = 0; i < table.size(); i++)
+    table[i] = (1 - cosf(_2pi * i / table.size())) / 2 * UINT16_MAX;
+  return table;
+}();
+
+static uint32_t step(const Tremolo &tremolo, Hertz beat) {
+  const float freq = tremolo.beats > 0 ? beat / tremolo.beats : tremolo.freq;
+  return static_cast<uint32_t>(
+      std::ldexp(freq / static_cast<float>(Duration::rate), 32));
+}
+
+void Lfo::start(const Tremolo &tremolo, Hertz beat) {
+  _phase = 0;
+  retune(tremolo, beat);
+}
+
+void Lfo::retune(const Tremolo &tremolo, Hertz beat) {
+  _depth = tremolo.depth * UINT16_MAX;
+  _step = step(tremolo, beat);
+}
+
+uint32_t Lfo::next(Duration32 period) {
+  const uint32_t taken = uint32_t(_depth) * wave[_phase >> (32 - table_bits)];
+  _phase += _step * period.ticks();
+  return unity_gain - (taken >> (32 - gain_shift));
 }
 
 } // namespace teslasynth::synth
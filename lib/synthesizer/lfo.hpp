@@ -1,6 +1,8 @@
 #pragma once
 
 #include "core.hpp"
+#include "envelope.hpp"
+#include <cstdint>
 
 namespace teslasynth::synth {
 using namespace teslasynth::core;
@@ -8,8 +10,14 @@ using namespace teslasynth::core;
 struct Vibrato {
   Hertz freq = 0_hz;
   Hertz depth = 0_hz;
+  // Radians, moved on by every period played. Keeping the phase instead of
+  // working it out from the time keeps the wave continuous across retunes,
+  // and across the wraparound of the timeline.
+  float phase = 0;
 
-  Hertz offset(const Duration &now);
+  Hertz offset() const;
+  /// Moves the wave on by `period`
+  void advance(Duration32 period);
 
   constexpr static Vibrato none() { return {}; }
 
@@ -27,4 +35,50 @@ struct Vibrato {
   }
 };
 
+/// Amplitude modulation, the wave takes away up to `depth` of the volume
+struct Tremolo {
+  Hertz freq = 0_hz;
+  EnvelopeLevel depth = EnvelopeLevel::zero();
+  // Length of a cycle in beats when synced to the tempo, zero runs at `freq`
+  float beats = 0;
+
+  constexpr static Tremolo none() { return {}; }
+
+  constexpr bool operator==(Tremolo b) const {
+    return freq == b.freq && depth == b.depth && beats == b.beats;
+  }
+  constexpr bool operator!=(Tremolo b) const { return !(*this == b); }
+
+  inline operator std::string() const {
+    return std::string("F: ") + std::string(freq) +
+           std::string(" D: ") + std::string(depth) +
+           std::string(" B: ") + std::to_string(beats);
+  }
+};
+
+/**
+ * Low frequency oscillator for the volume, a phase accumulator reading its
+ * wave from a table. Advancing it and reading the gain is integer math done
+ * once per pulse, the frequency is only worked out when it changes.
+ */
+class Lfo final {
+  uint32_t _phase = 0, _step = 0; // Full cycle is 2^32, step is per tick
+  uint16_t _depth = 0;
+
+public:
+  static constexpr uint8_t table_bits = 8;
+  static constexpr uint8_t gain_shift = 16;
+  static constexpr uint32_t unity_gain = 1 << gain_shift;
+
+  /// Starts the tremolo from full volume, `beat` is the tempo in beats/s
+  void start(const Tremolo &tremolo, Hertz beat);
+  /// Changes the frequency, the wave carries on from where it is
+  void retune(const Tremolo &tremolo, Hertz beat);
+
+  inline bool is_off() const { return _depth == 0; }
+
+  /// Gain with `gain_shift` fractional bits, then moves on by `period`
+  uint32_t next(Duration32 period);
+};
+
 }; // namespace teslasynth::synth
@@ -10,56 +10,136 @@
 
 namespace teslasynth::synth {
 
-void Note::start(const MidiNote &mnote, Duration time, Envelope env,
+void Note::start(const MidiNote &mnote, Instant time, Envelope env,
                  Vibrato vibrato, Hertz tuning) {
+  start(mnote, time, env, vibrato, Tremolo::none(), tuning);
+}
+
+void Note::start(const MidiNote &mnote, Instant time, Envelope env,
+                 Vibrato vibrato, Tremolo tremolo, Hertz tuning) {
   if (_active && mnote.velocity == 0)
     return release(time);
   _freq = mnote.frequency(tuning);
+  start_glide();
+  _instrument = nullptr;
   _envelope = env;
-  _vibrato = vibrato;
+  _base_vibrato = vibrato;
+  _vibrato = {vibrato.freq * _vibrato_rate,
+              vibrato.depth * _vibrato_depth * _timbre, vibrato.phase};
+  _tremolo = tremolo;
+  _lfo.start(tremolo, _beat);
   _active = true;
   _released = false;
   _level = _envelope.update(0_us, true);
-  _volume = EnvelopeLevel::logscale(mnote.velocity * 2 + 1);
+  _velocity = _velocities ? velocity_level(*_velocities, mnote.velocity)
+                          : VelocityTable::standard()[mnote.velocity];
+  _volume = pressed_volume();
   _now = time;
   next();
 }
 
-void Note::start(const MidiNote &mnote, Duration time,
+void Note::start(const MidiNote &mnote, Instant time,
                  const Instrument &instrument, Hertz tuning) {
-  start(mnote, time, instrument.envelope, instrument.vibrato, tuning);
+  if (_active && mnote.velocity == 0)
+    return release(time);
+  start(mnote, time,
+        Envelope(instrument.compiled, _attack_scale, _release_scale),
+        instrument.vibrato, instrument.tremolo, tuning);
+  _instrument = &instrument;
 }
 
-void Note::start(const MidiNote &mnote, Duration time, Envelope env,
+void Note::start(const MidiNote &mnote, Instant time, Envelope env,
                  Hertz tuning) {
   start(mnote, time, env, Vibrato::none(), tuning);
 }
 
-void Note::release(Duration time) {
+void Note::legato(const MidiNote &mnote, Hertz tuning) {
+  _freq = mnote.frequency(tuning);
+  start_glide();
+}
+
+void Note::start_glide() {
+  _glide = _glide_rate = 0;
+  if (!_glide_time.is_zero() && _glide_from > Hertz(0)) {
+    // Periods are inversely proportional, the glide starts at from's period
+    const float offset = _freq / _glide_from - 1;
+    _glide = static_cast<int64_t>(std::ldexp(offset, glide_shift));
+    _glide_rate = _glide / _glide_time.ticks();
+    _glide_left = _glide_time;
+    // Too small to move within the glide time
+    if (_glide_rate == 0)
+      _glide = 0;
+  }
+  _glide_from = Hertz(0);
+}
+
+Hertz Note::pitch() const {
+  if (_glide == 0)
+    return _freq;
+  return _freq * (1 / (1 + std::ldexp(static_cast<float>(_glide),
+                                      -glide_shift)));
+}
+
+void Note::release(Instant time) {
   _released = true;
   _release = time;
 }
 
 void Note::off() { _active = false; }
 
+void Note::modulate_vibrato(float rate, float depth) {
+  _vibrato_rate = rate;
+  _vibrato_depth = depth;
+  _vibrato.depth = _base_vibrato.depth * depth * _timbre;
+  _vibrato.freq = _base_vibrato.freq * rate;
+}
+
+void Note::timbre(float depth) {
+  _timbre = depth;
+  _vibrato.depth = _base_vibrato.depth * _vibrato_depth * depth;
+}
+
 bool Note::next() {
   if (_envelope.is_off())
     _active = false;
   if (_active) {
-    Duration32 period = (_freq + _vibrato.offset(now())).period();
+    Duration32 period = (_freq + _vibrato.offset()).period();
+    uint32_t bend = _bend;
+    if (_glide != 0) {
+      const uint32_t glide =
+          bend_unity + (_glide >> (glide_shift - bend_shift));
+      bend = (static_cast<uint64_t>(bend) * glide) >> bend_shift;
+    }
+    if (bend != bend_unity)
+      period = Duration32::ticks(
+          (static_cast<uint64_t>(period.ticks()) * bend) >> bend_shift);
+    if (_glide != 0) {
+      // Ramps towards unity, ending where it would cross it. The rate is
+      // rounded down, so it also ends once the glide time is over.
+      const int64_t left = _glide - _glide_rate * period.ticks();
+      if ((left ^ _glide) < 0 || !(period < _glide_left))
+        _glide = 0;
+      else {
+        _glide = left;
+        _glide_left = *(_glide_left - period);
+      }
+    }
     _pulse.start = _now;
     _pulse.volume = _level * _volume;
+    if (!_lfo.is_off()) {
+      const float gain = _lfo.next(period) * (1.f / Lfo::unity_gain);
+      _pulse.volume = EnvelopeLevel(_pulse.volume * gain);
+    }
     _pulse.period = period;
+    _vibrato.advance(period);
 
-    Duration next_tick = _now + period;
+    Instant next_tick = _now + period;
     if (!_released || next_tick < _release)
       _level = _envelope.update(period, true);
     else {
       if (_now <= _release) {
-        uint32_t remained = _release.micros() - _now.micros();
-        _envelope.update(Duration32::micros(remained), true);
-        remained = (*(next_tick - _release)).micros();
-        _level = _envelope.update(Duration32::micros(remained), false);
+        _envelope.update(*(_release - _now), true);
+        _level = _envelope.update(*(next_tick - _release), false);
       } else
         _level = _envelope.update(period, false);
     }
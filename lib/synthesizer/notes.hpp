@@ -4,6 +4,7 @@
 #include "envelope.hpp"
 #include "instruments.hpp"
 #include "lfo.hpp"
+#include "velocity.hpp"
 #include <algorithm>
 #include <array>
 #include <cstddef>
@@ -19,7 +20,7 @@ namespace teslasynth::synth {
 using namespace teslasynth::core;
 
 struct NotePulse {
-  Duration start;
+  Instant start;
   Duration32 period;
   EnvelopeLevel volume;
 
@@ -52,22 +53,109 @@ struct MidiNote {
 
 class Note final {
   Hertz _freq = Hertz(0);
+  // Instrument the note plays, its envelope stages are referenced not copied
+  const Instrument *_instrument = nullptr;
+  const VelocityCurve *_velocities = nullptr;
   Envelope _envelope =
       Envelope(ADSR{0_us, 0_us, EnvelopeLevel(0), 0_us, CurveType::Lin});
-  Vibrato _vibrato;
+  Vibrato _vibrato, _base_vibrato;
+  Tremolo _tremolo;
+  Lfo _lfo;
+  Hertz _beat = 2_hz;
+  float _vibrato_rate = 1, _vibrato_depth = 1, _timbre = 1;
+  float _attack_scale = 1, _release_scale = 1, _gain = 1;
   NotePulse _pulse;
-  EnvelopeLevel _level, _volume;
-  Duration _release, _now;
+  EnvelopeLevel _level, _velocity, _pressure, _volume;
+  Instant _release, _now;
+  // Period multiplier, the channel's bend times the note's own
+  uint32_t _bend = bend_unity, _channel_bend = bend_unity,
+           _note_bend = bend_unity;
+  // Period multiplier of a glide as its offset from unity, with
+  // `glide_shift` fractional bits, and how much it moves towards unity a tick
+  int64_t _glide = 0, _glide_rate = 0;
+  // Glide the next start or legato begins with
+  Hertz _glide_from = Hertz(0);
+  Duration32 _glide_time, _glide_left;
   bool _active = false;
   bool _released = false;
 
 public:
-  void start(const MidiNote &mnote, Duration time, Envelope env,
+  static constexpr uint8_t bend_shift = 16;
+  static constexpr uint32_t bend_unity = 1 << bend_shift;
+  static constexpr uint8_t glide_shift = 32;
+
+  void start(const MidiNote &mnote, Instant time, Envelope env,
              Vibrato vibrato, Hertz tuning);
-  void start(const MidiNote &mnote, Duration time, const Instrument &instrument,
+  void start(const MidiNote &mnote, Instant time, const Instrument &instrument,
              Hertz tuning);
-  void start(const MidiNote &mnote, Duration time, Envelope env, Hertz tuning);
-  void release(Duration time);
+  void start(const MidiNote &mnote, Instant time, Envelope env, Hertz tuning);
+  void release(Instant time);
+
+  /**
+   * Changes the pitch of a playing note without a new attack, the pulse
+   * already scheduled keeps its period.
+   */
+  void legato(const MidiNote &mnote, Hertz tuning);
+
+  /**
+   * The next start or legato glides from `from` to its own pitch in `time`.
+   * Nothing glides if either is zero.
+   */
+  void glide(Hertz from, Duration32 time) {
+    _glide_from = from;
+    _glide_time = time;
+  }
+  /**
+   * Fixed point multiplier of the period with `bend_shift` fractional bits,
+   * the pulse already scheduled keeps its period and the next one is bent.
+   */
+  void bend(uint32_t multiplier) {
+    _channel_bend = multiplier;
+    _bend = combined_bend();
+  }
+
+  /// Bend of this note alone, applied on top of the channel's
+  void note_bend(uint32_t multiplier) {
+    _note_bend = multiplier;
+    _bend = combined_bend();
+  }
+
+  /**
+   * Scales the volume of the velocity while the key is pressed harder, up to
+   * twice as loud at full pressure, so soft notes stay softer than loud ones.
+   */
+  void pressure(EnvelopeLevel level) {
+    _pressure = level;
+    _volume = pressed_volume();
+  }
+
+  /// Scales the volume, the volume controller of the note's channel
+  void gain(float gain) {
+    _gain = gain;
+    _volume = pressed_volume();
+  }
+
+  /// Scales the rate and depth of the instrument's vibrato
+  void modulate_vibrato(float rate, float depth);
+
+  /// Timbre of this note alone, scales its vibrato depth
+  void timbre(float depth);
+
+  /// Tempo in beats per second, synced tremolos follow it
+  void tempo(Hertz beat) {
+    _beat = beat;
+    if (_tremolo.beats > 0)
+      _lfo.retune(_tremolo, beat);
+  }
+
+  /// Levels of velocities from the next start, used while starting only
+  void velocity_curve(const VelocityCurve &curve) { _velocities = &curve; }
+
+  /// Scales attack and release times of the instrument from the next start
+  void modulate_envelope(float attack, float release) {
+    _attack_scale = attack;
+    _release_scale = release;
+  }
 
   void off();
 
@@ -76,68 +164,475 @@ public:
 
   bool is_active() const { return _active; }
   bool is_released() const { return _released; }
-  const Duration &now() const { return _now; }
+  const Instant &now() const { return _now; }
   const Hertz &frequency() const { return _freq; }
+  /// Frequency the note is at, partway through a glide
+  Hertz pitch() const;
   const EnvelopeLevel &max_volume() const { return _volume; }
+  /// The instrument, or nullptr if started with an envelope
+  const Instrument *instrument() const { return _instrument; }
+
+private:
+  void start(const MidiNote &mnote, Instant time, Envelope env,
+             Vibrato vibrato, Tremolo tremolo, Hertz tuning);
+  void start_glide();
+
+  inline EnvelopeLevel pressed_volume() const {
+    return EnvelopeLevel(_velocity * (1.f + _pressure) * _gain);
+  }
+
+  inline uint32_t combined_bend() const {
+    return static_cast<uint32_t>(
+        (static_cast<uint64_t>(_channel_bend) * _note_bend) >> bend_shift);
+  }
+};
+
+/**
+ * How a voice plays the keys held down. Mono modes play a single note, the
+ * held key that has priority: the last pressed, the highest or the lowest.
+ * Moving between keys held together changes the pitch without a new attack.
+ */
+enum class VoiceMode : uint8_t { Poly, Last, High, Low };
+
+/// Expression of a single note, sent on a MIDI channel of its own
+struct NoteExpression {
+  uint32_t bend = Note::bend_unity;
+  // The channel's pressure when not given
+  std::optional<EnvelopeLevel> pressure;
+  float timbre = 1;
+};
+
+/**
+ * Controllers of the MIDI channel a note starts from. The caller keeps them,
+ * once per channel for all its voices, and changes the playing notes through
+ * the voice.
+ */
+struct ChannelControllers {
+  uint32_t bend = Note::bend_unity;
+  EnvelopeLevel pressure = EnvelopeLevel::zero();
+  float gain = 1, vibrato_rate = 1, vibrato_depth = 1;
+  float attack = 1, release = 1;
 };
 
 template <std::uint8_t MAX_NOTES = CONFIG_MAX_NOTES> class Voice final {
+public:
+  /// MIDI channels as a mask, controllers apply to the notes they started
+  typedef uint16_t Channels;
+  static constexpr Channels all_channels = UINT16_MAX;
+
+private:
+  static_assert(MAX_NOTES <= 32, "Pedal masks hold up to 32 notes");
+  typedef uint32_t Mask;
+
+  static constexpr uint8_t no_slot = UINT8_MAX;
+  static constexpr uint8_t channel_count = 16;
+  static constexpr uint8_t mono_keys = 16;
+
   uint8_t _size = MAX_NOTES;
+  VoiceMode _mode = VoiceMode::Poly;
+  Hertz _tuning = 440_hz, _beat = 2_hz;
+  bool _portamento = false;
+  Duration32 _portamento_time;
+  // Slot of the latest note, glides start from its pitch
+  uint8_t _last = no_slot;
+  // Keys held in mono modes, oldest first
+  std::array<uint8_t, mono_keys> _held;
+  uint8_t _held_size = 0;
+  VelocityCurve _velocities;
   std::array<Note, MAX_NOTES> _notes;
-  std::array<uint8_t, MAX_NOTES> _numbers;
+  // Number of each note and the MIDI channel it came from, a note is found
+  // by both so the same number on two channels plays two notes
+  std::array<uint8_t, MAX_NOTES> _numbers{}, _channels{};
+  // Slot each note number and each channel last started a note in, checked
+  // against `_numbers` and `_channels`
+  std::array<uint8_t, 128> _slots;
+  std::array<uint8_t, channel_count> _channel_slots;
+  // Notes whose number another channel started after them, the only ones
+  // the indexes may miss
+  Mask _shared = 0;
+  // Notes held by sostenuto, and the ones whose key is up but still held
+  Mask _sostenuto = 0, _deferred = 0;
+  // Channels whose damper and sostenuto pedals are down
+  Channels _dampers = 0, _sostenutos = 0;
 
-public:
-  Voice() {}
-  Voice(uint8_t size) : _size(std::min(size, MAX_NOTES)) {}
-  Note &start(const MidiNote &mnote, Duration time,
-              const Instrument &instrument, Hertz tuning) {
-    uint8_t idx = 0;
-    for (uint8_t i = 0; i < _size; i++) {
-      if (_notes[i].is_active() && _numbers[i] != mnote.number)
-        continue;
-      idx = i;
-      break;
-    }
+  inline bool plays_at(uint8_t i, uint8_t number, uint8_t channel) const {
+    return i < _size && _notes[i].is_active() && _numbers[i] == number &&
+           _channels[i] == channel;
+  }
+
+  /// @return the slot of an active note, or `_size` if it isn't playing
+  inline uint8_t slot_of(uint8_t number, uint8_t channel) const {
+    number &= 0x7F;
+    channel &= channel_count - 1;
+    if (plays_at(_slots[number], number, channel))
+      return _slots[number];
+    if (plays_at(_channel_slots[channel], number, channel))
+      return _channel_slots[channel];
+    for (Mask mask = _shared; mask; mask &= mask - 1)
+      if (plays_at(__builtin_ctz(mask), number, channel))
+        return __builtin_ctz(mask);
+    return _size;
+  }
+
+  /// Notes started by the channels
+  Mask notes_of(Channels channels) const {
+    Mask notes = 0;
+    for (uint8_t i = 0; i < _size; i++)
+      if ((channels >> _channels[i]) & 1)
+        notes |= Mask(1) << i;
+    return notes;
+  }
+
+  template <class F> void each_note(Channels channels, F &&apply) {
+    for (uint8_t i = 0; i < _size; i++)
+      if ((channels >> _channels[i]) & 1)
+        apply(_notes[i]);
+  }
+
+  void release_at(uint8_t i, Instant time) {
+    const Mask bit = Mask(1) << i;
+    if (((_dampers >> _channels[i]) & 1) || (_sostenuto & bit))
+      _deferred |= bit;
+    else
+      _notes[i].release(time);
+  }
+
+  void release_all(Mask mask, Instant time) {
+    _deferred &= ~mask;
+    for (; mask; mask &= mask - 1)
+      _notes[__builtin_ctz(mask)].release(time);
+  }
+
+  inline Hertz glide_from() const {
+    return _portamento && _last < _size ? _notes[_last].pitch() : Hertz(0);
+  }
+
+  Note &play(uint8_t idx, bool stolen, const MidiNote &mnote, Instant time,
+             const Instrument &instrument, Hertz tuning,
+             const NoteExpression &expression, uint8_t channel,
+             const ChannelControllers &controllers) {
+    const Mask bit = Mask(1) << idx;
+    if (stolen)
+      _sostenuto &= ~bit;
+    _deferred &= ~bit;
+    _shared &= ~bit;
+    channel &= channel_count - 1;
+    _notes[idx].bend(controllers.bend);
+    _notes[idx].modulate_vibrato(controllers.vibrato_rate,
+                                 controllers.vibrato_depth);
+    _notes[idx].modulate_envelope(controllers.attack, controllers.release);
+    _notes[idx].gain(controllers.gain);
+    _notes[idx].note_bend(expression.bend);
+    _notes[idx].pressure(expression.pressure.value_or(controllers.pressure));
+    _notes[idx].timbre(expression.timbre);
+    _notes[idx].glide(glide_from(), _portamento_time);
+    _notes[idx].velocity_curve(_velocities);
+    _notes[idx].tempo(_beat);
     _notes[idx].start(mnote, time, instrument, tuning);
-    _numbers[idx] = mnote.number;
+    const uint8_t number = mnote.number & 0x7F;
+    const uint8_t before = _slots[number];
+    if (before != idx && before < _size && _notes[before].is_active() &&
+        _numbers[before] == number)
+      _shared |= Mask(1) << before;
+    _numbers[idx] = number;
+    _channels[idx] = channel;
+    _slots[number] = idx;
+    _channel_slots[channel] = idx;
+    _last = idx;
+    _tuning = tuning;
     return _notes[idx];
   }
-  void release(uint8_t number, Duration time) {
-    for (uint8_t i = 0; i < _size; i++) {
-      if (_notes[i].is_active() && _numbers[i] == number) {
-        _notes[i].release(time);
-        return;
+
+  void hold(uint8_t number) {
+    unhold(number);
+    if (_held_size == mono_keys)
+      unhold(_held[0]);
+    _held[_held_size++] = number;
+  }
+
+  void unhold(uint8_t number) {
+    auto end = _held.begin() + _held_size;
+    auto it = std::find(_held.begin(), end, number);
+    if (it != end) {
+      std::copy(it + 1, end, it);
+      _held_size--;
+    }
+  }
+
+  /// The held key that sounds in mono modes, there must be one
+  uint8_t priority() const {
+    auto end = _held.begin() + _held_size;
+    switch (_mode) {
+    case VoiceMode::High:
+      return *std::max_element(_held.begin(), end);
+    case VoiceMode::Low:
+      return *std::min_element(_held.begin(), end);
+    default:
+      return _held[_held_size - 1];
+    }
+  }
+
+  /// Moves the mono note to `number` while it keeps playing
+  void legato(uint8_t number) {
+    Note &note = _notes[0];
+    note.glide(glide_from(), _portamento_time);
+    note.legato({number, 0}, _tuning);
+    _numbers[0] = number;
+    _slots[number & 0x7F] = 0;
+  }
+
+  Note &start_mono(const MidiNote &mnote, Instant time,
+                   const Instrument &instrument, Hertz tuning,
+                   const NoteExpression &expression, uint8_t channel,
+                   const ChannelControllers &controllers) {
+    if (mnote.velocity == 0) {
+      release(mnote.number, time);
+      return _notes[0];
+    }
+    hold(mnote.number);
+    const uint8_t number = priority();
+    Note &note = _notes[0];
+    if (!note.is_active() || note.is_released())
+      return play(0, true, {number, mnote.velocity}, time, instrument, tuning,
+                  expression, channel, controllers);
+    if (number != _numbers[0]) {
+      _tuning = tuning;
+      legato(number);
+      note.note_bend(expression.bend);
+    }
+    return note;
+  }
+
+  void release_mono(uint8_t number, Instant time) {
+    unhold(number);
+    const Note &note = _notes[0];
+    if (!note.is_active() || note.is_released() || _numbers[0] != number)
+      return;
+    if (_held_size == 0)
+      release_at(0, time);
+    else
+      // Back to a key still held, without a new attack
+      legato(priority());
+  }
+
+public:
+  Voice() {
+    _slots.fill(no_slot);
+    _channel_slots.fill(no_slot);
+  }
+  Voice(uint8_t size) : Voice() { _size = std::min(size, MAX_NOTES); }
+
+  /**
+   * Starts a note, or restarts the one playing the same number from the same
+   * MIDI channel. The channel tells notes apart for the calls that find them
+   * by number, the note starts with its controllers.
+   */
+  Note &start(const MidiNote &mnote, Instant time,
+              const Instrument &instrument, Hertz tuning,
+              const NoteExpression &expression = {}, uint8_t channel = 0,
+              const ChannelControllers &controllers = {}) {
+    if (_mode != VoiceMode::Poly)
+      return start_mono(mnote, time, instrument, tuning, expression, channel,
+                        controllers);
+    uint8_t idx = slot_of(mnote.number, channel);
+    const bool same = idx < _size;
+    if (!same) {
+      idx = 0;
+      for (uint8_t i = 0; i < _size; i++) {
+        if (!_notes[i].is_active()) {
+          idx = i;
+          break;
+        }
       }
     }
+    if (same && mnote.velocity == 0) {
+      release_at(idx, time);
+      return _notes[idx];
+    }
+    return play(idx, !same, mnote, time, instrument, tuning, expression,
+                channel, controllers);
+  }
+  /// Releases a note, or defers it until the pedals holding it are up
+  void release(uint8_t number, Instant time, uint8_t channel = 0) {
+    if (_mode != VoiceMode::Poly)
+      return release_mono(number, time);
+    const uint8_t i = slot_of(number, channel);
+    if (i < _size)
+      release_at(i, time);
   }
-  inline void release(const MidiNote &mnote, Duration time) {
+  inline void release(const MidiNote &mnote, Instant time) {
     release(mnote.number, time);
   }
   void off() {
     for (uint8_t i = 0; i < _size; i++)
       _notes[i].off();
+    _sostenuto = _deferred = 0;
+    _held_size = 0;
+  }
+
+  /**
+   * Changes how held keys are played, see `VoiceMode`. The notes playing are
+   * turned off, they are found differently in the other mode.
+   */
+  void mode(VoiceMode mode) {
+    if (mode == _mode)
+      return;
+    off();
+    _mode = mode;
+  }
+  inline VoiceMode mode() const { return _mode; }
+
+  /// Portamento switch, new notes glide from the pitch of the latest one
+  void portamento(bool on) { _portamento = on; }
+  /// How long glides take, zero turns them off
+  void portamento_time(Duration32 time) { _portamento_time = time; }
+
+  /// Damper pedal, holds every released note of the channels while down
+  void sustain(bool down, Instant time, Channels channels = all_channels) {
+    if (down) {
+      _dampers |= channels;
+      return;
+    }
+    _dampers &= ~channels;
+    release_all(_deferred & ~_sostenuto & notes_of(channels), time);
+  }
+
+  /**
+   * Sostenuto pedal, holds the notes of the channels whose keys are down when
+   * pressed. Only pressing and lifting it count, controllers repeat the
+   * position while the pedal stays down, and the notes it holds stay held.
+   */
+  void sostenuto(bool down, Instant time, Channels channels = all_channels) {
+    channels &= down ? ~_sostenutos : _sostenutos;
+    if (!channels)
+      return;
+    const Mask notes = notes_of(channels);
+    if (down) {
+      _sostenutos |= channels;
+      Mask held = 0;
+      for (uint8_t i = 0; i < _size; i++)
+        if (_notes[i].is_active() && !_notes[i].is_released())
+          held |= Mask(1) << i;
+      _sostenuto = (_sostenuto & ~notes) | (held & notes & ~_deferred);
+    } else {
+      _sostenutos &= ~channels;
+      release_all(_deferred & _sostenuto & notes & ~notes_of(_dampers), time);
+      _sostenuto &= ~notes;
+    }
+  }
+
+  inline bool is_sustained() const { return _dampers != 0; }
+
+  /// Key pressure of a single note, polyphonic aftertouch
+  void pressure(uint8_t number, EnvelopeLevel level, uint8_t channel = 0) {
+    const uint8_t i = slot_of(number, channel);
+    if (i < _size)
+      _notes[i].pressure(level);
+  }
+
+  /// Pressure of the channels' notes, channel aftertouch
+  void pressure(EnvelopeLevel level, Channels channels = all_channels) {
+    each_note(channels, [&](Note &note) { note.pressure(level); });
+  }
+
+  /// Bends a single note, see `Note::note_bend`
+  void note_bend(uint8_t number, uint32_t multiplier, uint8_t channel = 0) {
+    const uint8_t i = slot_of(number, channel);
+    if (i < _size)
+      _notes[i].note_bend(multiplier);
+  }
+
+  /// Timbre of a single note, see `Note::timbre`
+  void timbre(uint8_t number, float depth, uint8_t channel = 0) {
+    const uint8_t i = slot_of(number, channel);
+    if (i < _size)
+      _notes[i].timbre(depth);
+  }
+
+  /// Modulates the vibrato of the channels, see `Note::modulate_vibrato`
+  void modulate_vibrato(float rate, float depth,
+                        Channels channels = all_channels) {
+    each_note(channels,
+              [&](Note &note) { note.modulate_vibrato(rate, depth); });
+  }
+
+  /// Volume of the channels, see `Note::gain`
+  void modulate_gain(float gain, Channels channels = all_channels) {
+    each_note(channels, [&](Note &note) { note.gain(gain); });
+  }
+
+  /// Tempo in beats per minute, see `Note::tempo`
+  void tempo(float bpm) {
+    _beat = Hertz(bpm / 60);
+    for (auto &note : _notes)
+      note.tempo(_beat);
+  }
+
+  /// Velocity response of the notes that follow
+  void velocity_curve(const VelocityCurve &curve) { _velocities = curve; }
+
+  /// @return true if an active note plays the instrument
+  bool plays(const Instrument *instrument) const {
+    for (uint8_t i = 0; i < _size; i++)
+      if (_notes[i].is_active() && _notes[i].instrument() == instrument)
+        return true;
+    return false;
+  }
+
+  /// Bends the notes of the channels, see `Note::bend`
+  void bend(uint32_t multiplier, Channels channels = all_channels) {
+    each_note(channels, [&](Note &note) { note.bend(multiplier); });
   }
 
   Note &next() {
-    uint8_t out = 0;
-    Duration min = Duration::max();
+    uint8_t out = _size;
+    Instant min;
     for (uint8_t i = 0; i < _size; i++) {
       if (!_notes[i].is_active())
         continue;
-      Duration time = _notes[i].current().start;
-      if (time < min) {
+      Instant time = _notes[i].current().start;
+      if (out == _size || time < min) {
         out = i;
         min = time;
       }
     }
-    return _notes[out];
+    return _notes[out == _size ? 0 : out];
   }
 
+  /**
+   * Changes the number of notes, active notes are moved to the front so as
+   * many of them as possible keep playing.
+   */
   void adjust_size(uint8_t size) {
-    if (size <= MAX_NOTES && size > 0 && size != _size) {
-      off();
-      _size = size;
+    if (size > MAX_NOTES || size == 0 || size == _size)
+      return;
+    uint8_t kept = 0;
+    Mask sostenuto = 0, deferred = 0, shared = 0;
+    for (uint8_t i = 0; i < _size; i++) {
+      if (!_notes[i].is_active())
+        continue;
+      if (kept < size) {
+        sostenuto |= ((_sostenuto >> i) & 1) << kept;
+        deferred |= ((_deferred >> i) & 1) << kept;
+        shared |= ((_shared >> i) & 1) << kept;
+      }
+      if (kept < size && kept != i) {
+        _notes[kept] = _notes[i];
+        _numbers[kept] = _numbers[i];
+        _channels[kept] = _channels[i];
+        if (_slots[_numbers[i]] == i)
+          _slots[_numbers[i]] = kept;
+        if (_channel_slots[_channels[i]] == i)
+          _channel_slots[_channels[i]] = kept;
+      }
+      if (kept >= size || kept != i)
+        _notes[i].off();
+      kept++;
     }
+    _sostenuto = sostenuto;
+    _deferred = deferred;
+    _shared = shared;
+    _size = size;
   }
   uint8_t active() const {
     uint8_t active = 0;
@@ -0,0 +1,57 @@
+#include "velocity.hpp"
+#include "envelope.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace teslasynth::synth {
+
+static float user_level(const VelocityCurve &curve, uint8_t velocity) {
+  auto points = curve.points;
+  std::stable_sort(points.begin(), points.end(),
+                   [](const VelocityPoint &a, const VelocityPoint &b) {
+                     return a.velocity < b.velocity;
+                   });
+  if (velocity <= points.front().velocity)
+    return points.front().level;
+  for (size_t i = 1; i < points.size(); i++) {
+    const VelocityPoint &a = points[i - 1], &b = points[i];
+    if (velocity <= b.velocity)
+      return a.level + (b.level - a.level) * float(velocity - a.velocity) /
+                           (b.velocity - a.velocity);
+  }
+  return points.back().level;
+}
+
+static EnvelopeLevel level(const VelocityCurve &curve, uint8_t velocity) {
+  switch (curve.type) {
+  case VelocityCurveType::Log:
+    return EnvelopeLevel::logscale(velocity * 2 + 1);
+  case VelocityCurveType::Linear:
+    return EnvelopeLevel(velocity / 127.f);
+  case VelocityCurveType::Exp:
+    return EnvelopeLevel((exp2f(velocity * 4 / 127.f) - 1) / 15);
+  case VelocityCurveType::Fixed:
+    return EnvelopeLevel(curve.fixed / 127.f);
+  case VelocityCurveType::User:
+    return EnvelopeLevel(user_level(curve, velocity) / 127.f);
+  }
+  return EnvelopeLevel::max();
+}
+
+VelocityTable::VelocityTable(const VelocityCurve &curve) : curve_(curve) {
+  for (uint8_t v = 0; v < levels_.size(); v++)
+    levels_[v] = level(curve, v);
+}
+
+const VelocityTable &VelocityTable::standard() {
+  static const VelocityTable table;
+  return table;
+}
+
+EnvelopeLevel velocity_level(const VelocityCurve &curve, uint8_t velocity) {
+  if (curve.type == VelocityCurveType::Log)
+    return VelocityTable::standard()[velocity];
+  return level(curve, velocity & 0x7F);
+}
+
+} // namespace teslasynth::synth
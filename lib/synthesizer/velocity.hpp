@@ -0,0 +1,72 @@
+#pragma once
+
+#include "envelope.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace teslasynth::synth {
+
+/// How note velocities turn into volume
+enum class VelocityCurveType : uint8_t {
+  Log,    // Loud early, the response notes always had
+  Linear, // Proportional to velocity
+  Exp,    // Quiet until played hard
+  Fixed,  // Every note at the same level, whatever the velocity
+  User,   // Straight lines through the points
+};
+
+struct VelocityPoint {
+  uint8_t velocity, level; // Both from 0 to 127
+
+  constexpr bool operator==(const VelocityPoint &b) const {
+    return velocity == b.velocity && level == b.level;
+  }
+};
+
+struct VelocityCurve {
+  static constexpr size_t max_points = 4;
+
+  VelocityCurveType type = VelocityCurveType::Log;
+  // Level of the fixed curve, from 0 to 127
+  uint8_t fixed = 127;
+  // Points of the user curve by increasing velocity, levels stay flat
+  // before the first and after the last one
+  std::array<VelocityPoint, max_points> points{
+      {{0, 0}, {42, 42}, {85, 85}, {127, 127}}};
+
+  constexpr bool operator==(const VelocityCurve &b) const {
+    return type == b.type && fixed == b.fixed && points == b.points;
+  }
+  constexpr bool operator!=(const VelocityCurve &b) const {
+    return !(*this == b);
+  }
+};
+
+/**
+ * Level of every velocity of a curve, worked out ahead so finding one is a
+ * lookup.
+ */
+class VelocityTable final {
+  std::array<EnvelopeLevel, 128> levels_;
+  VelocityCurve curve_;
+
+public:
+  explicit VelocityTable(const VelocityCurve &curve = {});
+
+  inline EnvelopeLevel operator[](uint8_t velocity) const {
+    return levels_[velocity & 0x7F];
+  }
+  inline const VelocityCurve &curve() const { return curve_; }
+
+  /// The log curve, for notes started without a curve of their own
+  static const VelocityTable &standard();
+};
+
+/**
+ * Level of a velocity on a curve, worked out when a note starts so voices
+ * don't keep a table each. The log curve is looked up in the standard table.
+ */
+EnvelopeLevel velocity_level(const VelocityCurve &curve, uint8_t velocity);
+
+} // namespace teslasynth::synth
@@ -0,0 +1,375 @@
+#pragma once
+
+#include "core.hpp"
+#include "midi_synth.hpp"
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <optional>
+
+/**
+ * Tagged encoding of the configuration.
+ *
+ * Every setting is a field of its own, identified by a section and a tag and
+ * holding a 32 bit value, so settings can be stored and updated one by one.
+ * Section zero is the synth configuration, channels follow from one.
+ *
+ * Tags are never reused. A field that changes meaning gets a new tag, so
+ * older firmware skips what it doesn't know and newer firmware keeps the
+ * defaults for what it doesn't find.
+ */
+namespace teslasynth::midisynth::codec {
+
+/// Format version 1 was the configuration struct stored as a raw blob
+constexpr uint8_t format_version = 2;
+
+struct Field {
+  uint8_t section, tag;
+  uint32_t value;
+
+  constexpr bool operator==(const Field &b) const {
+    return section == b.section && tag == b.tag && value == b.value;
+  }
+  constexpr bool operator!=(const Field &b) const { return !(*this == b); }
+};
+
+enum class SynthTag : uint8_t {
+  Tuning = 1,
+  Instrument = 2,
+  PowerDuty = 3,
+  PowerWindow = 4,
+  MaxConcurrent = 5,
+  MaxStagger = 6,
+};
+constexpr size_t synth_fields = 6;
+
+enum class ChannelTag : uint8_t {
+  MaxOnTime = 1,
+  MinDeadtime = 2,
+  DutyWindow = 3,
+  Notes = 4,
+  MaxDuty = 5,
+  Instrument = 6,
+  ThermalTimeConstant = 7,
+  ThermalDuty = 8,
+  HeatModel = 9,
+  DutyMode = 10,
+  VoiceMode = 11,
+  VelocityCurve = 12,
+  // Points of the user velocity curve, two in each
+  VelocityPoints = 13,
+  VelocityPointsHigh = 14,
+  // Route of each MIDI channel to the output, up to Route + 15
+  Route = 16,
+};
+constexpr size_t channel_fields = 14 + midi_channels;
+static_assert(VelocityCurve::max_points == 4,
+              "Two fields hold the points of the user velocity curve");
+
+template <std::uint8_t OUTPUTS>
+using Fields = std::array<Field, synth_fields + OUTPUTS * channel_fields>;
+
+namespace detail {
+constexpr uint32_t no_instrument = UINT32_MAX;
+
+inline uint32_t from_float(float v) {
+  uint32_t res;
+  std::memcpy(&res, &v, sizeof(res));
+  return res;
+}
+inline float to_float(uint32_t v) {
+  float res;
+  std::memcpy(&res, &v, sizeof(res));
+  return res;
+}
+
+constexpr uint32_t from_instrument(std::optional<uint8_t> v) {
+  return v ? *v : no_instrument;
+}
+constexpr bool to_instrument(uint32_t v, std::optional<uint8_t> &out) {
+  if (v == no_instrument)
+    out = {};
+  else if (v <= UINT8_MAX)
+    out = v;
+  else
+    return false;
+  return true;
+}
+
+template <typename T, uint32_t HZ>
+constexpr bool to_duration(uint32_t v, SimpleDuration<T, HZ> &out) {
+  if (v > std::numeric_limits<T>::max())
+    return false;
+  out = SimpleDuration<T, HZ>::ticks(v);
+  return true;
+}
+
+constexpr bool to_duty(uint32_t v, DutyCycle &out) {
+  if (v > DutyCycle::max().value())
+    return false;
+  out = DutyCycle::from_value(v);
+  return true;
+}
+
+// Enabled in bit 0, transpose and velocity in the next two bytes
+constexpr uint32_t from_route(const Route &route) {
+  return uint32_t(route.enabled) | uint32_t(uint8_t(route.transpose)) << 8 |
+         uint32_t(route.velocity) << 16;
+}
+constexpr bool to_route(uint32_t v, Route &out) {
+  const uint8_t velocity = v >> 16;
+  if ((v & 0xFF0000FE) != 0 || velocity > Route::max_velocity)
+    return false;
+  out = {.enabled = (v & 1) != 0,
+         .transpose = static_cast<int8_t>(v >> 8),
+         .velocity = velocity};
+  return true;
+}
+
+// Curve type in the first byte, the fixed level in the next one
+constexpr uint32_t from_velocity_curve(const VelocityCurve &curve) {
+  return static_cast<uint32_t>(curve.type) | uint32_t(curve.fixed) << 8;
+}
+constexpr bool to_velocity_curve(uint32_t v, VelocityCurve &out) {
+  if ((v & 0xFFFF8000) != 0 || (v & 0xFF) > uint8_t(VelocityCurveType::User))
+    return false;
+  out.type = static_cast<VelocityCurveType>(v & 0xFF);
+  out.fixed = v >> 8;
+  return true;
+}
+
+// A point in each half, its velocity in the low byte and level in the high
+constexpr uint32_t from_velocity_points(const VelocityCurve &curve,
+                                        size_t i) {
+  const VelocityPoint &a = curve.points[i], &b = curve.points[i + 1];
+  return uint32_t(a.velocity) | uint32_t(a.level) << 8 |
+         uint32_t(b.velocity) << 16 | uint32_t(b.level) << 24;
+}
+constexpr bool to_velocity_points(uint32_t v, VelocityCurve &out, size_t i) {
+  if ((v & 0x80808080) != 0)
+    return false;
+  out.points[i] = {uint8_t(v), uint8_t(v >> 8)};
+  out.points[i + 1] = {uint8_t(v >> 16), uint8_t(v >> 24)};
+  return true;
+}
+
+template <typename E> constexpr bool to_enum(uint32_t v, E last, E &out) {
+  if (v > static_cast<uint32_t>(last))
+    return false;
+  out = static_cast<E>(v);
+  return true;
+}
+
+inline bool decode(const Field &field, SynthConfig &config) {
+  const uint32_t v = field.value;
+  switch (static_cast<SynthTag>(field.tag)) {
+  case SynthTag::Tuning: {
+    const float hz = to_float(v);
+    if (!std::isfinite(hz) || hz <= 0)
+      return false;
+    config.a440 = Hertz(hz);
+    return true;
+  }
+  case SynthTag::Instrument:
+    return to_instrument(v, config.instrument);
+  case SynthTag::PowerDuty:
+    return to_duty(v, config.power_duty);
+  case SynthTag::PowerWindow:
+    return to_duration(v, config.power_window);
+  case SynthTag::MaxConcurrent:
+    if (v > UINT8_MAX)
+      return false;
+    config.max_concurrent = v;
+    return true;
+  case SynthTag::MaxStagger:
+    return to_duration(v, config.max_stagger);
+  }
+  return false;
+}
+
+inline bool decode(const Field &field, Config &config) {
+  const uint32_t v = field.value;
+  switch (static_cast<ChannelTag>(field.tag)) {
+  case ChannelTag::MaxOnTime:
+    return to_duration(v, config.max_on_time);
+  case ChannelTag::MinDeadtime:
+    return to_duration(v, config.min_deadtime);
+  case ChannelTag::DutyWindow:
+    return to_duration(v, config.duty_window);
+  case ChannelTag::Notes:
+    if (v < 1 || v > Config::max_notes)
+      return false;
+    config.notes = v;
+    return true;
+  case ChannelTag::MaxDuty:
+    return to_duty(v, config.max_duty);
+  case ChannelTag::Instrument:
+    return to_instrument(v, config.instrument);
+  case ChannelTag::ThermalTimeConstant:
+    return to_duration(v, config.thermal_time_constant);
+  case ChannelTag::ThermalDuty:
+    return to_duty(v, config.thermal_duty);
+  case ChannelTag::HeatModel:
+    return to_enum(v, HeatModel::Squared, config.heat_model);
+  case ChannelTag::DutyMode:
+    return to_enum(v, DutyMode::LookAhead, config.duty_mode);
+  case ChannelTag::VoiceMode:
+    return to_enum(v, VoiceMode::Low, config.voice_mode);
+  case ChannelTag::VelocityCurve:
+    return to_velocity_curve(v, config.velocity);
+  case ChannelTag::VelocityPoints:
+    return to_velocity_points(v, config.velocity, 0);
+  case ChannelTag::VelocityPointsHigh:
+    return to_velocity_points(v, config.velocity, 2);
+  case ChannelTag::Route:
+    // Routes are part of the whole configuration
+    break;
+  }
+  return false;
+}
+} // namespace detail
+
+template <std::uint8_t OUTPUTS>
+Fields<OUTPUTS> encode(const Configuration<OUTPUTS> &config) {
+  using namespace detail;
+  const SynthConfig &synth = config.synth_config;
+  Fields<OUTPUTS> fields = {{
+      {0, uint8_t(SynthTag::Tuning), from_float(synth.a440)},
+      {0, uint8_t(SynthTag::Instrument), from_instrument(synth.instrument)},
+      {0, uint8_t(SynthTag::PowerDuty), synth.power_duty.value()},
+      {0, uint8_t(SynthTag::PowerWindow), synth.power_window.ticks()},
+      {0, uint8_t(SynthTag::MaxConcurrent), synth.max_concurrent},
+      {0, uint8_t(SynthTag::MaxStagger), synth.max_stagger.ticks()},
+  }};
+  size_t i = synth_fields;
+  for (uint8_t ch = 0; ch < OUTPUTS; ch++) {
+    const Config &c = config.channel_configs[ch];
+    const uint8_t s = ch + 1;
+    fields[i++] = {s, uint8_t(ChannelTag::MaxOnTime), c.max_on_time.ticks()};
+    fields[i++] = {s, uint8_t(ChannelTag::MinDeadtime),
+                   c.min_deadtime.ticks()};
+    fields[i++] = {s, uint8_t(ChannelTag::DutyWindow), c.duty_window.ticks()};
+    fields[i++] = {s, uint8_t(ChannelTag::Notes), c.notes};
+    fields[i++] = {s, uint8_t(ChannelTag::MaxDuty), c.max_duty.value()};
+    fields[i++] = {s, uint8_t(ChannelTag::Instrument),
+                   from_instrument(c.instrument)};
+    fields[i++] = {s, uint8_t(ChannelTag::ThermalTimeConstant),
+                   c.thermal_time_constant.ticks()};
+    fields[i++] = {s, uint8_t(ChannelTag::ThermalDuty),
+                   c.thermal_duty.value()};
+    fields[i++] = {s, uint8_t(ChannelTag::HeatModel),
+                   static_cast<uint32_t>(c.heat_model)};
+    fields[i++] = {s, uint8_t(ChannelTag::DutyMode),
+                   static_cast<uint32_t>(c.duty_mode)};
+    fields[i++] = {s, uint8_t(ChannelTag::VoiceMode),
+                   static_cast<uint32_t>(c.voice_mode)};
+    fields[i++] = {s, uint8_t(ChannelTag::VelocityCurve),
+                   from_velocity_curve(c.velocity)};
+    fields[i++] = {s, uint8_t(ChannelTag::VelocityPoints),
+                   from_velocity_points(c.velocity, 0)};
+    fields[i++] = {s, uint8_t(ChannelTag::VelocityPointsHigh),
+                   from_velocity_points(c.velocity, 2)};
+    for (uint8_t m = 0; m < midi_channels; m++)
+      fields[i++] = {s, uint8_t(uint8_t(ChannelTag::Route) + m),
+                     from_route(config.routes[m][ch])};
+  }
+  return fields;
+}
+
+/**
+ * Applies a single field to the configuration.
+ *
+ * @return false if the field is unknown or its value is out of range, the
+ * configuration is left untouched in that case.
+ */
+template <std::uint8_t OUTPUTS>
+bool decode(const Field &field, Configuration<OUTPUTS> &config) {
+  if (field.section == 0)
+    return detail::decode(field, config.synth_config);
+  if (field.section > OUTPUTS)
+    return false;
+  const uint8_t route = uint8_t(ChannelTag::Route);
+  if (field.tag >= route && field.tag < route + midi_channels)
+    return detail::to_route(
+        field.value,
+        config.routes[field.tag - route][field.section - 1]);
+  return detail::decode(field, config.channel_configs[field.section - 1]);
+}
+
+/**
+ * The configuration struct stored as a blob by format version 1, frozen as it
+ * was laid out then so the blob can still be read after the struct changed.
+ * Durations were in microseconds, optionals a value followed by a flag.
+ */
+namespace legacy {
+struct Instrument {
+  uint8_t value, engaged;
+};
+static_assert(sizeof(Instrument) == sizeof(std::optional<uint8_t>),
+              "Legacy optionals are a value and a flag");
+
+struct Config {
+  uint16_t max_on_time, min_deadtime, duty_window;
+  uint8_t notes, max_duty;
+  Instrument instrument;
+};
+static_assert(sizeof(Config) == 10, "Legacy channel layout changed");
+
+struct SynthConfig {
+  float a440;
+  Instrument instrument;
+};
+static_assert(sizeof(SynthConfig) == 8, "Legacy synth layout changed");
+
+template <std::uint8_t OUTPUTS> struct Configuration {
+  SynthConfig synth_config;
+  std::array<Config, OUTPUTS> channel_configs;
+};
+
+namespace detail {
+inline std::optional<uint8_t> to_instrument(const Instrument &instrument) {
+  if (!instrument.engaged)
+    return {};
+  return instrument.value;
+}
+} // namespace detail
+
+/**
+ * Reads a version 1 blob, settings that are out of range keep their
+ * defaults.
+ *
+ * @return nothing if the blob isn't the size of a version 1 configuration
+ */
+template <std::uint8_t OUTPUTS>
+std::optional<midisynth::Configuration<OUTPUTS>> decode(const void *blob,
+                                                        size_t size) {
+  Configuration<OUTPUTS> legacy;
+  if (size != sizeof(legacy))
+    return {};
+  std::memcpy(&legacy, blob, size);
+
+  midisynth::Configuration<OUTPUTS> config;
+  const float a440 = legacy.synth_config.a440;
+  if (std::isfinite(a440) && a440 > 0)
+    config.synth_config.a440 = Hertz(a440);
+  config.synth_config.instrument =
+      detail::to_instrument(legacy.synth_config.instrument);
+  for (uint8_t i = 0; i < OUTPUTS; i++) {
+    const Config &from = legacy.channel_configs[i];
+    midisynth::Config &to = config.channel_configs[i];
+    to.max_on_time = Micros16::micros(from.max_on_time);
+    to.min_deadtime = Micros16::micros(from.min_deadtime);
+    to.duty_window = Micros16::micros(from.duty_window);
+    if (from.notes >= 1 && from.notes <= midisynth::Config::max_notes)
+      to.notes = from.notes;
+    to.max_duty = DutyCycle::from_value(from.max_duty);
+    to.instrument = detail::to_instrument(from.instrument);
+  }
+  return config;
+}
+} // namespace legacy
+
+} // namespace teslasynth::midisynth::codec
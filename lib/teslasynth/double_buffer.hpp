@@ -0,0 +1,82 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace teslasynth::midisynth {
+
+/**
+ * Hands values from a writer to readers without blocking either side.
+ *
+ * The writer fills the slot readers aren't looking at, marking the write by
+ * making the sequence odd, and publishes it by making the sequence even
+ * again. Readers copy the last published slot and check the sequence after,
+ * copying again only if the writer may have started writing that slot
+ * meanwhile, so they never keep a torn value and never wait for a write to
+ * finish. Writers must not publish concurrently.
+ */
+template <class T> class DoubleBuffer final {
+  std::array<T, 2> slots_{};
+  // Twice the number of values published, odd while one is being written
+  std::atomic<uint32_t> sequence_{0};
+  uint32_t consumed_ = 0;
+
+  // Slot of the last value published as of `sequence`
+  static constexpr uint8_t slot(uint32_t sequence) {
+    return (sequence >> 1) & 1;
+  }
+
+public:
+  DoubleBuffer() {}
+  DoubleBuffer(const T &initial) { slots_[0] = initial; }
+
+  /// Writer side, makes the value available to the reader
+  void publish(const T &value) {
+    const uint32_t sequence = sequence_.load(std::memory_order_relaxed);
+    sequence_.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slots_[slot(sequence + 2)] = value;
+    sequence_.store(sequence + 2, std::memory_order_release);
+  }
+
+  /**
+   * Copies the last published value, any number of readers can do this at
+   * the same time without blocking the writer.
+   *
+   * @return the version of the copy
+   */
+  uint32_t snapshot(T &out) const {
+    uint32_t sequence = sequence_.load(std::memory_order_acquire);
+    while (true) {
+      out = slots_[slot(sequence)];
+      std::atomic_thread_fence(std::memory_order_acquire);
+      const uint32_t now = sequence_.load(std::memory_order_relaxed);
+      // The copied slot is only written again by the write after next, or
+      // the next one if a write was already going on
+      if (now - sequence <= 2 - (sequence & 1))
+        return sequence >> 1;
+      sequence = sequence_.load(std::memory_order_acquire);
+    }
+  }
+
+  /**
+   * Copies the last published value if it hasn't been consumed yet, for the
+   * reader that applies the values.
+   *
+   * @return whether there was a new value
+   */
+  bool consume(T &out) {
+    if (version() == consumed_)
+      return false;
+    consumed_ = snapshot(out);
+    return true;
+  }
+
+  /// Changes every time a value is published
+  uint32_t version() const {
+    return sequence_.load(std::memory_order_acquire) >> 1;
+  }
+};
+
+} // namespace teslasynth::midisynth
@@ -0,0 +1,204 @@
+#pragma once
+
+#include "core.hpp"
+#include "envelope.hpp"
+#include "instruments.hpp"
+#include "lfo.hpp"
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <optional>
+
+/**
+ * Instruments stored as fixed size records in a single file.
+ *
+ * The file starts with a header, followed by one record per instrument, all
+ * values are little endian:
+ *
+ *   header  "TSIB", u16 version, u16 record size, u32 count, u32 reserved
+ *   record  name[16], u32 attack, u32 decay, u32 release (us), f32 sustain,
+ *           u8 curve, u8[3] reserved, f32 vibrato frequency, f32 depth,
+ *           f32 tremolo frequency, f32 depth, f32 beats
+ *
+ * Version 1 records end before the tremolo, their instruments have none.
+ * An instrument is found at `header_size + n * record size`, so loading one
+ * never scans the file. Records may grow in later versions, readers use the
+ * record size from the header and ignore what they don't know.
+ */
+namespace teslasynth::midisynth::bank {
+using namespace teslasynth::synth;
+
+constexpr uint8_t magic[4] = {'T', 'S', 'I', 'B'};
+constexpr uint16_t format_version = 2;
+constexpr size_t header_size = 16;
+constexpr size_t name_size = 16;
+constexpr size_t record_size = 56;
+// Size of version 1 records
+constexpr size_t min_record_size = 44;
+
+typedef std::array<uint8_t, header_size> Header;
+typedef std::array<uint8_t, record_size> Record;
+
+namespace detail {
+inline void put16(uint8_t *p, uint16_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+}
+inline void put32(uint8_t *p, uint32_t v) {
+  for (int i = 0; i < 4; i++)
+    p[i] = v >> (8 * i);
+}
+inline void putf(uint8_t *p, float v) {
+  uint32_t bits;
+  std::memcpy(&bits, &v, sizeof(bits));
+  put32(p, bits);
+}
+inline uint16_t get16(const uint8_t *p) { return p[0] | p[1] << 8; }
+inline uint32_t get32(const uint8_t *p) {
+  return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 |
+         uint32_t(p[3]) << 24;
+}
+inline float getf(const uint8_t *p) {
+  uint32_t bits = get32(p);
+  float v;
+  std::memcpy(&v, &bits, sizeof(v));
+  return v;
+}
+} // namespace detail
+
+inline Header encode_header(uint32_t count) {
+  Header header{};
+  std::memcpy(header.data(), magic, sizeof(magic));
+  detail::put16(&header[4], format_version);
+  detail::put16(&header[6], record_size);
+  detail::put32(&header[8], count);
+  return header;
+}
+
+inline Record encode(const Instrument &instrument, const char *name = "") {
+  using namespace detail;
+  Record record{};
+  std::strncpy(reinterpret_cast<char *>(record.data()), name, name_size);
+  const ADSR &env = instrument.envelope;
+  put32(&record[16], env.attack.micros());
+  put32(&record[20], env.decay.micros());
+  put32(&record[24], env.release.micros());
+  putf(&record[28], env.sustain);
+  record[32] = env.type;
+  putf(&record[36], instrument.vibrato.freq);
+  putf(&record[40], instrument.vibrato.depth);
+  putf(&record[44], instrument.tremolo.freq);
+  putf(&record[48], instrument.tremolo.depth);
+  putf(&record[52], instrument.tremolo.beats);
+  return record;
+}
+
+namespace detail {
+inline bool is_positive(float v) { return std::isfinite(v) && v >= 0; }
+} // namespace detail
+
+/**
+ * @param size of the record, shorter ones from older versions are missing
+ * what came later
+ * @return the instrument, or nothing if the record holds invalid values
+ */
+inline std::optional<Instrument> decode(const uint8_t *record,
+                                        size_t size = record_size) {
+  using namespace detail;
+  const float sustain = getf(&record[28]);
+  const float freq = getf(&record[36]), depth = getf(&record[40]);
+  if (!std::isfinite(sustain) || !is_positive(freq) || !is_positive(depth) ||
+      record[32] > CurveType::Const)
+    return {};
+  Tremolo tremolo = Tremolo::none();
+  if (size >= record_size) {
+    const float freq = getf(&record[44]), depth = getf(&record[48]),
+                beats = getf(&record[52]);
+    if (!is_positive(freq) || !is_positive(depth) || depth > 1 ||
+        !is_positive(beats))
+      return {};
+    tremolo = {Hertz(freq), EnvelopeLevel(depth), beats};
+  }
+  return Instrument{
+      .envelope = {Duration32::micros(get32(&record[16])),
+                   Duration32::micros(get32(&record[20])),
+                   EnvelopeLevel(sustain),
+                   Duration32::micros(get32(&record[24])),
+                   static_cast<CurveType>(record[32])},
+      .vibrato = {Hertz(freq), Hertz(depth)},
+      .tremolo = tremolo,
+  };
+}
+} // namespace teslasynth::midisynth::bank
+
+namespace teslasynth::midisynth {
+using namespace teslasynth::synth;
+
+/**
+ * Instruments read on demand from a bank file.
+ *
+ * An instrument costs a single read at a known offset. Nothing is kept in
+ * memory, the synth holds on to the instruments it plays, and reading touches
+ * nothing but the file so it can go on while the synth plays.
+ */
+class InstrumentBank final {
+public:
+  /// Reads `len` bytes at `offset` of the bank, false on a short read
+  typedef std::function<bool(uint32_t offset, uint8_t *data, size_t len)>
+      Reader;
+
+private:
+  Reader read_;
+  uint32_t count_ = 0;
+  uint16_t record_size_ = 0;
+  uint32_t loads_ = 0;
+
+public:
+  /**
+   * Validates the header and starts reading instruments through `reader`.
+   *
+   * @return false if the header isn't a supported bank, the bank is empty
+   * then.
+   */
+  bool open(Reader reader) {
+    *this = InstrumentBank();
+    bank::Header header;
+    if (!reader(0, header.data(), header.size()) ||
+        std::memcmp(header.data(), bank::magic, sizeof(bank::magic)) != 0)
+      return false;
+    const uint16_t version = bank::detail::get16(&header[4]);
+    const uint16_t record_size = bank::detail::get16(&header[6]);
+    if (version == 0 || record_size < bank::min_record_size)
+      return false;
+    read_ = reader;
+    record_size_ = record_size;
+    count_ = std::min<uint32_t>(bank::detail::get32(&header[8]), UINT16_MAX);
+    return true;
+  }
+
+  inline size_t size() const { return count_; }
+
+  /// Number of records read from the bank so far
+  inline uint32_t loads() const { return loads_; }
+
+  /**
+   * @return the instrument, or nothing if it isn't in the bank or its record
+   * can't be read
+   */
+  std::optional<Instrument> read(uint16_t n) {
+    if (n >= count_)
+      return {};
+    bank::Record record;
+    const uint32_t offset = bank::header_size + uint32_t(n) * record_size_;
+    const size_t size = std::min<size_t>(record_size_, record.size());
+    loads_++;
+    if (!read_(offset, record.data(), size))
+      return {};
+    return bank::decode(record.data(), size);
+  }
+};
+
+} // namespace teslasynth::midisynth
@@ -3,13 +3,21 @@
 #include "../midi/midi_core.hpp"
 #include "../synthesizer/notes.hpp"
 #include "core.hpp"
+#include "instrument_bank.hpp"
 #include "instruments.hpp"
+#include "modulation.hpp"
+#include "mpe.hpp"
+#include "pitch_bend.hpp"
 #include <algorithm>
 #include <array>
 #include <cassert>
+#include <cmath>
 #include <cstddef>
 #include <cstdint>
 #include <functional>
+#include <initializer_list>
+#include <memory>
+#include <optional>
 
 #ifndef CONFIG_DEFAULT_MAX_DUTY
 #define CONFIG_DEFAULT_MAX_DUTY 100
@@ -23,7 +31,7 @@ using namespace teslasynth::midi;
 
 template <unsigned int OUTPUTS = 1> class TrackState {
   Duration _started;
-  std::array<Duration, OUTPUTS> _received, _played;
+  std::array<Instant, OUTPUTS> _received, _played;
   bool _playing = false;
   TrackStateCallback _cb;
 
@@ -31,8 +39,8 @@ public:
   TrackState(TrackStateCallback cb = [](bool) {}) : _cb(cb) {}
   constexpr bool is_playing() const { return _playing; }
   constexpr Duration started_time() const { return _started; }
-  constexpr Duration received_time(uint8_t ch) const { return _received[ch]; }
-  constexpr Duration played_time(uint8_t ch) const { return _played[ch]; }
+  constexpr Instant received_time(uint8_t ch) const { return _received[ch]; }
+  constexpr Instant played_time(uint8_t ch) const { return _played[ch]; }
 
   /**
    * Stops and resets both track's clocks
@@ -41,7 +49,7 @@ public:
     _playing = false;
     _started = Duration::zero();
     for (uint8_t i = 0; i < OUTPUTS; i++) {
-      _received[i] = _played[i] = Duration::zero();
+      _received[i] = _played[i] = Instant();
     }
     _cb(_playing);
   }
@@ -50,9 +58,9 @@ public:
    * Advances the receive clock, starts playing if not already playing
    *
    * @param time Absolute current time
-   * @return the absolute time of relative to track start time
+   * @return the time relative to track start time, on the track's timeline
    */
-  Duration on_receive(uint8_t ch, Duration time) {
+  Instant on_receive(uint8_t ch, Duration time) {
     if (!_playing) {
       _playing = true;
       _started = time;
@@ -63,7 +71,7 @@ public:
       _received[ch] = *d;
       return _received[ch];
     }
-    return Duration::zero();
+    return Instant();
   }
 
   /**
@@ -72,9 +80,9 @@ public:
    * @param delta The time to add to the current clock
    * @return the amount of time that added to the clock
    */
-  Duration on_play(uint8_t ch, Duration delta) {
+  Duration32 on_play(uint8_t ch, Duration32 delta) {
     if (!_playing) {
-      return Duration::zero();
+      return Duration32::zero();
     }
 
     _played[ch] += delta;
@@ -86,7 +94,20 @@ struct Pulse {
   Duration16 on, off;
 
   constexpr bool is_zero() const { return on.is_zero(); }
-  constexpr Duration32 length() const { return on + off; }
+  constexpr Duration32 length() const { return Duration32(on) + off; }
+
+  /**
+   * Extends an idle pulse with the silence of the next one.
+   *
+   * @return false if either pulse is not idle or the silence doesn't fit
+   */
+  constexpr bool merge(const Pulse &next) {
+    uint32_t total = off.ticks() + next.off.ticks();
+    if (!is_zero() || !next.is_zero() || total > Duration16::max().ticks())
+      return false;
+    off = Duration16::ticks(total);
+    return true;
+  }
 
   inline operator std::string() const {
     return std::string("Pulse[on:") + std::string(on) +
@@ -117,6 +138,29 @@ template <std::uint8_t OUTPUTS = 1, std::size_t SIZE = 64> struct PulseBuffer {
   }
 };
 
+/**
+ * Progress of a render window that is sampled in chunks.
+ * Keeps the time left to render for each channel, so the next chunk resumes
+ * exactly where the previous one stopped.
+ */
+template <std::uint8_t OUTPUTS = 1> struct RenderWindow {
+  std::array<uint32_t, OUTPUTS> left{};
+  // Silence already rendered but not yet written, in ticks
+  std::array<uint16_t, OUTPUTS> held{};
+  // Set once the first chunk of the window is rendered
+  bool started = false;
+
+  constexpr RenderWindow() {}
+  constexpr RenderWindow(Duration32 length) { left.fill(length.ticks()); }
+
+  constexpr bool done() const {
+    for (auto l : left)
+      if (l > 0)
+        return false;
+    return true;
+  }
+};
+
 /**
  * A numeric value representing duty cycle.
  * Max value: 100%
@@ -146,6 +190,13 @@ public:
   constexpr static DutyCycle min() { return DutyCycle(0); }
   constexpr uint8_t value() const { return value_; }
   constexpr uint8_t inverse() const { return max_value - value_; }
+
+  /// Duty cycle from its raw value, as returned by value()
+  constexpr static DutyCycle from_value(uint8_t value) {
+    DutyCycle res;
+    res.value_ = std::min<uint8_t>(value, max_value);
+    return res;
+  }
   constexpr operator float() const {
     return value_ / static_cast<float>(max_value);
   }
@@ -155,14 +206,37 @@ public:
   }
 };
 
+/**
+ * How a pulse's on-time translates into heat in the coil.
+ * Squared is the I²t model, normalized so a pulse of max on-time heats the
+ * same in both models.
+ */
+enum class HeatModel : uint8_t { Linear, Squared };
+
+/**
+ * What happens to a pulse that doesn't fit in the duty budget.
+ * Drop turns it into silence, Scale shortens it to what is left of the
+ * budget, and LookAhead spreads the budget over the pulses expected in the
+ * window so they are all shortened evenly.
+ */
+enum class DutyMode : uint8_t { Drop, Scale, LookAhead };
+
 struct Config {
   static constexpr uint8_t max_notes = CONFIG_MAX_NOTES;
   static constexpr float default_max_duty = CONFIG_DEFAULT_MAX_DUTY;
 
-  Duration16 max_on_time = 100_us, min_deadtime = 100_us, duty_window = 10_ms;
+  Micros16 max_on_time = 100_us, min_deadtime = 100_us, duty_window = 10_ms;
   uint8_t notes = max_notes;
   DutyCycle max_duty = DutyCycle(CONFIG_DEFAULT_MAX_DUTY);
   std::optional<uint8_t> instrument = {};
+  // Thermal limit, the coil can take thermal_duty at max on-time
+  // continuously. Disabled when the time constant is zero.
+  Millis16 thermal_time_constant = Millis16::zero();
+  DutyCycle thermal_duty = DutyCycle::max();
+  HeatModel heat_model = HeatModel::Squared;
+  DutyMode duty_mode = DutyMode::Drop;
+  VoiceMode voice_mode = VoiceMode::Poly;
+  VelocityCurve velocity = {};
 
   inline operator std::string() const {
     return std::string("Concurrent notes: ") + std::to_string(notes) +
@@ -170,23 +244,86 @@ struct Config {
            "\nMin deadtime: " + std::string(min_deadtime) +
            "\nMax duty: " + std::string(max_duty) +
            "\nDuty window: " + std::string(duty_window) +
-           "\nInstrument: " + (instrument ? std::to_string(*instrument) : "-");
+           "\nInstrument: " + (instrument ? std::to_string(*instrument) : "-") +
+           "\nThermal time constant: " + std::string(thermal_time_constant) +
+           "\nThermal duty: " + std::string(thermal_duty) +
+           "\nHeat model: " +
+           (heat_model == HeatModel::Squared ? "I2t" : "linear") +
+           "\nDuty mode: " +
+           (duty_mode == DutyMode::Drop    ? "drop"
+            : duty_mode == DutyMode::Scale ? "scale"
+                                           : "look-ahead") +
+           "\nVoice mode: " +
+           (voice_mode == VoiceMode::Poly   ? "poly"
+            : voice_mode == VoiceMode::Last ? "mono, last note"
+            : voice_mode == VoiceMode::High ? "mono, high note"
+                                            : "mono, low note") +
+           "\nVelocity curve: " +
+           (velocity.type == VelocityCurveType::Log      ? "log"
+            : velocity.type == VelocityCurveType::Linear ? "linear"
+            : velocity.type == VelocityCurveType::Exp    ? "exp"
+            : velocity.type == VelocityCurveType::Fixed  ? "fixed"
+                                                         : "user");
   }
 };
 
 struct SynthConfig {
   Hertz a440 = 440_hz;
   std::optional<uint8_t> instrument = {};
+  // Shared power supply limits. Power duty is relative to all outputs
+  // running at full duty, max concurrent of zero means no limit.
+  DutyCycle power_duty = DutyCycle::max();
+  Micros16 power_window = 10_ms;
+  uint8_t max_concurrent = 0;
+  // Pulses that would start while another output is on can be delayed by up
+  // to this much to interleave them, zero turns staggering off.
+  Micros16 max_stagger = Micros16::zero();
 
   inline operator std::string() const {
     return std::string("Tuning: ") + std::string(a440) +
-           "\nInstrument: " + (instrument ? std::to_string(*instrument) : "-");
+           "\nInstrument: " + (instrument ? std::to_string(*instrument) : "-") +
+           "\nPower duty: " + std::string(power_duty) +
+           "\nPower window: " + std::string(power_window) +
+           "\nMax concurrent: " +
+           (max_concurrent ? std::to_string(max_concurrent) : "-") +
+           "\nMax stagger: " + std::string(max_stagger);
   }
 };
 
+constexpr uint8_t midi_channels = 16;
+
+/// How a MIDI channel plays on an output
+struct Route {
+  static constexpr uint8_t unity_velocity = 100;
+  static constexpr uint8_t max_velocity = 200;
+
+  bool enabled = false;
+  int8_t transpose = 0; // Semitones
+  // Percent of the received velocity
+  uint8_t velocity = unity_velocity;
+
+  constexpr bool operator==(const Route &b) const {
+    return enabled == b.enabled && transpose == b.transpose &&
+           velocity == b.velocity;
+  }
+};
+
+template <std::uint8_t OUTPUTS>
+using Routes = std::array<std::array<Route, OUTPUTS>, midi_channels>;
+
+/// Each of the first MIDI channels plays on the output of the same number
+template <std::uint8_t OUTPUTS> constexpr Routes<OUTPUTS> default_routes() {
+  Routes<OUTPUTS> routes{};
+  for (uint8_t ch = 0; ch < OUTPUTS && ch < midi_channels; ch++)
+    routes[ch][ch].enabled = true;
+  return routes;
+}
+
 template <std::uint8_t OUTPUTS = 1> struct Configuration {
   SynthConfig synth_config;
   std::array<Config, OUTPUTS> channel_configs{};
+  // Outputs each MIDI channel plays on, by MIDI channel then output
+  Routes<OUTPUTS> routes = default_routes<OUTPUTS>();
 
   constexpr Configuration() {}
   constexpr Configuration(const SynthConfig &synth_config,
@@ -199,32 +336,115 @@ template <std::uint8_t OUTPUTS = 1> struct Configuration {
 
   SynthConfig &synth() { return synth_config; }
   Config &channel(uint8_t ch) { return channel_configs[ch]; }
+  Route &route(uint8_t midi_channel, uint8_t output) {
+    return routes[midi_channel][output];
+  }
   constexpr uint8_t channels_size() const { return OUTPUTS; }
 };
 
+/// How much on-time the duty limiter took away from the pulses
+struct DutyStats {
+  uint32_t pulses = 0, attenuated = 0, dropped = 0;
+  Duration requested = Duration::zero(), granted = Duration::zero();
+
+  /// Fraction of the requested on-time that was taken away
+  inline float attenuation() const {
+    return requested.is_zero()
+               ? 0
+               : 1 - granted.ticks() / static_cast<float>(requested.ticks());
+  }
+};
+
 class DutyLimiter final {
-  uint16_t max_budget_ = 0, budget_ = 0, replenishing_ = 0;
+  // In ticks, so pulses are accounted for exactly as they are emitted
+  uint32_t max_budget_ = 0, budget_ = 0, replenishing_ = 0;
   DutyCycle duty_;
+  DutyMode mode_ = DutyMode::Drop;
+  // Average time between pulses and the time since the last one, to
+  // estimate how many pulses are coming until the budget is refilled.
+  uint32_t period_ = 0, since_ = 0;
+  DutyStats stats_;
+
+  uint32_t allowance(uint32_t requested) const {
+    switch (mode_) {
+    case DutyMode::Drop:
+      return requested <= budget_ ? requested : 0;
+    case DutyMode::Scale:
+      return std::min<uint32_t>(requested, budget_);
+    case DutyMode::LookAhead:
+      break;
+    }
+    if (period_ == 0)
+      return std::min<uint32_t>(requested, budget_);
+    // The budget is refilled once enough off-time has passed, what is left
+    // is shared by the pulses expected until then. Only off-time refills,
+    // so n pulses of period T bring back n * (T - budget / n) * duty.
+    const uint32_t refill = max_budget_ - replenishing_;
+    const auto brought_back = [&](uint32_t n) -> uint32_t {
+      return n * static_cast<uint32_t>(
+                     (period_ - std::min(period_, budget_ / n)) * duty_);
+    };
+    uint32_t n = std::max<uint32_t>(
+        1, (refill + budget_ * duty_) / (period_ * duty_ + 1));
+    while (n < budget_ && brought_back(n) < refill)
+      n++;
+    return std::min<uint32_t>(requested, budget_ / n);
+  }
 
 public:
   DutyLimiter() : duty_(DutyCycle::max()) {}
-  DutyLimiter(const DutyCycle &duty, const Duration16 window = 10_ms)
-      : max_budget_(window.micros() * duty), budget_(max_budget_), duty_(duty) {
-  }
-  DutyLimiter(const Config &config) : DutyLimiter(config.max_duty) {}
+  DutyLimiter(const DutyCycle &duty, const Micros16 window = 10_ms,
+              DutyMode mode = DutyMode::Drop)
+      : max_budget_(Duration32(window).ticks() * duty), budget_(max_budget_),
+        duty_(duty), mode_(mode) {}
+  DutyLimiter(const Config &config)
+      : DutyLimiter(config.max_duty, config.duty_window, config.duty_mode) {}
 
   bool can_use(const Duration16 &on) {
     if (duty_.is_max())
       return true;
-    if (on.micros() <= budget_) {
-      budget_ -= on.micros();
+    if (on.ticks() <= budget_) {
+      budget_ -= on.ticks();
       return true;
     }
     return false;
   }
 
+  /**
+   * Takes on-time from the budget according to the mode.
+   *
+   * @return the on-time that can be used, zero if the pulse is dropped
+   */
+  Duration16 grant(const Duration16 &on) {
+    if (on.is_zero())
+      return on;
+    stats_.pulses++;
+    stats_.requested += on;
+    if (since_ > 0) {
+      period_ = period_ == 0 ? since_ : (3ull * period_ + since_) / 4;
+      since_ = 0;
+    }
+
+    Duration16 granted = on;
+    if (!duty_.is_max()) {
+      const uint32_t requested = on.ticks(), allowed = allowance(requested);
+      budget_ -= allowed;
+      granted = Duration16::ticks(allowed);
+    }
+
+    if (granted.is_zero())
+      stats_.dropped++;
+    else if (granted < on)
+      stats_.attenuated++;
+    stats_.granted += granted;
+    since_ += granted.ticks();
+    return granted;
+  }
+
   void replenish(const Duration16 &off) {
-    uint32_t total = replenishing_ + (off.micros() * duty_);
+    // Saturates over long silences, where the period doesn't matter
+    since_ += std::min<uint32_t>(off.ticks(), UINT32_MAX - since_);
+    uint32_t total = replenishing_ + static_cast<uint32_t>(off.ticks() * duty_);
     if (total >= max_budget_) {
       budget_ = max_budget_;
       replenishing_ = 0;
@@ -233,7 +453,191 @@ public:
     }
   }
 
-  constexpr Duration16 budget() const { return Duration16::micros(budget_); }
+  /// Keeps what is left of the budget and the stats of a previous limiter
+  void carry_over(const DutyLimiter &previous) {
+    if (!previous.duty_.is_max())
+      budget_ = std::min(budget_, previous.budget_);
+    period_ = previous.period_;
+    stats_ = previous.stats_;
+  }
+
+  constexpr Duration32 budget() const { return Duration32::ticks(budget_); }
+  constexpr const DutyStats &stats() const { return stats_; }
+};
+
+/**
+ * Thermal model of a coil, attenuates on-time as the coil heats up.
+ *
+ * Heat is counted in ticks of on-time at max on-time, and cools
+ * exponentially with the configured time constant. The limit is the steady
+ * state heat of running at the thermal duty. Above the knee pulses are
+ * scaled down gradually, and never beyond what is left to the limit.
+ */
+class ThermalLimiter final {
+  static constexpr float knee = 0.75f;
+
+  float heat_ = 0, max_heat_ = 0, inv_tau_ = 0, inv_max_on_ = 0;
+  HeatModel model_ = HeatModel::Linear;
+
+  constexpr float heat_of(float on) const {
+    return model_ == HeatModel::Squared ? on * on * inv_max_on_ : on;
+  }
+  inline float on_for(float heat) const {
+    return model_ == HeatModel::Squared ? sqrtf(heat / inv_max_on_) : heat;
+  }
+
+public:
+  ThermalLimiter() {}
+  ThermalLimiter(const Config &config) : model_(config.heat_model) {
+    if (config.thermal_time_constant.is_zero() || config.thermal_duty.is_max())
+      return;
+    const float tau = Duration32(config.thermal_time_constant).ticks();
+    max_heat_ = tau * config.thermal_duty;
+    inv_tau_ = 1 / tau;
+    inv_max_on_ =
+        1.f / std::max<uint32_t>(1, Duration32(config.max_on_time).ticks());
+  }
+
+  constexpr bool is_enabled() const { return inv_tau_ > 0; }
+
+  /**
+   * Takes the heat of a pulse.
+   *
+   * @return the on-time that can be used, at most the requested one
+   */
+  Duration16 grant(const Duration16 &on) {
+    if (!is_enabled() || on.is_zero())
+      return on;
+    const float requested = on.ticks();
+    float granted = requested;
+    const float load = heat_ / max_heat_;
+    if (load > knee)
+      granted *= std::max(0.f, (1 - load) / (1 - knee));
+    granted = std::min(granted, on_for(std::max(0.f, max_heat_ - heat_)));
+    heat_ += heat_of(granted);
+    if (granted >= requested)
+      return on;
+    return Duration16::ticks(static_cast<uint16_t>(granted));
+  }
+
+  /// Cools down over the given time, usually the length of the last pulse
+  void cool(const Duration32 &elapsed) {
+    if (!is_enabled())
+      return;
+    // Bilinear approximation of the exponential decay, stable for any step
+    const float x = elapsed.ticks() * inv_tau_;
+    heat_ = x >= 2 ? 0 : heat_ * (2 - x) / (2 + x);
+  }
+
+  /// Current heat relative to the limit
+  constexpr float load() const {
+    return is_enabled() ? heat_ / max_heat_ : 0;
+  }
+
+  /// Keeps the load of a previous limiter, the coil doesn't cool on reload
+  void carry_over(const ThermalLimiter &previous) {
+    heat_ = previous.load() * max_heat_;
+  }
+};
+
+/**
+ * Arbitrates a power supply shared by all outputs.
+ *
+ * Limits the combined duty of all outputs over a window, and how many
+ * outputs may be on at the same time. Every output is guaranteed an equal
+ * share of the budget, shares left unused by quiet outputs go into a pool
+ * that busy outputs can draw from.
+ */
+template <std::uint8_t OUTPUTS = 1> class PowerArbiter final {
+  std::array<uint32_t, OUTPUTS> credit_{}, denied_{};
+  std::array<Instant, OUTPUTS> on_until_{};
+  uint32_t pool_ = 0, share_ = 0, max_budget_ = 0;
+  float rate_ = 0;
+  uint8_t max_concurrent_ = OUTPUTS;
+
+  // Pulses are shorter than the largest Duration16, an end further ahead is
+  // from an output that has been quiet for longer than the timeline orders
+  inline bool is_on(uint8_t i, Instant at) const {
+    const auto ahead = on_until_[i] - at;
+    return ahead && !ahead->is_zero() && *ahead <= Duration16::max();
+  }
+
+public:
+  PowerArbiter() {}
+  PowerArbiter(const SynthConfig &config)
+      : max_concurrent_(config.max_concurrent > 0 &&
+                                config.max_concurrent < OUTPUTS
+                            ? config.max_concurrent
+                            : OUTPUTS) {
+    if (config.power_duty.is_max())
+      return;
+    share_ = Duration32(config.power_window).ticks() * config.power_duty;
+    max_budget_ = share_ * OUTPUTS;
+    rate_ = config.power_duty;
+    credit_.fill(share_);
+  }
+
+  constexpr bool is_limited() const { return rate_ > 0; }
+
+  /**
+   * Decides whether an output can be on for the given time.
+   *
+   * @param at Start of the pulse on the track's timeline
+   */
+  bool can_use(uint8_t ch, Instant at, const Duration16 &on) {
+    if (on.is_zero())
+      return true;
+    if (max_concurrent_ < OUTPUTS) {
+      uint8_t concurrent = 0;
+      for (uint8_t i = 0; i < OUTPUTS; i++)
+        concurrent += i != ch && is_on(i, at);
+      if (concurrent >= max_concurrent_) {
+        denied_[ch]++;
+        return false;
+      }
+    }
+    if (is_limited()) {
+      const uint32_t need = on.ticks();
+      if (credit_[ch] >= need) {
+        credit_[ch] -= need;
+      } else if (credit_[ch] + pool_ >= need) {
+        pool_ -= need - credit_[ch];
+        credit_[ch] = 0;
+      } else {
+        denied_[ch]++;
+        return false;
+      }
+    }
+    on_until_[ch] = at + on;
+    return true;
+  }
+
+  void replenish(uint8_t ch, const Duration32 &elapsed) {
+    if (!is_limited())
+      return;
+    credit_[ch] += elapsed.ticks() * rate_;
+    if (credit_[ch] <= share_)
+      return;
+    // Whatever this output can't hold goes to the pool, as long as the
+    // total stays within the budget of the window
+    uint32_t stored = 0;
+    for (auto c : credit_)
+      stored += std::min(c, share_);
+    pool_ = std::min(pool_ + credit_[ch] - share_, max_budget_ - stored);
+    credit_[ch] = share_;
+  }
+
+  /// Number of pulses dropped on an output
+  constexpr uint32_t denied(uint8_t ch) const { return denied_[ch]; }
+
+  /// End of the latest pulse on other outputs, or `at` if they are all off
+  Instant busy_until(uint8_t ch, Instant at) const {
+    Instant until = at;
+    for (uint8_t i = 0; i < OUTPUTS; i++)
+      if (i != ch && is_on(i, at) && on_until_[i] > until)
+        until = on_until_[i];
+    return until;
+  }
 };
 
 template <std::uint8_t OUTPUTS = 1, class N = Voice<>> class Teslasynth final {
@@ -241,16 +645,212 @@ template <std::uint8_t OUTPUTS = 1, class N = Voice<>> class Teslasynth final {
   TrackState<OUTPUTS> _track;
   Instrument const *_instruments = instruments.begin();
   size_t _instruments_size = instruments.size();
-  std::array<uint8_t, OUTPUTS> current_instrument_{};
+  InstrumentBank *_bank = nullptr;
+  // Program of each part, the notes received on a MIDI channel
+  std::array<uint8_t, midi_channels> bank_select_{};
+  std::array<uint16_t, midi_channels> program_{};
+  // Controllers of each part, they apply to its notes on every output
+  struct Controllers {
+    RegisteredParameter rpn;
+    PitchBend bend;
+    ModulationMatrix mod;
+    uint8_t pressure = 0;
+  };
+  std::array<Controllers, midi_channels> controllers_{};
+  Mpe mpe_;
+  // MIDI clock, counted over a beat to measure the tempo
+  static constexpr uint8_t clocks_per_beat = 24;
+  float tempo_ = 120;
+  uint8_t clocks_ = 0;
+  Duration beat_start_;
+
+  // A route resolved for the message handler, velocity is fixed point
+  struct Target {
+    static constexpr uint8_t velocity_shift = 8;
+    uint8_t output = 0;
+    int8_t transpose = 0;
+    uint16_t velocity = 1 << velocity_shift;
+
+    /// @return the transposed note, or nothing if it is out of range
+    inline std::optional<uint8_t> note(uint8_t number) const {
+      const int n = number + transpose;
+      if (n < 0 || n > 127)
+        return {};
+      return n;
+    }
+    // Note on velocity zero is a note off, which stays as it is
+    inline uint8_t scale(uint8_t v) const {
+      if (v == 0)
+        return 0;
+      const uint32_t scaled = (v * velocity + (1u << (velocity_shift - 1))) >>
+                              velocity_shift;
+      return std::clamp<uint32_t>(scaled, 1, 127);
+    }
+  };
+  struct Targets {
+    uint8_t size = 0;
+    std::array<Target, OUTPUTS> targets;
+  };
+  std::array<Targets, midi_channels> routes_{};
+
+  // Instrument of each part and of each output the configuration sets one
+  // for, resolved when they change so notes start without looking them up. A
+  // number without an instrument is in the bank and not read yet.
+  struct Resolved {
+    static constexpr uint16_t none = UINT16_MAX;
+    uint16_t number = none;
+    const Instrument *instrument = nullptr;
+
+    inline bool missing() const { return number != none && !instrument; }
+  };
+  std::array<Resolved, midi_channels> parts_{};
+  std::array<Resolved, OUTPUTS> configured_{};
+
+  // Instruments read from the bank, the ones used last are kept. Notes keep a
+  // reference to theirs, so a slot is only reused once no note or output
+  // refers to it, parts just read theirs again. Allocated with the bank.
+  struct Loaded {
+    uint16_t number = Resolved::none;
+    uint32_t used = 0;
+    Instrument instrument;
+  };
+  static constexpr size_t cached_instruments = OUTPUTS + 4;
+  typedef std::array<Loaded, cached_instruments> Cache;
+  std::unique_ptr<Cache> loaded_;
+  uint32_t uses_ = 0;
+
+  bool playing(const Loaded &slot) const {
+    for (uint8_t i = 0; i < OUTPUTS; i++)
+      if (_voices[i].plays(&slot.instrument))
+        return true;
+    return false;
+  }
+
+  bool in_use(const Loaded &slot) const {
+    for (const auto &output : configured_)
+      if (output.instrument == &slot.instrument)
+        return true;
+    return playing(slot);
+  }
+
+  bool full() const {
+    return std::all_of(loaded_->begin(), loaded_->end(),
+                       [this](const Loaded &slot) { return in_use(slot); });
+  }
+
+  /// Slot to read an instrument into, or nullptr if all are in use
+  Loaded *evict() {
+    Loaded *oldest = nullptr;
+    for (auto &slot : *loaded_)
+      if (!in_use(slot) && (!oldest || slot.used < oldest->used))
+        oldest = &slot;
+    if (!oldest)
+      return nullptr;
+    for (auto &part : parts_)
+      if (part.instrument == &oldest->instrument)
+        part.instrument = nullptr;
+    return oldest;
+  }
+
+  /// @return the instrument, or nullptr if the bank has it and it isn't read
+  const Instrument *resident(uint16_t n) const {
+    if (!_bank)
+      return n < _instruments_size ? &_instruments[n] : &default_instrument();
+    if (n >= _bank->size())
+      return &default_instrument();
+    for (const auto &slot : *loaded_)
+      if (slot.number == n)
+        return &slot.instrument;
+    return nullptr;
+  }
+
+  // Marks a bank instrument as used, so it is the last one evicted
+  void touch(const Instrument *instrument) {
+    if (!_bank)
+      return;
+    for (auto &slot : *loaded_)
+      if (&slot.instrument == instrument)
+        slot.used = ++uses_;
+  }
+
+  inline Resolved resolve(std::optional<uint16_t> n) const {
+    if (!n)
+      return {};
+    return {*n, resident(*n)};
+  }
+
+  void resolve_all() {
+    for (uint8_t part = 0; part < midi_channels; part++)
+      parts_[part] = resolve(program_[part]);
+    for (uint8_t i = 0; i < OUTPUTS; i++) {
+      const auto &n = config_.channel_configs[i].instrument;
+      configured_[i] = resolve(n ? n : config_.synth_config.instrument);
+    }
+  }
+
+  // Max on time in ticks, so scaling it by the volume keeps the resolution
+  // of the tick rate
+  std::array<Duration32, OUTPUTS> max_on_{};
+  // Mono (true) or poly mode switched to by channel mode messages, kept over
+  // the configured voice mode until the next switch
+  std::array<std::optional<bool>, OUTPUTS> mono_{};
   std::array<N, OUTPUTS> _voices;
   std::array<DutyLimiter, OUTPUTS> _limiters;
+  std::array<ThermalLimiter, OUTPUTS> _thermal;
+  PowerArbiter<OUTPUTS> _power;
+
+  /// Voice mode of an output, mono plays with the priority configured
+  VoiceMode voice_mode(uint8_t ch) const {
+    const VoiceMode configured = config_.channel_configs[ch].voice_mode;
+    if (!mono_[ch])
+      return configured;
+    if (!*mono_[ch])
+      return VoiceMode::Poly;
+    return configured == VoiceMode::Poly ? VoiceMode::Last : configured;
+  }
+
+  // Sets up the outputs and routes of the configuration
+  void apply_config() {
+    for (auto i = 0; i < OUTPUTS; i++) {
+      _voices[i].adjust_size(config_.channel(i).notes);
+      _voices[i].mode(voice_mode(i));
+      _voices[i].velocity_curve(config_.channel(i).velocity);
+      DutyLimiter limiter(config_.channel(i));
+      limiter.carry_over(_limiters[i]);
+      _limiters[i] = limiter;
+      ThermalLimiter thermal(config_.channel(i));
+      thermal.carry_over(_thermal[i]);
+      _thermal[i] = thermal;
+    }
+    _power = PowerArbiter<OUTPUTS>(config_.synth());
+    for (uint8_t i = 0; i < OUTPUTS; i++)
+      max_on_[i] = config_.channel(i).max_on_time;
+    resolve_all();
+    for (uint8_t ch = 0; ch < midi_channels; ch++) {
+      Targets &targets = routes_[ch];
+      targets.size = 0;
+      for (uint8_t out = 0; out < OUTPUTS; out++) {
+        const Route &route = config_.routes[ch][out];
+        if (!route.enabled)
+          continue;
+        targets.targets[targets.size++] = {
+            .output = out,
+            .transpose = route.transpose,
+            .velocity = static_cast<uint16_t>(
+                (route.velocity << Target::velocity_shift) /
+                Route::unity_velocity),
+        };
+      }
+    }
+  }
 
 public:
   Teslasynth(
       const Configuration<OUTPUTS> &config,
       TrackStateCallback onPlaybackChanged = [](bool) {})
       : config_(config), _track(onPlaybackChanged) {
-    reload_config();
+    mpe_.output(Mpe::Upper, OUTPUTS - 1);
+    apply_config();
   }
 
   Teslasynth(TrackStateCallback onPlaybackChanged = [](bool) {})
@@ -262,37 +862,457 @@ public:
   void use_instruments(const std::array<Instrument, INSTRUMENTS> &instruments) {
     _instruments = instruments.begin();
     _instruments_size = instruments.size();
+    _bank = nullptr;
+    resolve_all();
+    if (loaded_ && std::none_of(loaded_->begin(), loaded_->end(),
+                                [this](const Loaded &slot) {
+                                  return playing(slot);
+                                }))
+      loaded_.reset();
+  }
+
+  /**
+   * Takes the instruments from a bank instead, they are read when a part
+   * changes to them, see `missing`. Bank select picks groups of 128 programs.
+   */
+  void use_instruments(InstrumentBank &bank) {
+    _bank = &bank;
+    if (!loaded_)
+      loaded_ = std::make_unique<Cache>();
+    for (auto &slot : *loaded_)
+      slot.number = Resolved::none;
+    resolve_all();
+  }
+
+  inline size_t instruments_size() const {
+    return _bank ? _bank->size() : _instruments_size;
+  }
+
+  /**
+   * Instrument the bank has to read before `msg` is handled, so the synth
+   * never waits on storage. Reading doesn't touch the synth, tasks sharing it
+   * read without holding their lock, and `provide` the instrument after.
+   */
+  std::optional<uint16_t> missing(const MidiChannelMessage &msg) const {
+    if (!_bank)
+      return {};
+    const Mpe::Channel &mpe = mpe_.channel(msg.channel);
+    const bool member = mpe.role == Mpe::Role::Member;
+    if (msg.type == MidiMessageType::ProgramChange) {
+      const uint16_t n = program(msg.channel, msg.data0);
+      // It is read ahead only when there is room, the note reads it otherwise
+      if (member || resident(n) || full())
+        return {};
+      return n;
+    }
+    if (msg.type != MidiMessageType::NoteOn)
+      return {};
+    const uint8_t channel = msg.channel;
+    const Resolved &part = parts_[member ? Mpe::master(mpe.zone) : channel];
+    if (part.missing())
+      return part.number;
+    for (const auto &output : configured_)
+      if (output.missing())
+        return output.number;
+    return {};
+  }
+
+  /// Reads an instrument from the bank, see `missing`
+  inline std::optional<Instrument> read(uint16_t n) {
+    return _bank ? _bank->read(n) : std::nullopt;
+  }
+
+  /**
+   * Takes an instrument read from the bank. One that couldn't be read, or
+   * found every cached one still playing, plays the default instrument, and
+   * isn't missing anymore.
+   */
+  void provide(uint16_t n, const std::optional<Instrument> &instrument) {
+    const Instrument *stored = resident(n);
+    if (Loaded *slot = stored ? nullptr : evict()) {
+      *slot = {n, ++uses_, instrument.value_or(default_instrument())};
+      stored = &slot->instrument;
+    }
+    if (!stored)
+      stored = &default_instrument();
+    for (auto &part : parts_)
+      if (part.number == n && !part.instrument)
+        part.instrument = stored;
+    for (auto &output : configured_)
+      if (output.number == n && !output.instrument)
+        output.instrument = stored;
+  }
+
+  /// MPE zones, set up by the configuration message or directly
+  inline Mpe &mpe() { return mpe_; }
+
+  /// Tempo in beats per minute, which synced tremolos follow
+  void tempo(float bpm) {
+    tempo_ = bpm;
+    for (auto &voice : _voices)
+      voice.tempo(bpm);
+  }
+  inline float tempo() const { return tempo_; }
+
+  /**
+   * Follows the MIDI timing clock. The tempo is measured over a whole beat, so
+   * the jitter of single clocks averages out, and measuring starts again when
+   * clocks stop for longer than a beat at 20 BPM.
+   */
+  void clock(Duration time) {
+    const auto beat = time - beat_start_;
+    if (clocks_ > 0 && (!beat || *beat > 3_s))
+      clocks_ = 0;
+    else if (clocks_ == clocks_per_beat) {
+      if (beat->micros() > 0)
+        tempo(60e6f / beat->micros());
+      clocks_ = 0;
+    }
+    if (clocks_++ == 0)
+      beat_start_ = time;
   }
 
   void handle(MidiChannelMessage msg, Duration time) {
+    if (msg.type == MidiMessageType::ControlChange &&
+        mpe_.control_change(msg.channel,
+                            static_cast<ControlChange>(msg.data0.value),
+                            msg.data1))
+      return;
+    const Mpe::Channel &mpe = mpe_.channel(msg.channel);
+    if (mpe.role == Mpe::Role::Member)
+      return handle_member(msg, time);
+
+    // Programs belong to the part, wherever it is routed
+    if (msg.type == MidiMessageType::ProgramChange)
+      return change_instrument(msg.channel, msg.data0);
+    if (msg.type == MidiMessageType::ControlChange &&
+        msg.data0 == uint8_t(ControlChange::BANK_SELECT_MSB)) {
+      bank_select_[msg.channel] = msg.data1;
+      return;
+    }
+
+    // Controllers too, they reach the outputs the part plays on
+    switch (msg.type) {
+    case MidiMessageType::ControlChange:
+      return control_change(msg.channel,
+                            static_cast<ControlChange>(msg.data0.value),
+                            msg.data1, time);
+    case MidiMessageType::AfterTouchChannel:
+      return after_touch(msg.channel, msg.data0);
+    case MidiMessageType::PitchBend:
+      return pitch_bend(msg.channel, msg.data0, msg.data1);
+    default:
+      break;
+    }
+
+    if (mpe.role == Mpe::Role::Master)
+      return handle(Target{.output = mpe.output}, msg, time);
+
+    const Targets &routes = routes_[msg.channel];
+    for (uint8_t i = 0; i < routes.size; i++)
+      handle(routes.targets[i], msg, time);
+  }
+
+  /// Plays a message on the output it is routed to
+  void handle(const Target &to, const MidiChannelMessage &msg,
+              Duration time) {
+    const uint8_t ch = to.output;
     switch (msg.type) {
     case MidiMessageType::NoteOff:
-      note_off(msg.channel, msg.data0, time);
+      if (auto number = to.note(msg.data0))
+        note_off(ch, msg.channel, *number, time);
       break;
     case MidiMessageType::NoteOn:
-      note_on(msg.channel, msg.data0, msg.data1, time);
+      if (auto number = to.note(msg.data0))
+        note_on(ch, msg.channel, {*number, to.scale(msg.data1)}, time);
       break;
     case MidiMessageType::AfterTouchPoly:
+      if (auto number = to.note(msg.data0))
+        after_touch(ch, msg.channel, *number, msg.data1);
+      break;
+    default:
+      break;
+    }
+  }
+
+  /**
+   * Calls `apply(output, channels)` for every output a part plays on, with
+   * the MIDI channels of the notes its controllers apply to there: its own,
+   * or the whole zone for an MPE master.
+   */
+  template <class F> void each_output(uint8_t part, F &&apply) {
+    const Mpe::Channel &mpe = mpe_.channel(part);
+    if (mpe.role == Mpe::Role::Master) {
+      if (mpe.output < OUTPUTS)
+        apply(mpe.output, mpe_.zone_channels(mpe.zone));
+      return;
+    }
+    const Targets &routes = routes_[part & (midi_channels - 1)];
+    for (uint8_t i = 0; i < routes.size; i++)
+      apply(routes.targets[i].output, uint16_t(1u << (part & 0x0F)));
+  }
+
+  /// Messages on an MPE member channel, they apply to its note alone
+  void handle_member(const MidiChannelMessage &msg, Duration time) {
+    Mpe::Channel &member = mpe_.channel(msg.channel);
+    const uint8_t out = member.output;
+    if (out >= OUTPUTS)
+      return;
+    N &voice = _voices[out];
+    switch (msg.type) {
+    case MidiMessageType::NoteOff:
+      note_off(out, msg.channel, msg.data0, time);
+      break;
+    case MidiMessageType::NoteOn:
+      member.note = msg.data0;
+      // Members play the program of the zone's master channel, their notes
+      // are told apart by the member channel
+      start_note(out, Mpe::master(member.zone), msg.channel,
+                 {msg.data0, msg.data1}, time,
+                 {member.bend.multiplier(), pressure_level(member.pressure),
+                  timbre_depth(member.timbre)});
+      break;
+    case MidiMessageType::AfterTouchPoly:
+      after_touch(out, msg.channel, msg.data0, msg.data1);
+      break;
+    case MidiMessageType::AfterTouchChannel:
+      member.pressure = msg.data0;
+      voice.pressure(member.note, pressure_level(member.pressure),
+                     msg.channel);
+      break;
+    case MidiMessageType::PitchBend:
+      member.bend.bend(msg.data0, msg.data1);
+      voice.note_bend(member.note, member.bend.multiplier(), msg.channel);
       break;
     case MidiMessageType::ControlChange:
-      switch (static_cast<ControlChange>(msg.data0.value)) {
-      case ControlChange::ALL_SOUND_OFF:
-      case ControlChange::RESET_ALL_CONTROLLERS:
-      case ControlChange::ALL_NOTES_OFF:
-        off();
-        break;
-      default:
+      member_control_change(msg.channel,
+                            static_cast<ControlChange>(msg.data0.value),
+                            msg.data1);
+      break;
+    case MidiMessageType::ProgramChange:
+      // Programs belong to the zone, sent on its master channel
+      break;
+    }
+  }
+
+  void member_control_change(uint8_t ch, ControlChange number,
+                             uint8_t value) {
+    Mpe::Channel &member = mpe_.channel(ch);
+    N &voice = _voices[member.output];
+    switch (number) {
+    case ControlChange::BRIGHTNESS:
+      member.timbre = value;
+      voice.timbre(member.note, timbre_depth(value), ch);
+      break;
+    case ControlChange::RESET_ALL_CONTROLLERS:
+      member.pressure = 0;
+      member.timbre = Mpe::neutral_timbre;
+      member.bend.reset();
+      voice.pressure(member.note, EnvelopeLevel::zero(), ch);
+      voice.timbre(member.note, 1, ch);
+      voice.note_bend(member.note, member.bend.multiplier(), ch);
+      break;
+    case ControlChange::RPN_MSB:
+      member.rpn.select_msb(value);
+      break;
+    case ControlChange::RPN_LSB:
+      member.rpn.select_lsb(value);
+      break;
+    case ControlChange::NRPN_MSB:
+    case ControlChange::NRPN_LSB:
+      member.rpn.reset();
+      break;
+    case ControlChange::DATA_ENTRY_MSB:
+    case ControlChange::DATA_ENTRY_LSB:
+      // The bend range is shared by every member of the zone
+      if (member.rpn.selected() != RegisteredParameter::pitch_bend_range)
         break;
+      for (uint8_t i = 0; i < Mpe::channels; i++) {
+        Mpe::Channel &other = mpe_.channel(i);
+        if (other.role != Mpe::Role::Member || other.zone != member.zone)
+          continue;
+        if (number == ControlChange::DATA_ENTRY_MSB)
+          other.bend.range_semitones(value);
+        else
+          other.bend.range_cents(value);
+        voice.note_bend(other.note, other.bend.multiplier(), i);
       }
       break;
-    case MidiMessageType::ProgramChange:
-      change_instrument(msg.channel, msg.data0);
+    default:
       break;
-    case MidiMessageType::AfterTouchChannel:
+    }
+  }
+
+  /// Controller of a part, the notes received on MIDI channel `part`
+  void control_change(uint8_t part, ControlChange number, uint8_t value,
+                      Duration time) {
+    // Channel mode messages stop everything, whichever channel they are on
+    switch (number) {
+    case ControlChange::RESET_ALL_CONTROLLERS:
+      reset_controllers(part, time);
+      off();
       break;
-    case MidiMessageType::PitchBend:
+    case ControlChange::ALL_SOUND_OFF:
+    case ControlChange::ALL_NOTES_OFF:
+    case ControlChange::MONO_MODE_ON:
+    case ControlChange::POLY_MODE_ON:
+      off();
+      break;
+    default:
+      break;
+    }
+
+    Controllers &c = controllers_[part & (midi_channels - 1)];
+    c.mod.control_change(number, value);
+    switch (number) {
+    case ControlChange::RPN_MSB:
+      c.rpn.select_msb(value);
+      return;
+    case ControlChange::RPN_LSB:
+      c.rpn.select_lsb(value);
+      return;
+    case ControlChange::NRPN_MSB:
+    case ControlChange::NRPN_LSB:
+      // Data entry belongs to the non-registered parameter now
+      c.rpn.reset();
+      return;
+    case ControlChange::DATA_ENTRY_MSB:
+    case ControlChange::DATA_ENTRY_LSB:
+      if (c.rpn.selected() != RegisteredParameter::pitch_bend_range)
+        return;
+      if (number == ControlChange::DATA_ENTRY_MSB)
+        c.bend.range_semitones(value);
+      else
+        c.bend.range_cents(value);
+      each_output(part, [&](uint8_t ch, uint16_t channels) {
+        _voices[ch].bend(c.bend.multiplier(), channels);
+      });
+      return;
+    default:
       break;
     }
+
+    each_output(part, [&](uint8_t ch, uint16_t channels) {
+      N &voice = _voices[ch];
+      switch (number) {
+      case ControlChange::DAMPER_PEDAL:
+        voice.sustain(value >= 64, pedal_time(ch, time), channels);
+        break;
+      case ControlChange::SOSTENUTO_SWITCH:
+        voice.sostenuto(value >= 64, pedal_time(ch, time), channels);
+        break;
+      case ControlChange::PORTAMENTO_SWITCH:
+        voice.portamento(value >= 64);
+        break;
+      case ControlChange::PORTAMENTO_TIME_MSB:
+        voice.portamento_time(portamento_time(value));
+        break;
+      case ControlChange::MONO_MODE_ON:
+      case ControlChange::POLY_MODE_ON:
+        mono_[ch] = number == ControlChange::MONO_MODE_ON;
+        voice.mode(voice_mode(ch));
+        break;
+      default:
+        break;
+      }
+    });
+  }
+
+  // Pedals are kept while stopped, but only move the clock when playing
+  inline Instant pedal_time(uint8_t ch, Duration time) {
+    return _track.is_playing() ? _track.on_receive(ch, time) : Instant();
+  }
+
+  inline const ModulationMatrix &modulation(uint8_t part) const {
+    return controllers_[part & (midi_channels - 1)].mod;
+  }
+
+  /// Moves modulated parameters towards their controllers, once per window
+  void modulate() {
+    for (uint8_t part = 0; part < midi_channels; part++)
+      if (controllers_[part].mod.smooth())
+        apply_modulation(part);
+  }
+
+  inline void apply_modulation(uint8_t part) {
+    const ModulationMatrix &mod = controllers_[part].mod;
+    each_output(part, [&](uint8_t ch, uint16_t channels) {
+      _voices[ch].modulate_gain(mod.value(ModTarget::Gain), channels);
+      _voices[ch].modulate_vibrato(mod.value(ModTarget::VibratoRate),
+                                   mod.value(ModTarget::VibratoDepth),
+                                   channels);
+    });
+  }
+
+  /// Puts the controllers of a part on the outputs it plays on
+  void apply_controllers(uint8_t part) {
+    const Controllers &c = controllers_[part];
+    each_output(part, [&](uint8_t ch, uint16_t channels) {
+      _voices[ch].bend(c.bend.multiplier(), channels);
+      _voices[ch].pressure(pressure_level(c.pressure), channels);
+    });
+    apply_modulation(part);
+  }
+
+  /// Bends the notes of a part, from their next pulse on
+  inline void pitch_bend(uint8_t part, uint8_t lsb, uint8_t msb) {
+    PitchBend &bend = controllers_[part & (midi_channels - 1)].bend;
+    bend.bend(lsb, msb);
+    each_output(part, [&](uint8_t ch, uint16_t channels) {
+      _voices[ch].bend(bend.multiplier(), channels);
+    });
+  }
+
+  inline const PitchBend &pitch_bend(uint8_t part) const {
+    return controllers_[part & (midi_channels - 1)].bend;
+  }
+
+  /// Pressure follows the log velocity curve, and is off at zero
+  static inline EnvelopeLevel pressure_level(uint8_t value) {
+    return value == 0 ? EnvelopeLevel::zero()
+                      : VelocityTable::standard()[value];
+  }
+
+  /// Glide time of a portamento time value, quadratic up to about 4s
+  static inline Duration32 portamento_time(uint8_t value) {
+    return Duration32::micros(value * value * 250u);
+  }
+
+  /// Vibrato depth multiplier of an MPE timbre value
+  static inline float timbre_depth(uint8_t value) {
+    return exp2f((value - int(Mpe::neutral_timbre)) / 32.f);
+  }
+
+  /// Polyphonic aftertouch of a note a MIDI channel started on an output
+  inline void after_touch(uint8_t ch, uint8_t channel, uint8_t number,
+                          uint8_t value) {
+    if (ch < OUTPUTS)
+      _voices[ch].pressure(number, pressure_level(value), channel);
+  }
+
+  /// Channel aftertouch of a part, from the next pulse of its notes on
+  inline void after_touch(uint8_t part, uint8_t value) {
+    controllers_[part & (midi_channels - 1)].pressure = value;
+    each_output(part, [&](uint8_t ch, uint16_t channels) {
+      _voices[ch].pressure(pressure_level(value), channels);
+    });
+  }
+
+  inline void reset_controllers(uint8_t part, Duration time) {
+    Controllers &c = controllers_[part & (midi_channels - 1)];
+    c.rpn.reset();
+    c.bend.reset();
+    c.mod.reset();
+    c.pressure = 0;
+    each_output(part, [&](uint8_t ch, uint16_t channels) {
+      const Instant at = pedal_time(ch, time);
+      N &voice = _voices[ch];
+      voice.bend(c.bend.multiplier(), channels);
+      voice.sustain(false, at, channels);
+      voice.sostenuto(false, at, channels);
+      voice.portamento(false);
+      voice.pressure(EnvelopeLevel::zero(), channels);
+    });
   }
 
   inline void off() {
@@ -302,109 +1322,266 @@ public:
     }
   }
 
+  /**
+   * Applies the current configuration without stopping playback, notes keep
+   * playing as long as they fit in the new number of notes.
+   */
   inline void reload_config() {
-    if (_track.is_playing())
-      off();
-    for (auto i = 0; i < OUTPUTS; i++) {
-      _voices[i].adjust_size(config_.channel(i).notes);
-      _limiters[i] = DutyLimiter(config_.channel(i).max_duty,
-                                 config_.channel(i).duty_window);
-    }
+    apply_config();
+    // Outputs a part is newly routed to pick up its controllers
+    for (uint8_t part = 0; part < midi_channels; part++)
+      apply_controllers(part);
   }
 
-  inline void change_instrument(uint8_t ch, uint8_t n) {
-    if (ch < OUTPUTS) {
-      current_instrument_[ch] =
-          std::min<uint8_t>(_instruments_size, std::max<uint8_t>(0, n));
-    }
+  inline void reload_config(const Configuration<OUTPUTS> &config) {
+    config_ = config;
+    reload_config();
+  }
+
+  inline const DutyStats &duty_stats(uint8_t ch) const {
+    assert(ch < OUTPUTS);
+    return _limiters[ch].stats();
+  }
+
+  /// Program change of a part, the notes received on MIDI channel `part`
+  inline void change_instrument(uint8_t part, uint8_t n) {
+    part &= midi_channels - 1;
+    program_[part] = program(part, n);
+    parts_[part] = resolve(program_[part]);
+  }
+
+  /// Instrument number a program change of a part picks
+  inline uint16_t program(uint8_t part, uint8_t n) const {
+    part &= midi_channels - 1;
+    return std::min<size_t>(instruments_size(), bank_select_[part] * 128u + n);
   }
 
-  inline constexpr uint8_t instrument_number(uint8_t ch) const {
+  /**
+   * Instrument a part plays on an output, unless the configuration sets one
+   * for the output or the whole synth.
+   */
+  inline constexpr uint16_t instrument_number(uint8_t ch, uint8_t part) const {
     assert(ch < OUTPUTS);
     return config_.channel_configs[ch].instrument.value_or(
-        config_.synth_config.instrument.value_or(current_instrument_[ch]));
+        config_.synth_config.instrument.value_or(
+            program_[part & (midi_channels - 1)]));
+  }
+  inline constexpr uint16_t instrument_number(uint8_t ch) const {
+    return instrument_number(ch, ch);
   }
 
-  inline const Instrument &instrument(uint8_t ch) const {
-    const auto nr = instrument_number(ch);
-    return nr < _instruments_size ? _instruments[nr] : default_instrument();
+  inline const Instrument &instrument(uint8_t ch, uint8_t part) {
+    const uint16_t n = instrument_number(ch, part);
+    part &= midi_channels - 1;
+    for (const Resolved *r : {&configured_[ch], &parts_[part]})
+      if (r->number == n && r->instrument) {
+        touch(r->instrument);
+        return *r->instrument;
+      }
+    const Instrument *found = resident(n);
+    return found ? *found : default_instrument();
   }
+  inline const Instrument &instrument(uint8_t ch) { return instrument(ch, ch); }
 
-  inline void note_off(uint8_t ch, uint8_t number, Duration time) {
+  /// Releases a note a MIDI channel started on an output
+  inline void note_off(uint8_t ch, uint8_t channel, uint8_t number,
+                       Duration time) {
     if (_track.is_playing()) {
       if (ch < OUTPUTS) {
-        Duration delta = _track.on_receive(ch, time);
-        _voices[ch].release(number, delta);
+        Instant delta = _track.on_receive(ch, time);
+        _voices[ch].release(number, delta, channel);
       }
     }
   }
+  inline void note_off(uint8_t ch, uint8_t number, Duration time) {
+    note_off(ch, ch, number, time);
+  }
   inline void note_off(uint8_t ch, MidiNote mnote, Duration time) {
     note_off(ch, mnote.number, time);
   }
 
-  inline void note_on(uint8_t ch, uint8_t number, uint8_t velocity,
-                      Duration time) {
+  /**
+   * Starts a note of a part on an output, from the MIDI channel that tells it
+   * apart from the same number on other channels.
+   */
+  inline void start_note(uint8_t ch, uint8_t part, uint8_t channel,
+                         MidiNote mnote, Duration time,
+                         const NoteExpression &expression = {}) {
     if (ch < OUTPUTS) {
-      Duration delta = _track.on_receive(ch, time);
-      _voices[ch].start({number, velocity}, delta, instrument(ch),
-                        config_.synth().a440);
+      Instant delta = _track.on_receive(ch, time);
+      _voices[ch].start(mnote, delta, instrument(ch, part),
+                        config_.synth().a440, expression, channel,
+                        channel_controllers(part));
     }
   }
+
+  /// Controllers of a part the notes it starts begin with
+  ChannelControllers channel_controllers(uint8_t part) const {
+    const Controllers &c = controllers_[part & (midi_channels - 1)];
+    return {.bend = c.bend.multiplier(),
+            .pressure = pressure_level(c.pressure),
+            .gain = c.mod.value(ModTarget::Gain),
+            .vibrato_rate = c.mod.value(ModTarget::VibratoRate),
+            .vibrato_depth = c.mod.value(ModTarget::VibratoDepth),
+            .attack = c.mod.value(ModTarget::Attack),
+            .release = c.mod.value(ModTarget::Release)};
+  }
+
+  /// Starts a note of a part on an output
+  inline void note_on(uint8_t ch, uint8_t part, MidiNote mnote, Duration time,
+                      const NoteExpression &expression = {}) {
+    start_note(ch, part, part, mnote, time, expression);
+  }
+  inline void note_on(uint8_t ch, uint8_t number, uint8_t velocity,
+                      Duration time) {
+    note_on(ch, ch, {number, velocity}, time);
+  }
   inline void note_on(uint8_t ch, MidiNote mnote, Duration time) {
-    note_on(ch, mnote.number, mnote.velocity, time);
+    note_on(ch, ch, mnote, time);
   }
 
   Pulse sample(uint8_t ch, Duration16 max) {
     Pulse res;
 
+    const Instant played = _track.played_time(ch);
+    const Micros16 stagger = config_.synth_config.max_stagger;
     Note *note = &_voices[ch].next();
-    Duration next_edge = note->current().start;
-    while (next_edge < _track.played_time(ch) && note->is_active()) {
+    Instant next_edge = note->current().start;
+    // Edges that were delayed by staggering are still due
+    while (next_edge + stagger < played && note->is_active()) {
       note->next();
       note = &_voices[ch].next();
       next_edge = note->current().start;
     }
 
-    Duration target = _track.played_time(ch) + max;
+    Instant target = played + max;
     if (!note->is_active() || next_edge > target || !_track.is_playing()) {
       res.off = max;
-    } else if (next_edge == _track.played_time(ch)) {
-      res.on = note->current().volume * config_.channel_configs[ch].max_on_time;
-      res.off = config_.channel_configs[ch].min_deadtime;
-      note->next();
-    } else if (next_edge <= target && next_edge >= _track.played_time(ch)) {
-      res.off = Duration16::micros(next_edge.micros() -
-                                   _track.played_time(ch).micros());
+    } else if (next_edge <= played) {
+      // Wait for other outputs to go off if it is within the allowed shift,
+      // otherwise there is no point in delaying the pulse at all.
+      Instant busy = _power.busy_until(ch, played);
+      if (busy > played && busy <= next_edge + stagger) {
+        res.off = Duration16::ticks(
+            std::min((*(busy - played)).ticks(), uint32_t(max.ticks())));
+      } else {
+        res.on = Duration16::ticks(
+            std::min<uint32_t>((note->current().volume * max_on_[ch]).ticks(),
+                               Duration16::max().ticks()));
+        res.off = config_.channel_configs[ch].min_deadtime;
+        note->next();
+      }
+    } else if (next_edge <= target && next_edge >= played) {
+      res.off = Duration16::ticks((*(next_edge - played)).ticks());
     }
 
-    if (!_limiters[ch].can_use(res.on)) {
-      res.off += res.on;
+    // The withheld on-time turns into silence. Long pulses and deadtimes may
+    // not fit together at fine tick rates, the rest is rendered by the next
+    // sample since the note has already moved on.
+    auto silence = [&res](uint32_t ticks) {
+      res.off = Duration16::ticks(std::min<uint32_t>(
+          res.off.ticks() + ticks, Duration16::max().ticks()));
+    };
+    if (!res.on.is_zero()) {
+      Duration16 granted = _limiters[ch].grant(_thermal[ch].grant(res.on));
+      silence(res.on.ticks() - granted.ticks());
+      res.on = granted;
+    }
+    if (!_power.can_use(ch, played, res.on)) {
+      silence(res.on.ticks());
       res.on = 0_us;
     }
 
     _limiters[ch].replenish(res.off);
+    _thermal[ch].cool(res.length());
+    _power.replenish(ch, res.length());
     _track.on_play(ch, res.length());
 
     return res;
   }
 
+  /**
+   * Renders the next chunk of a window, stopping early on channels whose
+   * buffer is full.
+   *
+   * @return true if the whole window has been rendered
+   */
   template <size_t BUFSIZE>
-  void sample_all(Duration16 max, PulseBuffer<OUTPUTS, BUFSIZE> &output) {
+  bool sample_chunk(RenderWindow<OUTPUTS> &window,
+                    PulseBuffer<OUTPUTS, BUFSIZE> &output) {
     if (!_track.is_playing()) {
       output.clean();
-      return;
+      window = {};
+      return true;
+    }
+    if (!window.started) {
+      modulate();
+      window.started = true;
     }
-    int16_t now = max.micros();
+    output.clean();
+    // Channels are rendered interleaved in time order, so limits shared by
+    // all outputs see pulses in the order they are played. The chunk ends
+    // once the channel that is furthest behind runs out of buffer.
+    while (true) {
+      uint8_t ch = OUTPUTS;
+      for (uint8_t c = 0; c < OUTPUTS; c++) {
+        if (window.left[c] == 0)
+          continue;
+        // On ties the channel that was denied more goes first, so pulses
+        // that collide don't always drop on the same channel.
+        if (ch == OUTPUTS || _track.played_time(c) < _track.played_time(ch) ||
+            (_track.played_time(c) == _track.played_time(ch) &&
+             _power.denied(c) > _power.denied(ch)))
+          ch = c;
+      }
+      if (ch == OUTPUTS || output.written[ch] == BUFSIZE)
+        break;
+
+      uint32_t &left = window.left[ch];
+      uint8_t &i = output.written[ch];
+      Pulse pulse = sample(ch, Duration16::ticks(std::min<uint32_t>(
+                                   left, Duration16::max().ticks())));
+      left -= std::min(left, pulse.length().ticks());
+      // Consecutive silences are kept as a single idle pulse, outputs
+      // expand it into as many symbols as their hardware needs.
+      if (i == 0 || !output.at(ch, i - 1).merge(pulse))
+        output.at(ch, i++) = pulse;
+    }
+
+    // Outputs that start all channels together need something on every
+    // channel in every chunk. Channels that are done early hold back part
+    // of their last gap, and spread it over the chunks that follow.
+    const bool done = window.done();
     for (uint8_t ch = 0; ch < OUTPUTS; ch++) {
-      int16_t processed = 0;
-      uint8_t i = 0, start = ch * BUFSIZE;
-      for (; processed < now && i < BUFSIZE; i++) {
-        auto left = Duration16::micros(now - processed);
-        output.pulses[start + i] = sample(ch, left);
-        processed += output.pulses[start + i].length().micros();
+      if (window.left[ch] > 0)
+        continue;
+      uint8_t &written = output.written[ch];
+      uint16_t &held = window.held[ch];
+      if (done) {
+        if (held > 0)
+          output.at(ch, written++) = {0_us, Duration16::ticks(held)};
+        held = 0;
+      } else if (written > 0) {
+        Pulse &last = output.at(ch, written - 1);
+        held = last.off.ticks() / 2;
+        last.off = Duration16::ticks(last.off.ticks() - held);
+      } else if (held > 1) {
+        uint16_t part = held / 2;
+        output.at(ch, written++) = {0_us, Duration16::ticks(part)};
+        held -= part;
       }
-      output.written[ch] = i;
     }
+    return done;
+  }
+
+  /**
+   * Renders a window in a single chunk, whatever doesn't fit in the buffer
+   * is left for the next window.
+   */
+  template <size_t BUFSIZE>
+  void sample_all(Duration32 max, PulseBuffer<OUTPUTS, BUFSIZE> &output) {
+    RenderWindow<OUTPUTS> window(max);
+    sample_chunk(window, output);
   }
 
   const TrackState<OUTPUTS> &track() const { return _track; }
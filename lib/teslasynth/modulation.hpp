@@ -0,0 +1,174 @@
+#pragma once
+
+#include "../midi/midi_core.hpp"
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+namespace teslasynth::midisynth {
+using namespace teslasynth::midi;
+
+/// Parameters of a channel that controllers can modulate
+enum class ModTarget : uint8_t {
+  Gain,
+  VibratoRate,
+  VibratoDepth,
+  Attack,
+  Release,
+};
+constexpr size_t mod_targets = 5;
+
+/// How a controller value turns into a multiplier of its target
+enum class ModCurve : uint8_t {
+  Level,    // 0 to 1, 127 leaves the target as it is
+  Relative, // 1/4 to 4 times, 64 leaves the target as it is
+  Boost,    // 1 to 4 times, 0 leaves the target as it is
+};
+
+struct ModRoute {
+  ControlChange source;
+  ModTarget target;
+  ModCurve curve;
+};
+
+/**
+ * Routes the controllers of a channel to the parameters they modulate.
+ *
+ * Controller messages only record the value. Parameters follow once per
+ * render window, smoothed so a controller sweep doesn't step, which keeps
+ * streams of controller messages cheap.
+ */
+class ModulationMatrix final {
+public:
+  static constexpr size_t max_routes = 8;
+  /// Fraction of the way to the controller value covered every window
+  static constexpr float smoothing = 0.25f;
+
+  /// Multipliers of each parameter, one when not modulated
+  typedef std::array<float, mod_targets> Values;
+
+  static constexpr std::array<ModRoute, 6> default_routes{{
+      {ControlChange::CHANNEL_VOLUME_MSB, ModTarget::Gain, ModCurve::Level},
+      {ControlChange::MODULATION_MSB, ModTarget::VibratoDepth,
+       ModCurve::Boost},
+      {ControlChange::VIBRATO_RATE, ModTarget::VibratoRate,
+       ModCurve::Relative},
+      {ControlChange::VIBRATO_DEPTH, ModTarget::VibratoDepth,
+       ModCurve::Relative},
+      {ControlChange::ATTACK_TIME, ModTarget::Attack, ModCurve::Relative},
+      {ControlChange::RELEASE_TIME, ModTarget::Release, ModCurve::Relative},
+  }};
+
+private:
+  struct Source {
+    ModRoute route;
+    uint8_t value;
+    float smoothed;
+  };
+
+  std::array<Source, max_routes> sources_;
+  uint8_t size_ = 0;
+  Values values_;
+  bool settled_ = true;
+
+  static constexpr uint8_t neutral(ModCurve curve) {
+    switch (curve) {
+    case ModCurve::Level:
+      return 127;
+    case ModCurve::Relative:
+      return 64;
+    case ModCurve::Boost:
+      return 0;
+    }
+    return 0;
+  }
+
+  static float multiplier(ModCurve curve, float value) {
+    switch (curve) {
+    case ModCurve::Level:
+      return value / 127.f;
+    case ModCurve::Relative:
+      return exp2f((value - 64) / 32.f);
+    case ModCurve::Boost:
+      return 1 + 3 * value / 127.f;
+    }
+    return 1;
+  }
+
+public:
+  ModulationMatrix() {
+    for (auto &route : default_routes)
+      this->route(route);
+    values_.fill(1);
+  }
+
+  /// Adds a route, false if there is no room left
+  bool route(const ModRoute &route) {
+    if (size_ == max_routes)
+      return false;
+    const uint8_t v = neutral(route.curve);
+    sources_[size_++] = {route, v, static_cast<float>(v)};
+    return true;
+  }
+
+  void clear() {
+    size_ = 0;
+    reset();
+  }
+
+  /// Puts every controller back to where it leaves its target unchanged
+  void reset() {
+    for (uint8_t i = 0; i < size_; i++)
+      sources_[i].value = neutral(sources_[i].route.curve);
+    settled_ = false;
+  }
+
+  /// @return true if the controller is routed to something
+  bool control_change(ControlChange number, uint8_t value) {
+    bool routed = false;
+    for (uint8_t i = 0; i < size_; i++) {
+      if (sources_[i].route.source == number) {
+        sources_[i].value = value;
+        routed = true;
+      }
+    }
+    settled_ &= !routed;
+    return routed;
+  }
+
+  /**
+   * Moves the parameters towards their controllers, meant to be called
+   * once per render window.
+   *
+   * @return true if any parameter changed
+   */
+  bool smooth() {
+    if (settled_)
+      return false;
+    Values values;
+    values.fill(1);
+    settled_ = true;
+    for (uint8_t i = 0; i < size_; i++) {
+      Source &s = sources_[i];
+      const float diff = s.value - s.smoothed;
+      if (std::fabs(diff) < 0.5f)
+        s.smoothed = s.value;
+      else {
+        s.smoothed += diff * smoothing;
+        settled_ = false;
+      }
+      values[static_cast<uint8_t>(s.route.target)] *=
+          multiplier(s.route.curve, s.smoothed);
+    }
+    values_ = values;
+    return true;
+  }
+
+  inline const Values &values() const { return values_; }
+  inline float value(ModTarget target) const {
+    return values_[static_cast<uint8_t>(target)];
+  }
+};
+
+} // namespace teslasynth::midisynth
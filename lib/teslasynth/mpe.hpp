@@ -0,0 +1,154 @@
+#pragma once
+
+#include "../midi/midi_core.hpp"
+#include "pitch_bend.hpp"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+namespace teslasynth::midisynth {
+using namespace teslasynth::midi;
+
+/**
+ * MIDI Polyphonic Expression zones.
+ *
+ * A zone is a master channel and the member channels next to it. Controllers
+ * play every note on a member channel of its own, so bend, pressure and
+ * timbre sent there apply to that note alone, while the master channel holds
+ * what applies to the whole zone. The lower zone's master is the first
+ * channel with members counting up, the upper zone's is the last one with
+ * members counting down. Each zone plays on a single output.
+ *
+ * Channels are looked up in a table rebuilt when zones change, so a message
+ * costs the same however the zones are set up.
+ */
+class Mpe final {
+public:
+  enum class Role : uint8_t { None, Master, Member };
+  enum Zone : uint8_t { Lower, Upper };
+
+  static constexpr uint8_t channels = 16;
+  static constexpr uint8_t max_members = channels - 1;
+  /// RPN of the MPE configuration message, sent on a master channel
+  static constexpr uint16_t configuration = 6;
+  /// Bend range of member channels in cents, 48 semitones
+  static constexpr uint16_t member_range = 4800;
+  /// Timbre, CC74, leaving notes as they are
+  static constexpr uint8_t neutral_timbre = 64;
+
+  struct Channel {
+    Role role = Role::None;
+    Zone zone = Lower;
+    uint8_t output = 0;
+    // Last note started on a member channel, its expression follows
+    uint8_t note = 0;
+    uint8_t pressure = 0;
+    uint8_t timbre = neutral_timbre;
+    PitchBend bend;
+    RegisteredParameter rpn;
+  };
+
+private:
+  std::array<Channel, channels> channels_{};
+  std::array<uint8_t, 2> members_{}, outputs_{};
+
+  void rebuild() {
+    for (uint8_t ch = 0; ch < channels; ch++) {
+      Channel &c = channels_[ch];
+      const RegisteredParameter rpn = c.rpn;
+      c = {};
+      c.rpn = rpn;
+    }
+    for (Zone zone : {Lower, Upper}) {
+      if (members_[zone] == 0)
+        continue;
+      const uint8_t master = Mpe::master(zone);
+      for (uint8_t i = 0; i <= members_[zone]; i++) {
+        Channel &c = channels_[zone == Lower ? master + i : master - i];
+        c.role = i == 0 ? Role::Master : Role::Member;
+        c.zone = zone;
+        c.output = outputs_[zone];
+        if (i > 0) {
+          c.bend.range_semitones(member_range / 100);
+          c.bend.range_cents(member_range % 100);
+        }
+      }
+    }
+  }
+
+public:
+  /**
+   * Sets the number of member channels of a zone, zero turns it off. The
+   * other zone gives up the channels they would share, as the configuration
+   * message asks.
+   */
+  void configure(Zone zone, uint8_t members) {
+    members = std::min(members, max_members);
+    const Zone other = zone == Lower ? Upper : Lower;
+    members_[zone] = members;
+    members_[other] = std::min<uint8_t>(
+        members_[other], members < max_members - 1 ? max_members - 1 - members
+                                                   : 0);
+    rebuild();
+  }
+
+  /// Output a zone plays on, from the next notes on
+  void output(Zone zone, uint8_t output) {
+    outputs_[zone] = output;
+    rebuild();
+  }
+
+  static constexpr uint8_t master(Zone zone) {
+    return zone == Lower ? 0 : channels - 1;
+  }
+
+  inline uint8_t members(Zone zone) const { return members_[zone]; }
+  /// Master and member channels of a zone, as a mask of channels
+  inline uint16_t zone_channels(Zone zone) const {
+    const uint16_t span = (1u << (members_[zone] + 1)) - 1;
+    return zone == Lower ? span : span << (max_members - members_[zone]);
+  }
+  inline uint8_t output(Zone zone) const { return outputs_[zone]; }
+  inline bool is_enabled() const { return members_[Lower] || members_[Upper]; }
+
+  inline Channel &channel(uint8_t ch) { return channels_[ch & 0x0F]; }
+  inline const Channel &channel(uint8_t ch) const {
+    return channels_[ch & 0x0F];
+  }
+
+  /**
+   * Watches for the configuration message on the channels zones are mastered
+   * from.
+   *
+   * @return true if the message was data for the configuration message and
+   * needs no further handling.
+   */
+  bool control_change(uint8_t ch, ControlChange number, uint8_t value) {
+    if (ch != 0 && ch != channels - 1)
+      return false;
+    RegisteredParameter &rpn = channel(ch).rpn;
+    switch (number) {
+    case ControlChange::RPN_MSB:
+      rpn.select_msb(value);
+      break;
+    case ControlChange::RPN_LSB:
+      rpn.select_lsb(value);
+      break;
+    case ControlChange::NRPN_MSB:
+    case ControlChange::NRPN_LSB:
+      rpn.reset();
+      break;
+    case ControlChange::DATA_ENTRY_MSB:
+      if (rpn.selected() == configuration) {
+        configure(ch == 0 ? Lower : Upper, value);
+        return true;
+      }
+      break;
+    default:
+      break;
+    }
+    return false;
+  }
+};
+
+} // namespace teslasynth::midisynth
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "core.hpp"
+#include "notes.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+namespace teslasynth::midisynth {
+
+/**
+ * Registered parameter selected on a channel with RPN MSB and LSB, data entry
+ * messages apply to it.
+ */
+class RegisteredParameter final {
+  uint8_t msb_ = 0x7F, lsb_ = 0x7F;
+
+public:
+  static constexpr uint16_t none = 0x3FFF;
+  static constexpr uint16_t pitch_bend_range = 0;
+
+  inline void select_msb(uint8_t v) { msb_ = v; }
+  inline void select_lsb(uint8_t v) { lsb_ = v; }
+  inline void reset() { msb_ = lsb_ = 0x7F; }
+  inline uint16_t selected() const { return msb_ << 7 | lsb_; }
+};
+
+/**
+ * Pitch bend of a channel, kept as a fixed point multiplier of note periods.
+ *
+ * The multiplier is worked out once per bend or range change, notes only
+ * multiply their period by it.
+ */
+class PitchBend final {
+  int16_t value_ = 0;
+  uint16_t range_ = default_range;
+  uint32_t multiplier_ = unity;
+
+  void update() {
+    const float semitones = value_ * range_ / (8192.f * 100.f);
+    multiplier_ = static_cast<uint32_t>(
+        std::lround(unity * exp2f(-semitones / 12.f)));
+  }
+
+public:
+  static constexpr uint32_t unity = synth::Note::bend_unity;
+  /// In cents, two semitones unless changed with RPN 0
+  static constexpr uint16_t default_range = 200;
+
+  /// Applies a pitch bend message
+  inline void bend(uint8_t lsb, uint8_t msb) {
+    value_ = static_cast<int16_t>((msb << 7 | lsb) - 8192);
+    update();
+  }
+
+  /// Data entry MSB of RPN 0, the range in semitones
+  inline void range_semitones(uint8_t semitones) {
+    range_ = semitones * 100;
+    update();
+  }
+
+  /// Data entry LSB of RPN 0, cents added to the semitones
+  inline void range_cents(uint8_t cents) {
+    range_ = range_ / 100 * 100 + std::min<uint8_t>(cents, 99);
+    update();
+  }
+
+  inline void reset() {
+    value_ = 0;
+    multiplier_ = unity;
+  }
+
+  inline int16_t value() const { return value_; }
+  inline uint16_t range() const { return range_; }
+  /// Multiplier of note periods, `unity` when not bent
+  inline uint32_t multiplier() const { return multiplier_; }
+};
+
+} // namespace teslasynth::midisynth
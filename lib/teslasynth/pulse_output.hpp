@@ -0,0 +1,102 @@
+#pragma once
+
+#include "midi_synth.hpp"
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace teslasynth::midisynth {
+
+/**
+ * Output stage that turns rendered pulses into a signal.
+ * Buffers are written per channel and submitted together on commit, so
+ * backends that can start all channels at once are free to do so.
+ */
+class PulseOutput {
+public:
+  virtual ~PulseOutput() = default;
+
+  /**
+   * Queues pulses for a channel, the buffer must stay valid until the
+   * backend has consumed it.
+   */
+  virtual void write(uint8_t ch, const Pulse *pulses, size_t len) = 0;
+
+  /**
+   * Submits everything written since the last commit as a single batch
+   */
+  virtual void commit() {}
+
+  /**
+   * Waits until at most the last `batches` committed batches are still being
+   * read, so the buffers of the ones before can be written again. Backends
+   * that copy the pulses as they are written don't wait.
+   */
+  virtual void wait_pending(size_t batches) {}
+
+  template <std::uint8_t OUTPUTS, std::size_t SIZE>
+  void write_all(PulseBuffer<OUTPUTS, SIZE> &buffer) {
+    for (uint8_t ch = 0; ch < OUTPUTS; ch++)
+      write(ch, &buffer.data(ch), buffer.data_size(ch));
+    commit();
+  }
+};
+
+struct OutputStats {
+  size_t batches = 0, transactions = 0, pulses = 0;
+  Duration on = Duration::zero(), total = Duration::zero();
+};
+
+/**
+ * Output backend that keeps everything written to it, for testing and
+ * comparing the output stage off-target.
+ */
+template <std::uint8_t OUTPUTS = 1> class RecordingOutput final
+    : public PulseOutput {
+  std::array<std::vector<Pulse>, OUTPUTS> pulses_;
+  std::array<OutputStats, OUTPUTS> stats_{};
+  size_t batches_ = 0;
+
+public:
+  void write(uint8_t ch, const Pulse *pulses, size_t len) override {
+    assert(ch < OUTPUTS);
+    if (len == 0)
+      return;
+    auto &stats = stats_[ch];
+    stats.transactions++;
+    stats.pulses += len;
+    for (size_t i = 0; i < len; i++) {
+      pulses_[ch].push_back(pulses[i]);
+      stats.on += pulses[i].on;
+      stats.total += pulses[i].length();
+    }
+  }
+
+  void commit() override {
+    batches_++;
+    for (auto &stats : stats_)
+      stats.batches = batches_;
+  }
+
+  void clear() {
+    for (uint8_t ch = 0; ch < OUTPUTS; ch++) {
+      pulses_[ch].clear();
+      stats_[ch] = OutputStats();
+    }
+    batches_ = 0;
+  }
+
+  const std::vector<Pulse> &pulses(uint8_t ch = 0) const {
+    assert(ch < OUTPUTS);
+    return pulses_[ch];
+  }
+  const OutputStats &stats(uint8_t ch = 0) const {
+    assert(ch < OUTPUTS);
+    return stats_[ch];
+  }
+  size_t batches() const { return batches_; }
+};
+
+} // namespace teslasynth::midisynth
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "double_buffer.hpp"
 #include "esp_event.h"
 #include "freertos/idf_additions.h"
 #include "midi_synth.hpp"
@@ -12,6 +13,7 @@ using namespace midisynth;
 namespace {
 typedef Teslasynth<CONFIG_TESLASYNTH_OUTPUT_COUNT> TSYNTH;
 typedef Configuration<CONFIG_TESLASYNTH_OUTPUT_COUNT> AppConfig;
+typedef DoubleBuffer<AppConfig> StagedConfig;
 
 void on_track_play(bool playing) {
   if (playing) {
@@ -27,58 +29,93 @@ void on_track_play(bool playing) {
 class PlaybackHandle {
   TSYNTH *impl;
   SemaphoreHandle_t lock;
+  StagedConfig *staged;
 
 public:
   PlaybackHandle() {}
-  PlaybackHandle(TSYNTH *impl, SemaphoreHandle_t lock)
-      : impl(impl), lock(lock) {}
+  PlaybackHandle(TSYNTH *impl, SemaphoreHandle_t lock, StagedConfig *staged)
+      : impl(impl), lock(lock), staged(staged) {}
 
   inline void acquire() { xSemaphoreTake(lock, portMAX_DELAY); }
   inline void release() { xSemaphoreGive(lock); }
 
+  /**
+   * Applies the last configuration set from the UI, if there is a new one.
+   * Meant to be called between windows, playback goes on.
+   */
+  inline void adopt_config() {
+    if (staged->consume(impl->configuration()))
+      impl->reload_config();
+  }
+
+  /**
+   * Handles a message while holding the lock. Instruments it needs from the
+   * bank are read with the lock released, so playback goes on meanwhile.
+   */
   inline void handle(MidiChannelMessage msg, Duration time) {
+    while (auto n = impl->missing(msg)) {
+      release();
+      const auto instrument = impl->read(*n);
+      acquire();
+      impl->provide(*n, instrument);
+    }
     impl->handle(msg, time);
   }
+  inline void clock(Duration time) { impl->clock(time); }
   template <size_t BUFSIZE>
   inline void
-  sample_all(Duration16 max,
+  sample_all(Duration32 max,
              PulseBuffer<CONFIG_TESLASYNTH_OUTPUT_COUNT, BUFSIZE> &output) {
     impl->sample_all(max, output);
   };
+  template <size_t BUFSIZE>
+  inline bool
+  sample_chunk(RenderWindow<CONFIG_TESLASYNTH_OUTPUT_COUNT> &window,
+               PulseBuffer<CONFIG_TESLASYNTH_OUTPUT_COUNT, BUFSIZE> &output) {
+    return impl->sample_chunk(window, output);
+  };
+  inline const DutyStats &duty_stats(uint8_t ch) const {
+    return impl->duty_stats(ch);
+  }
 };
 
 class UIHandle {
   TSYNTH *impl;
-  SemaphoreHandle_t write_lock, read_lock;
+  SemaphoreHandle_t write_lock, config_lock;
+  StagedConfig *staged;
 
 public:
   UIHandle() {}
-  UIHandle(TSYNTH *impl, SemaphoreHandle_t write, SemaphoreHandle_t read)
-      : impl(impl), write_lock(write), read_lock(read) {}
-
-  inline constexpr auto &config_read() const {
-    xSemaphoreTake(read_lock, portMAX_DELAY);
-    auto &res = impl->configuration();
-    xSemaphoreGive(read_lock);
-    return res;
+  UIHandle(TSYNTH *impl, SemaphoreHandle_t write, SemaphoreHandle_t config,
+           StagedConfig *staged)
+      : impl(impl), write_lock(write), config_lock(config), staged(staged) {}
+
+  /// A consistent copy of the current configuration, never blocks
+  inline AppConfig config_read() const {
+    AppConfig config;
+    staged->snapshot(config);
+    return config;
   }
 
-  inline constexpr void config_set(const AppConfig &config,
-                                   bool reload = false) {
-    xSemaphoreTake(read_lock, portMAX_DELAY);
-
-    xSemaphoreTake(write_lock, portMAX_DELAY);
-    impl->configuration() = config;
-    if (reload)
-      impl->reload_config();
-    xSemaphoreGive(write_lock);
-
-    xSemaphoreGive(read_lock);
+  /// Changes whenever a new configuration is set
+  inline uint32_t config_version() const { return staged->version(); }
+
+  /**
+   * Publishes a new configuration, the playback adopts it at the start of
+   * its next window without being blocked.
+   */
+  inline void config_set(const AppConfig &config) {
+    xSemaphoreTake(config_lock, portMAX_DELAY);
+    staged->publish(config);
+    xSemaphoreGive(config_lock);
     ESP_ERROR_CHECK(esp_event_post(EVENT_SYNTHESIZER_BASE,
                                    SYNTHESIZER_CONFIG_UPDATED, NULL, 0,
                                    portMAX_DELAY));
   }
 
+  /// Number of instruments programs can change to
+  inline size_t instruments_size() const { return impl->instruments_size(); }
+
   inline constexpr void playback_off() {
     xSemaphoreTake(write_lock, portMAX_DELAY);
     impl->off();
@@ -88,13 +125,20 @@ public:
 
 class Application {
   TSYNTH impl;
-  SemaphoreHandle_t write_lock, read_lock;
+  SemaphoreHandle_t write_lock, config_lock;
+  StagedConfig staged;
 
 public:
-  Application(const AppConfig &config)
+  Application(const AppConfig &config,
+              midisynth::InstrumentBank *instruments = nullptr)
       : impl(config, on_track_play), write_lock(xSemaphoreCreateMutex()),
-        read_lock(xSemaphoreCreateMutex()) {}
-  PlaybackHandle playback() { return PlaybackHandle(&impl, write_lock); }
-  UIHandle ui() { return UIHandle(&impl, write_lock, read_lock); }
+        config_lock(xSemaphoreCreateMutex()), staged(config) {
+    if (instruments != nullptr)
+      impl.use_instruments(*instruments);
+  }
+  PlaybackHandle playback() {
+    return PlaybackHandle(&impl, write_lock, &staged);
+  }
+  UIHandle ui() { return UIHandle(&impl, write_lock, config_lock, &staged); }
 };
 }; // namespace teslasynth::app
@@ -11,6 +11,7 @@
 #include <optional>
 #include <stdio.h>
 #include <string.h>
+#include <string>
 
 namespace teslasynth::app::cli {
 using namespace synth;
@@ -24,26 +25,54 @@ static constexpr const char *duty_window = "duty-window";
 static constexpr const char *tuning = "tuning";
 static constexpr const char *notes = "notes";
 static constexpr const char *instrument = "instrument";
+static constexpr const char *thermal_time_constant = "thermal-tau";
+static constexpr const char *thermal_duty = "thermal-duty";
+static constexpr const char *heat_model = "heat-model";
+static constexpr const char *duty_mode = "duty-mode";
+static constexpr const char *voice_mode = "voice-mode";
+static constexpr const char *velocity_curve = "velocity-curve";
+static constexpr const char *power_duty = "power-duty";
+static constexpr const char *power_window = "power-window";
+static constexpr const char *max_concurrent = "max-concurrent";
+static constexpr const char *max_stagger = "max-stagger";
+static constexpr const char *channel = "channel";
 }; // namespace keys
 
-static bool parse_duration(const char *s, Duration16 *out) {
+static bool parse_duration(const char *s, Micros16 *out) {
   char *end;
   auto val = strtoul(s, &end, 0);
   if (end == s)
     return false; // no digits
 
   if (*end == '\0' || strcmp(end, "us") == 0) {
-    *out = Duration16::micros(val);
+    *out = Micros16::micros(val);
     return true;
   }
   if (strcmp(end, "ms") == 0) {
-    *out = Duration16::millis(val);
+    *out = Micros16::millis(val);
     return true;
   }
 
   return false; // unknown suffix
 }
 
+static bool parse_millis(const char *s, Millis16 *out) {
+  char *end;
+  auto val = strtoul(s, &end, 0);
+  if (end == s)
+    return false;
+
+  if (*end == '\0' || strcmp(end, "ms") == 0) {
+    *out = Millis16::millis(val);
+    return true;
+  }
+  if (strcmp(end, "s") == 0) {
+    *out = Millis16::seconds(val);
+    return true;
+  }
+  return false;
+}
+
 static bool parse_hertz(const char *s, Hertz *out) {
   char *end;
   float val = strtof(s, &end);
@@ -57,6 +86,19 @@ static bool parse_hertz(const char *s, Hertz *out) {
   return false;
 }
 
+static bool parse_duty(const char *s, DutyCycle *out) {
+  char *end;
+  float val = strtof(s, &end);
+  if (end == s || val < 0 || val > 100)
+    return false;
+
+  if (*end == '\0' || strcmp(end, "%") == 0) {
+    *out = DutyCycle(val);
+    return true;
+  }
+  return false;
+}
+
 static bool parse_notes(const char *s, uint8_t *out) {
   char *end;
   unsigned long val = strtoul(s, &end, 0);
@@ -70,7 +112,8 @@ static bool parse_notes(const char *s, uint8_t *out) {
   return false;
 }
 
-static bool parse_instrument(const char *s, std::optional<uint8_t> *out) {
+static bool parse_instrument(const char *s, size_t available,
+                             std::optional<uint8_t> *out) {
   char *end;
   long val = strtol(s, &end, 0);
   size_t len = strlen(s);
@@ -81,7 +124,8 @@ static bool parse_instrument(const char *s, std::optional<uint8_t> *out) {
   if (val < 0 || len == 0) {
     *out = {};
     return true;
-  } else if (*end == '\0' && static_cast<size_t>(val) < instruments_size) {
+  } else if (*end == '\0' && static_cast<size_t>(val) < available &&
+             val <= UINT8_MAX) {
     *out = val;
     return true;
   }
@@ -104,11 +148,19 @@ inline int invalid_frequency(const char *value) {
   return 1;
 }
 
-inline int invalid_instrument(const char *value) {
+inline int invalid_duty(const char *value) {
+  printf("Invalid duty cycle value: %s\n"
+         "Valid values are floating point numbers in [0, 100] followed by an "
+         "optional unit [%%]\n",
+         value);
+  return 1;
+}
+
+inline int invalid_instrument(const char *value, size_t available) {
   printf("Invalid instrument value: %s\n"
          "Valid values are optional integer numbers, negative values are "
-         "considered as no value. Max allowed value is %du\n",
-         value, instruments_size);
+         "considered as no value. Max allowed value is %u\n",
+         value, std::min<size_t>(available, UINT8_MAX + 1) - 1);
   return 1;
 }
 
@@ -120,6 +172,93 @@ static UIHandle handle_;
   (config.instrument.has_value() ? std::to_string(*config.instrument).c_str()  \
                                  : "")
 
+static const char *duty_mode_name(DutyMode mode) {
+  switch (mode) {
+  case DutyMode::Drop:
+    return "drop";
+  case DutyMode::Scale:
+    return "scale";
+  case DutyMode::LookAhead:
+    return "look-ahead";
+  }
+  return "";
+}
+
+static const char *voice_mode_name(VoiceMode mode) {
+  switch (mode) {
+  case VoiceMode::Poly:
+    return "poly";
+  case VoiceMode::Last:
+    return "last";
+  case VoiceMode::High:
+    return "high";
+  case VoiceMode::Low:
+    return "low";
+  }
+  return "";
+}
+
+static std::string velocity_curve_value(const VelocityCurve &curve) {
+  switch (curve.type) {
+  case VelocityCurveType::Log:
+    return "log";
+  case VelocityCurveType::Linear:
+    return "linear";
+  case VelocityCurveType::Exp:
+    return "exp";
+  case VelocityCurveType::Fixed:
+    return "fixed:" + std::to_string(curve.fixed);
+  case VelocityCurveType::User: {
+    std::string value = "user:";
+    for (size_t i = 0; i < curve.points.size(); i++)
+      value += (i ? "," : "") + std::to_string(curve.points[i].velocity) +
+               "/" + std::to_string(curve.points[i].level);
+    return value;
+  }
+  }
+  return "";
+}
+
+static bool parse_velocity_value(const char *s, char **end, uint8_t *out) {
+  auto val = strtoul(s, end, 10);
+  if (*end == s || val > 127)
+    return false;
+  *out = val;
+  return true;
+}
+
+// log, linear, exp, fixed:<level> or user:<velocity>/<level>,... with
+// exactly as many points as a curve holds
+static bool parse_velocity_curve(const char *s, VelocityCurve *out) {
+  char *end;
+  if (strcmp(s, "log") == 0)
+    out->type = VelocityCurveType::Log;
+  else if (strcmp(s, "linear") == 0)
+    out->type = VelocityCurveType::Linear;
+  else if (strcmp(s, "exp") == 0)
+    out->type = VelocityCurveType::Exp;
+  else if (strncmp(s, "fixed:", 6) == 0) {
+    if (!parse_velocity_value(s + 6, &end, &out->fixed) || *end != '\0')
+      return false;
+    out->type = VelocityCurveType::Fixed;
+  } else if (strncmp(s, "user:", 5) == 0) {
+    const char *p = s + 5;
+    for (size_t i = 0; i < VelocityCurve::max_points; i++) {
+      VelocityPoint &point = out->points[i];
+      if (!parse_velocity_value(p, &end, &point.velocity) || *end != '/' ||
+          !parse_velocity_value(end + 1, &end, &point.level))
+        return false;
+      const bool last = i + 1 == VelocityCurve::max_points;
+      if (*end != (last ? '\0' : ','))
+        return false;
+      p = end + 1;
+    }
+    out->type = VelocityCurveType::User;
+  } else
+    return false;
+  return true;
+}
+
 static void print_channel_config(uint8_t nr, const Config &config) {
   printf("Channel[%u] configuration:\n"
          "\t%s = %u\n"
@@ -127,26 +266,57 @@ static void print_channel_config(uint8_t nr, const Config &config) {
          "\t%s = %s\n"
          "\t%s = %s\n"
          "\t%s = %s\n"
-         "\t%s = <%s>\n",
+         "\t%s = <%s>\n"
+         "\t%s = %s\n"
+         "\t%s = %s\n"
+         "\t%s = %s\n"
+         "\t%s = %s\n"
+         "\t%s = %s\n"
+         "\t%s = %s\n",
          nr + 1, keys::notes, config.notes, keys::max_on_time,
          cstr(config.max_on_time), keys::min_deadtime,
          cstr(config.min_deadtime), keys::max_duty, cstr(config.max_duty),
          keys::duty_window, cstr(config.duty_window), keys::instrument,
-         instrument_value(config));
+         instrument_value(config), keys::thermal_time_constant,
+         cstr(config.thermal_time_constant), keys::thermal_duty,
+         cstr(config.thermal_duty), keys::heat_model,
+         config.heat_model == HeatModel::Squared ? "i2t" : "linear",
+         keys::duty_mode, duty_mode_name(config.duty_mode), keys::voice_mode,
+         voice_mode_name(config.voice_mode), keys::velocity_curve,
+         velocity_curve_value(config.velocity).c_str());
 }
 
 static int print_config() {
   auto config = handle_.config_read();
   printf("Synth configuration:\n"
          "\t%s = %s\n"
-         "\t%s = <%s>\n",
+         "\t%s = <%s>\n"
+         "\t%s = %s\n"
+         "\t%s = %s\n"
+         "\t%s = %u\n"
+         "\t%s = %s\n",
          keys::tuning, cstr(config.synth().a440), keys::instrument,
-         instrument_value(config.synth()));
+         instrument_value(config.synth()), keys::power_duty,
+         cstr(config.synth().power_duty), keys::power_window,
+         cstr(config.synth().power_window), keys::max_concurrent,
+         config.synth().max_concurrent, keys::max_stagger,
+         cstr(config.synth().max_stagger));
 
   for (auto i = 0; i < config.channels_size(); i++) {
     print_channel_config(i, config.channel(i));
   }
 
+  printf("Routes:\n");
+  for (uint8_t m = 0; m < midisynth::midi_channels; m++) {
+    for (uint8_t i = 0; i < config.channels_size(); i++) {
+      const auto &route = config.route(m, i);
+      if (route.enabled)
+        printf("\tMIDI channel %u -> channel %u, transpose = %+d, "
+               "velocity = %u%%\n",
+               m + 1, i + 1, route.transpose, route.velocity);
+    }
+  }
+
   return 0;
 }
 
@@ -155,8 +325,132 @@ static int print_config() {
     return invalid_duration(value);                                            \
   }
 
+#define read_duty(out)                                                         \
+  if (!parse_duty(value, out)) {                                               \
+    return invalid_duty(value);                                                \
+  }
+
+static int set_channel_config(Config &config, const char *key,
+                              const char *value) {
+  if (strcmp(key, keys::max_on_time) == 0) {
+    read_duration(&config.max_on_time);
+  } else if (strcmp(key, keys::min_deadtime) == 0) {
+    read_duration(&config.min_deadtime);
+  } else if (strcmp(key, keys::max_duty) == 0) {
+    read_duty(&config.max_duty);
+  } else if (strcmp(key, keys::duty_window) == 0) {
+    read_duration(&config.duty_window);
+  } else if (strcmp(key, keys::notes) == 0) {
+    if (!parse_notes(value, &config.notes)) {
+      printf("Invalid notes value %s, must be a number in [1, %i]", value,
+             Config::max_notes);
+      return 1;
+    }
+  } else if (strcmp(key, keys::thermal_time_constant) == 0) {
+    if (!parse_millis(value, &config.thermal_time_constant)) {
+      printf("Invalid time constant %s, valid values are unsigned integers "
+             "followed by an optional time unit [ms (default), s]\n",
+             value);
+      return 1;
+    }
+  } else if (strcmp(key, keys::thermal_duty) == 0) {
+    read_duty(&config.thermal_duty);
+  } else if (strcmp(key, keys::heat_model) == 0) {
+    if (strcmp(value, "i2t") == 0)
+      config.heat_model = HeatModel::Squared;
+    else if (strcmp(value, "linear") == 0)
+      config.heat_model = HeatModel::Linear;
+    else {
+      printf("Invalid heat model %s, must be one of [i2t, linear]\n", value);
+      return 1;
+    }
+  } else if (strcmp(key, keys::duty_mode) == 0) {
+    if (strcmp(value, "drop") == 0)
+      config.duty_mode = DutyMode::Drop;
+    else if (strcmp(value, "scale") == 0)
+      config.duty_mode = DutyMode::Scale;
+    else if (strcmp(value, "look-ahead") == 0)
+      config.duty_mode = DutyMode::LookAhead;
+    else {
+      printf("Invalid duty mode %s, must be one of "
+             "[drop, scale, look-ahead]\n",
+             value);
+      return 1;
+    }
+  } else if (strcmp(key, keys::voice_mode) == 0) {
+    if (strcmp(value, "poly") == 0)
+      config.voice_mode = VoiceMode::Poly;
+    else if (strcmp(value, "last") == 0)
+      config.voice_mode = VoiceMode::Last;
+    else if (strcmp(value, "high") == 0)
+      config.voice_mode = VoiceMode::High;
+    else if (strcmp(value, "low") == 0)
+      config.voice_mode = VoiceMode::Low;
+    else {
+      printf("Invalid voice mode %s, must be one of "
+             "[poly, last, high, low]\n",
+             value);
+      return 1;
+    }
+  } else if (strcmp(key, keys::velocity_curve) == 0) {
+    if (!parse_velocity_curve(value, &config.velocity)) {
+      printf("Invalid velocity curve %s, must be one of [log, linear, exp, "
+             "fixed:<level>, user:<velocity>/<level>,...] with %u points "
+             "in [0, 127]\n",
+             value, unsigned(VelocityCurve::max_points));
+      return 1;
+    }
+  } else if (strcmp(key, keys::instrument) == 0) {
+    const size_t available = handle_.instruments_size();
+    if (!parse_instrument(value, available, &config.instrument)) {
+      return invalid_instrument(value, available);
+    }
+  } else {
+    printf("Unknown config: %s\n", key);
+    return 1;
+  }
+  return 0;
+}
+
+/// @return nothing if the key isn't a synth setting
+static std::optional<int> set_synth_config(SynthConfig &config, const char *key,
+                                           const char *value) {
+  if (strcmp(key, keys::tuning) == 0) {
+    if (!parse_hertz(value, &config.a440) || config.a440 <= 0_hz)
+      return invalid_frequency(value);
+  } else if (strcmp(key, keys::power_duty) == 0) {
+    read_duty(&config.power_duty);
+  } else if (strcmp(key, keys::power_window) == 0) {
+    read_duration(&config.power_window);
+  } else if (strcmp(key, keys::max_concurrent) == 0) {
+    char *end;
+    unsigned long val = strtoul(value, &end, 0);
+    if (end == value || *end != '\0' ||
+        val > CONFIG_TESLASYNTH_OUTPUT_COUNT) {
+      printf("Invalid max concurrent value %s, must be a number in [0, %u], "
+             "0 for no limit\n",
+             value, unsigned(CONFIG_TESLASYNTH_OUTPUT_COUNT));
+      return 1;
+    }
+    config.max_concurrent = val;
+  } else if (strcmp(key, keys::max_stagger) == 0) {
+    read_duration(&config.max_stagger);
+  } else {
+    return {};
+  }
+  return 0;
+}
+
+/**
+ * Changes the current configuration, then publishes and persists it.
+ * Channel settings go to the channel picked by `channel=<n>`, or to every
+ * channel. The instrument is the channel's when one is picked, the synth's
+ * otherwise.
+ */
 static int set_config(int argc, char **argv) {
-  Config config;
+  AppConfig config = handle_.config_read();
+  uint8_t first = 0, last = config.channels_size() - 1;
+  bool picked = false;
   for (int i = 0; i < argc; i++) {
     char *eq = strchr(argv[i], '=');
     if (!eq) {
@@ -164,30 +458,43 @@ static int set_config(int argc, char **argv) {
       return 1;
     }
     *eq = 0;
-    char *key = argv[i], *value = eq + 1;
-
-    if (strcmp(key, keys::max_on_time) == 0) {
-      read_duration(&config.max_on_time);
-    } else if (strcmp(key, keys::min_deadtime) == 0) {
-      read_duration(&config.min_deadtime);
-    } else if (strcmp(key, keys::notes) == 0) {
-      if (!parse_notes(value, &config.notes)) {
-        printf("Invalid notes value %s, must be a number in [1, %i]", value,
-               Config::max_notes);
+    if (strcmp(argv[i], keys::channel) == 0) {
+      char *end;
+      unsigned long val = strtoul(eq + 1, &end, 0);
+      if (end == eq + 1 || *end != '\0' || val < 1 ||
+          val > config.channels_size()) {
+        printf("Invalid channel %s, must be a number in [1, %u]\n", eq + 1,
+               config.channels_size());
         return 1;
       }
-    } else if (strcmp(key, keys::instrument) == 0) {
-      if (!parse_instrument(value, &config.instrument)) {
-        return invalid_instrument(value);
-      }
-    } else {
-      printf("Unknown config: %s", key);
-      return 1;
+      first = last = val - 1;
+      picked = true;
+    }
+  }
+
+  for (int i = 0; i < argc; i++) {
+    const char *key = argv[i], *value = argv[i] + strlen(argv[i]) + 1;
+    if (strcmp(key, keys::channel) == 0)
+      continue;
+    if (auto res = set_synth_config(config.synth(), key, value)) {
+      if (*res != 0)
+        return *res;
+      continue;
+    }
+    if (!picked && strcmp(key, keys::instrument) == 0) {
+      const size_t available = handle_.instruments_size();
+      if (!parse_instrument(value, available, &config.synth().instrument))
+        return invalid_instrument(value, available);
+      continue;
     }
+    for (uint8_t ch = first; ch <= last; ch++)
+      if (int res = set_channel_config(config.channel(ch), key, value))
+        return res;
   }
 
-  // update_config(config);
-  // save_config();
+  handle_.config_set(config);
+  persist(handle_);
+  print_config();
   return 0;
 }
 
@@ -214,7 +521,8 @@ void register_configuration_commands(UIHandle handle) {
   const esp_console_cmd_t cfg_cmd = {
       .command = "config",
       .help = "Configuration commands",
-      .hint = "set <key1>=<val1> [<key2>=<val2> …] | show | reset",
+      .hint = "set [channel=<n>] <key1>=<val1> [<key2>=<val2> …] | show | "
+              "reset",
       .func = config_cmd,
   };
   ESP_ERROR_CHECK(esp_console_cmd_register(&cfg_cmd));
@@ -1,13 +1,27 @@
 #include "synth.hpp"
+#include "config_codec.hpp"
 #include "esp_err.h"
 #include "esp_log.h"
 #include "nvs.h"
+#include <array>
+#include <cstdio>
 #include <cstring>
+#include <optional>
+#include <vector>
 
 namespace teslasynth::app::configuration {
 static const char *TAG = "synth_config";
-static const char *KEY = "config";
+static const char *VERSION_KEY = "version";
+// Configuration struct stored as a blob by format version 1
+static const char *LEGACY_KEY = "config";
 using namespace core;
+using namespace midisynth;
+
+typedef codec::Fields<CONFIG_TESLASYNTH_OUTPUT_COUNT> AppFields;
+
+// What is known to be in NVS, so only changed fields are written
+static AppFields stored_fields;
+static std::array<bool, std::tuple_size<AppFields>::value> stored{};
 
 static esp_err_t init(nvs_handle_t &handle) {
   esp_err_t err = nvs_open("synth", NVS_READWRITE, &handle);
@@ -17,16 +31,97 @@ static esp_err_t init(nvs_handle_t &handle) {
   return err;
 }
 
+static void field_key(const codec::Field &field,
+                      char (&key)[NVS_KEY_NAME_MAX_SIZE]) {
+  snprintf(key, sizeof(key), "f%u.%u", field.section, field.tag);
+}
+
+static size_t write_fields(nvs_handle_t handle, const AppConfig &config) {
+  const AppFields fields = codec::encode(config);
+  size_t written = 0;
+  for (size_t i = 0; i < fields.size(); i++) {
+    if (stored[i] && stored_fields[i] == fields[i])
+      continue;
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    field_key(fields[i], key);
+    auto err = nvs_set_u32(handle, key, fields[i].value);
+    if (err != ESP_OK) {
+      ESP_LOGE(TAG, "Couldn't persist %s (%s)", key, esp_err_to_name(err));
+      continue;
+    }
+    stored_fields[i] = fields[i];
+    stored[i] = true;
+    written++;
+  }
+  return written;
+}
+
+static AppConfig read_legacy(nvs_handle_t handle) {
+  size_t size = 0;
+  auto err = nvs_get_blob(handle, LEGACY_KEY, nullptr, &size);
+  if (err == ESP_ERR_NVS_NOT_FOUND)
+    return AppConfig();
+  std::vector<uint8_t> blob(size);
+  if (err == ESP_OK)
+    err = nvs_get_blob(handle, LEGACY_KEY, blob.data(), &size);
+  std::optional<AppConfig> config;
+  if (err == ESP_OK)
+    config = codec::legacy::decode<CONFIG_TESLASYNTH_OUTPUT_COUNT>(
+        blob.data(), size);
+  if (!config) {
+    ESP_LOGE(TAG, "Legacy configuration doesn't match, using defaults");
+    return AppConfig();
+  }
+  return *config;
+}
+
+// Moves the version 1 blob to per-field keys, the blob is only dropped once
+// every field made it
+static AppConfig migrate(nvs_handle_t handle) {
+  AppConfig config = read_legacy(handle);
+  if (write_fields(handle, config) != stored.size() ||
+      nvs_commit(handle) != ESP_OK ||
+      nvs_set_u8(handle, VERSION_KEY, codec::format_version) != ESP_OK ||
+      nvs_commit(handle) != ESP_OK) {
+    ESP_LOGE(TAG, "Couldn't migrate configuration, will try again");
+    return config;
+  }
+  nvs_erase_key(handle, LEGACY_KEY);
+  nvs_commit(handle);
+  ESP_LOGI(TAG, "Migrated configuration to format %u",
+           codec::format_version);
+  return config;
+}
+
 AppConfig read() {
   nvs_handle_t handle;
   ESP_ERROR_CHECK(init(handle));
-  AppConfig config;
 
-  size_t read_size = sizeof(config);
-  auto err = nvs_get_blob(handle, KEY, &config, &read_size);
-  if (err != ESP_OK || read_size != sizeof(config)) {
-    ESP_LOGE(TAG, "Corrupted configuration!");
-    config = AppConfig();
+  uint8_t version = 0;
+  if (nvs_get_u8(handle, VERSION_KEY, &version) != ESP_OK) {
+    AppConfig config = migrate(handle);
+    nvs_close(handle);
+    return config;
+  }
+  if (version > codec::format_version)
+    ESP_LOGW(TAG, "Configuration is from a newer format %u, unknown "
+                  "fields are kept but ignored",
+             version);
+
+  // Fields that are missing or invalid keep their defaults
+  AppConfig config;
+  AppFields fields = codec::encode(config);
+  for (size_t i = 0; i < fields.size(); i++) {
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    field_key(fields[i], key);
+    if (nvs_get_u32(handle, key, &fields[i].value) != ESP_OK)
+      continue;
+    if (!codec::decode(fields[i], config)) {
+      ESP_LOGW(TAG, "Ignoring invalid value of %s", key);
+      continue;
+    }
+    stored_fields[i] = fields[i];
+    stored[i] = true;
   }
 
   nvs_close(handle);
@@ -34,17 +129,12 @@ AppConfig read() {
 }
 
 void persist(UIHandle &ui) {
-  static_assert(std::is_trivially_copyable<AppConfig>::value,
-                "AppConfig must be trivially copyable");
-
   nvs_handle_t handle;
   ESP_ERROR_CHECK(init(handle));
 
-  AppConfig config = ui.config_read();
-  auto err = nvs_set_blob(handle, KEY, &config, sizeof(config));
-  if (err != ESP_OK) {
-    ESP_LOGE(TAG, "Couldn't persist configuration!");
-  } else {
+  size_t written = write_fields(handle, ui.config_read());
+  if (written > 0) {
+    ESP_LOGI(TAG, "Persisted %u changed field(s)", written);
     nvs_commit(handle);
   }
 
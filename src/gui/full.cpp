@@ -211,7 +211,7 @@ static void start_gui() {
   lv_scr_load(splash_screen);
 }
 
-void init() {
+void init(UIHandle) {
   init_ui();
   display = install_display();
 #if CONFIG_TESLASYNTH_TOUCH_ENABLED
@@ -33,12 +33,20 @@ void init_ui() {
   ESP_ERROR_CHECK(lvgl_port_init(&lvgl_cfg));
 }
 
+static UIHandle ui_;
+static uint32_t rendered_version = UINT32_MAX;
+
 lv_obj_t *label1, *label2;
 void render_config(void *) {
   if (label1 == nullptr || label2 == nullptr)
     return;
-  // TODO new
-  const Config config; //= app::configuration::get_config();
+  // Nothing to redraw unless the configuration has changed
+  const uint32_t version = ui_.config_version();
+  if (version == rendered_version)
+    return;
+  rendered_version = version;
+  const AppConfig app_config = ui_.config_read();
+  const Config &config = app_config.channel_configs[0];
 
   lv_label_set_text_fmt(label1, "Max on: %s",
                         std::string(config.max_on_time).c_str());
@@ -130,7 +138,8 @@ static void config_update_handler(void *, esp_event_base_t, int32_t, void *) {
   lv_async_call(render_config, nullptr);
 }
 
-void init() {
+void init(UIHandle ui) {
+  ui_ = ui;
   init_ui();
   display = install_display();
   ESP_LOGI(TAG, "starting the UI");
@@ -9,15 +9,17 @@ extern "C" void app_main(void) {
   devices::storage::init();
   ESP_ERROR_CHECK(esp_event_loop_create_default());
 
-  Application app(configuration::read());
+  // The synth is too large for the main task's stack, and outlives it anyway
+  static Application app(configuration::read(),
+                         devices::storage::instrument_bank());
 
 #ifndef CONFIG_TESLASYNTH_GUI_NONE
-  gui::init();
+  gui::init(app.ui());
 #endif
   cli::init(app.ui());
-  devices::rmt::init();
+  auto &output = devices::output::init();
   auto sbuf = devices::ble_midi::init();
-  synth::init(sbuf, app.playback());
+  synth::init(sbuf, app.playback(), output);
   while (1) {
     vTaskDelay(portMAX_DELAY);
   }
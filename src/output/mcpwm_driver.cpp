@@ -0,0 +1,255 @@
+#include "driver/mcpwm_prelude.h"
+#include "esp_attr.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "mcpwm_driver.hpp"
+#include "midi_synth.hpp"
+#include "pulse_output.hpp"
+#include "sdkconfig.h"
+#include "teslasynth.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+#if CONFIG_TESLASYNTH_OUTPUT_BACKEND_MCPWM
+
+namespace teslasynth::app::devices::mcpwm {
+using teslasynth::midisynth::Pulse;
+
+#define MCPWM_RESOLUTION_HZ (teslasynth::core::tick_rate)
+#define MCPWM_QUEUE_SIZE 256
+#define MCPWM_IDLE_TICKS (teslasynth::core::tick_rate / 1000)
+// Shortest idle period left when catching up, so the interrupts keep up
+#define MCPWM_MIN_IDLE_TICKS (teslasynth::core::tick_rate / 100000)
+
+namespace {
+
+const char *TAG = "MCPWM-DRIVER";
+
+/**
+ * A single timer period, the output is high from the start of the period
+ * until the compare value is reached.
+ */
+struct Period {
+  uint16_t ticks, on;
+};
+
+struct Channel {
+  mcpwm_timer_handle_t timer = nullptr;
+  mcpwm_oper_handle_t oper = nullptr;
+  mcpwm_cmpr_handle_t comparator = nullptr;
+  mcpwm_gen_handle_t generator = nullptr;
+  QueueHandle_t queue = nullptr;
+  // Idle time played when the queue ran empty, only written by the interrupt,
+  // and how much of it later silences were shortened by to get back in time
+  volatile uint32_t late = 0;
+  uint32_t caught_up = 0;
+};
+
+Channel channels[CONFIG_TESLASYNTH_OUTPUT_COUNT];
+
+const uint8_t output_pins[] = {
+#if CONFIG_TESLASYNTH_OUTPUT_COUNT >= 1
+    CONFIG_TESLASYNTH_OUTPUT_GPIO_PIN1,
+#endif
+#if CONFIG_TESLASYNTH_OUTPUT_COUNT >= 2
+    CONFIG_TESLASYNTH_OUTPUT_GPIO_PIN2,
+#endif
+#if CONFIG_TESLASYNTH_OUTPUT_COUNT >= 3
+    CONFIG_TESLASYNTH_OUTPUT_GPIO_PIN3,
+#endif
+#if CONFIG_TESLASYNTH_OUTPUT_COUNT >= 4
+    CONFIG_TESLASYNTH_OUTPUT_GPIO_PIN4,
+#endif
+};
+
+// Values written here are latched on the next timer empty event, so the
+// callback always prepares the period after the one that is starting.
+bool IRAM_ATTR on_empty(mcpwm_timer_handle_t timer,
+                        const mcpwm_timer_event_data_t *, void *arg) {
+  Channel *channel = static_cast<Channel *>(arg);
+  BaseType_t woken = pdFALSE;
+  Period next;
+  if (xQueueReceiveFromISR(channel->queue, &next, &woken) != pdTRUE) {
+    next = {.ticks = MCPWM_IDLE_TICKS, .on = 0};
+    channel->late = channel->late + next.ticks;
+  }
+
+  mcpwm_timer_set_period(timer, next.ticks);
+  // A zero compare value coincides with the empty event, the compare action
+  // has the higher priority so the output stays low for the whole period.
+  mcpwm_comparator_set_compare_value(channel->comparator, next.on);
+  return woken == pdTRUE;
+}
+
+void init_channel(uint8_t ch) {
+  Channel &channel = channels[ch];
+  const int group = ch / SOC_MCPWM_TIMERS_PER_GROUP;
+
+  channel.queue = xQueueCreate(MCPWM_QUEUE_SIZE, sizeof(Period));
+  assert(channel.queue);
+
+  mcpwm_timer_config_t timer_config = {
+      .group_id = group,
+      .clk_src = MCPWM_TIMER_CLK_SRC_DEFAULT,
+      .resolution_hz = MCPWM_RESOLUTION_HZ,
+      .count_mode = MCPWM_TIMER_COUNT_MODE_UP,
+      .period_ticks = MCPWM_IDLE_TICKS,
+      .intr_priority = 0,
+      .flags =
+          {
+              .update_period_on_empty = true,
+              .update_period_on_sync = false,
+              .allow_pd = false,
+          },
+  };
+  ESP_ERROR_CHECK(mcpwm_new_timer(&timer_config, &channel.timer));
+
+  mcpwm_operator_config_t operator_config = {
+      .group_id = group,
+      .intr_priority = 0,
+      .flags = {},
+  };
+  ESP_ERROR_CHECK(mcpwm_new_operator(&operator_config, &channel.oper));
+  ESP_ERROR_CHECK(mcpwm_operator_connect_timer(channel.oper, channel.timer));
+
+  mcpwm_comparator_config_t comparator_config = {
+      .intr_priority = 0,
+      .flags = {.update_cmp_on_tez = true},
+  };
+  ESP_ERROR_CHECK(mcpwm_new_comparator(channel.oper, &comparator_config,
+                                       &channel.comparator));
+  ESP_ERROR_CHECK(mcpwm_comparator_set_compare_value(channel.comparator, 0));
+
+  mcpwm_generator_config_t generator_config = {
+      .gen_gpio_num = output_pins[ch],
+      .flags = {},
+  };
+  ESP_ERROR_CHECK(mcpwm_new_generator(channel.oper, &generator_config,
+                                      &channel.generator));
+  ESP_ERROR_CHECK(mcpwm_generator_set_action_on_timer_event(
+      channel.generator,
+      MCPWM_GEN_TIMER_EVENT_ACTION(MCPWM_TIMER_DIRECTION_UP,
+                                   MCPWM_TIMER_EVENT_EMPTY,
+                                   MCPWM_GEN_ACTION_HIGH)));
+  ESP_ERROR_CHECK(mcpwm_generator_set_action_on_compare_event(
+      channel.generator,
+      MCPWM_GEN_COMPARE_EVENT_ACTION(MCPWM_TIMER_DIRECTION_UP,
+                                     channel.comparator, MCPWM_GEN_ACTION_LOW)));
+
+  mcpwm_timer_event_callbacks_t callbacks = {
+      .on_full = nullptr,
+      .on_empty = on_empty,
+      .on_stop = nullptr,
+  };
+  ESP_ERROR_CHECK(
+      mcpwm_timer_register_event_callbacks(channel.timer, &callbacks, &channel));
+}
+
+} // namespace
+
+void enable(void) {
+  ESP_LOGI(TAG, "Enable MCPWM timer(s)");
+  for (uint8_t i = 0; i < CONFIG_TESLASYNTH_OUTPUT_COUNT; ++i) {
+    ESP_ERROR_CHECK(mcpwm_timer_enable(channels[i].timer));
+    ESP_ERROR_CHECK(
+        mcpwm_timer_start_stop(channels[i].timer, MCPWM_TIMER_START_NO_STOP));
+  }
+}
+
+void disable(void) {
+  ESP_LOGI(TAG, "Disable MCPWM timer(s)");
+  for (uint8_t i = 0; i < CONFIG_TESLASYNTH_OUTPUT_COUNT; ++i) {
+    ESP_ERROR_CHECK(
+        mcpwm_timer_start_stop(channels[i].timer, MCPWM_TIMER_STOP_EMPTY));
+    ESP_ERROR_CHECK(mcpwm_timer_disable(channels[i].timer));
+  }
+}
+
+void init(void) {
+  ESP_LOGI(TAG, "Create %u MCPWM output(s)", CONFIG_TESLASYNTH_OUTPUT_COUNT);
+  for (uint8_t i = 0; i < CONFIG_TESLASYNTH_OUTPUT_COUNT; ++i)
+    init_channel(i);
+  enable();
+}
+
+void pulse_write(const Pulse *pulse, size_t len, uint8_t ch) {
+  Channel &channel = channels[ch];
+  constexpr uint32_t max_ticks = std::numeric_limits<uint16_t>::max();
+  uint32_t late = channel.late - channel.caught_up;
+
+  for (size_t i = 0; i < len; i++) {
+    uint32_t on = pulse[i].on.ticks(),
+             off = std::max<uint32_t>(1, pulse[i].off.ticks());
+    // Only silences are shortened, the deadtime after a pulse is kept
+    if (on == 0 && late > 0 && off > MCPWM_MIN_IDLE_TICKS) {
+      uint32_t cut = std::min(late, off - MCPWM_MIN_IDLE_TICKS);
+      off -= cut;
+      late -= cut;
+      channel.caught_up += cut;
+    }
+    // Periods can't be longer than the timer, so long pulses are split and
+    // the remainder is sent as idle periods.
+    uint32_t remained = on + off;
+    while (remained > 0) {
+      uint32_t ticks = std::min(remained, max_ticks);
+      Period period = {
+          .ticks = static_cast<uint16_t>(ticks),
+          .on = static_cast<uint16_t>(std::min(on, ticks - 1)),
+      };
+      // Waits for the timer to play what is queued, nothing is dropped
+      xQueueSend(channel.queue, &period, portMAX_DELAY);
+      on -= period.on;
+      remained -= ticks;
+    }
+  }
+
+#if CONFIG_TESLASYNTH_DEBUG
+  static size_t counter = 0;
+  if (counter++ % 100 == 0) {
+    ESP_LOGI(TAG, "MCPWM queue stats, waiting: %u, late: %u",
+             uxQueueMessagesWaiting(channel.queue),
+             static_cast<unsigned>(channel.late - channel.caught_up));
+  }
+#endif
+}
+
+void resync(void) {
+  for (auto &channel : channels)
+    channel.caught_up = channel.late;
+}
+} // namespace teslasynth::app::devices::mcpwm
+
+namespace teslasynth::app::devices::output {
+namespace {
+// Periods are queued as they are written, the timers keep running on idle
+// periods in between. Batches with nothing in them come while the track is
+// stopped, the outputs are in time with whatever is played next.
+class McpwmOutput final : public midisynth::PulseOutput {
+  bool written_ = false;
+
+public:
+  void write(uint8_t ch, const midisynth::Pulse *pulses, size_t len) override {
+    mcpwm::pulse_write(pulses, len, ch);
+    written_ |= len > 0;
+  }
+
+  void commit() override {
+    if (!written_)
+      mcpwm::resync();
+    written_ = false;
+  }
+};
+} // namespace
+
+midisynth::PulseOutput &init(void) {
+  static McpwmOutput output;
+  mcpwm::init();
+  return output;
+}
+} // namespace teslasynth::app::devices::output
+
+#endif
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "midi_synth.hpp"
+#include <cstddef>
+#include <cstdint>
+
+namespace teslasynth::app::devices::mcpwm {
+void init(void);
+/**
+ * Queues pulses of an output, waits while the queue is full.
+ * Silences are shortened to make up for the time the queue ran empty.
+ */
+void pulse_write(const midisynth::Pulse *pulse, size_t len, uint8_t ch = 0);
+/// Forgets the time lost to an empty queue, when there was nothing to play
+void resync(void);
+void enable(void);
+void disable(void);
+} // namespace teslasynth::app::devices::mcpwm
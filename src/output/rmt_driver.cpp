@@ -6,39 +6,75 @@
 #include "esp_err.h"
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
 #include "hal/rmt_types.h"
 #include "midi_synth.hpp"
+#include "pulse_output.hpp"
 #include "sdkconfig.h"
 #include "soc/gpio_num.h"
+#include "teslasynth.hpp"
 #include <algorithm>
 #include <cstddef>
 #include <cstdint>
 #include <stddef.h>
 #include <stdio.h>
 
+#if CONFIG_TESLASYNTH_OUTPUT_BACKEND_RMT
+
 namespace teslasynth::app::devices::rmt {
+using namespace teslasynth::core;
 using teslasynth::midisynth::Pulse;
 
-#define RMT_BUZZER_RESOLUTION_HZ 1'000'000
+#define RMT_BUZZER_RESOLUTION_HZ (teslasynth::core::tick_rate)
 
 namespace {
 
 const char *TAG = "RMT-DRIVER";
 
-inline void symbol_for_idx(Pulse const *current, rmt_symbol_word_t *symbol) {
-  if (current->is_zero()) {
+// Symbol durations are 15 bits wide, longer pulses take several symbols
+constexpr uint32_t max_symbol_ticks = 0x7fff;
+
+/**
+ * Progress of the encoder through the pulses of the current transaction.
+ * A pulse can be expanded into several symbols, so it may span callbacks.
+ */
+struct EncoderState {
+  size_t index;
+  uint32_t high, low;
+  bool loaded;
+};
+
+inline uint32_t take(uint32_t &left) {
+  uint32_t d = std::clamp<uint32_t>(left, 1, max_symbol_ticks);
+  left -= std::min(left, d);
+  return d;
+}
+
+inline void next_symbol(EncoderState &state, rmt_symbol_word_t *symbol) {
+  if (state.high > 0) {
+    uint32_t d0 = take(state.high);
+    bool high = state.high > 0;
+    uint32_t d1 = take(high ? state.high : state.low);
     *symbol = {
-        .duration0 = std::max<uint16_t>(1, current->off.micros() - 1),
-        .level0 = 0,
-        .duration1 = 1,
-        .level1 = 0,
+        .duration0 = static_cast<uint16_t>(d0),
+        .level0 = 1,
+        .duration1 = static_cast<uint16_t>(d1),
+        .level1 = high,
     };
   } else {
+    // Both halves are low, so a long silence costs one symbol per two
+    // maximum durations. It is spread evenly over the symbols, as durations
+    // of zero would end the transmission.
+    constexpr uint32_t max_idle = 2 * max_symbol_ticks;
+    uint32_t symbols =
+        std::max<uint32_t>(1, (state.low + max_idle - 1) / max_idle);
+    uint32_t part = std::max<uint32_t>(2, (state.low + symbols - 1) / symbols);
+    state.low -= std::min(state.low, part);
     *symbol = {
-        .duration0 = current->on.micros(),
-        .level0 = 1,
-        .duration1 = std::max<uint16_t>(1, current->off.micros()),
+        .duration0 = static_cast<uint16_t>(part / 2),
+        .level0 = 0,
+        .duration1 = static_cast<uint16_t>(part - part / 2),
         .level1 = 0,
     };
   }
@@ -49,19 +85,45 @@ size_t callback(const void *data, size_t data_size, size_t symbols_written,
                 void *arg) {
   const Pulse *input = static_cast<const Pulse *>(data);
   const size_t data_length = data_size / sizeof(Pulse);
+  EncoderState &state = *static_cast<EncoderState *>(arg);
+  if (symbols_written == 0)
+    state = {};
 
   size_t written = 0;
-  for (; written < symbols_free && symbols_written + written < data_length;
-       written++) {
-    Pulse const *current = &input[symbols_written + written];
-    symbol_for_idx(current, &symbols[written]);
+  for (; written < symbols_free && state.index < data_length; written++) {
+    if (!state.loaded) {
+      state.high = input[state.index].on.ticks();
+      state.low = input[state.index].off.ticks();
+      state.loaded = true;
+    }
+    next_symbol(state, &symbols[written]);
+    if (state.high == 0 && state.low == 0) {
+      state.index++;
+      state.loaded = false;
+    }
   }
-  if (written + symbols_written == data_length)
+  if (state.index == data_length)
     *done = true;
   return written;
 }
 rmt_channel_handle_t channels[CONFIG_TESLASYNTH_OUTPUT_COUNT];
 rmt_encoder_handle_t encoders[CONFIG_TESLASYNTH_OUTPUT_COUNT];
+EncoderState encoder_states[CONFIG_TESLASYNTH_OUTPUT_COUNT];
+
+constexpr size_t trans_queue_depth = 10;
+
+/**
+ * Transactions submitted and seen done on a channel. The encoder reads the
+ * pulses while they are sent, so their buffer is only free once done.
+ */
+struct Progress {
+  SemaphoreHandle_t done = nullptr;
+  uint32_t submitted = 0, completed = 0;
+};
+Progress progress[CONFIG_TESLASYNTH_OUTPUT_COUNT];
+#if CONFIG_TESLASYNTH_OUTPUT_SYNC
+rmt_sync_manager_handle_t synchro = nullptr;
+#endif
 
 constexpr rmt_transmit_config_t tx_config = {
     .loop_count = 0,
@@ -86,6 +148,37 @@ const uint8_t output_pins[] = {
     CONFIG_TESLASYNTH_OUTPUT_GPIO_PIN4,
 #endif
 };
+
+inline esp_err_t transmit(const Pulse *pulse, size_t len, uint8_t ch) {
+  esp_err_t err = rmt_transmit(channels[ch], encoders[ch], pulse,
+                               len * sizeof(Pulse), &tx_config);
+  if (err == ESP_OK)
+    progress[ch].submitted++;
+  return err;
+}
+
+bool IRAM_ATTR on_done(rmt_channel_handle_t, const rmt_tx_done_event_data_t *,
+                       void *arg) {
+  BaseType_t woken = pdFALSE;
+  xSemaphoreGiveFromISR(static_cast<Progress *>(arg)->done, &woken);
+  return woken == pdTRUE;
+}
+
+#if CONFIG_TESLASYNTH_OUTPUT_SYNC
+// Sent on channels that have nothing to play in a synchronized batch, as the
+// sync manager holds back the whole batch until every channel has started.
+constexpr Pulse idle_pulse = {.on = 0_us, .off = 1_us};
+
+void init_sync_manager() {
+  ESP_LOGI(TAG, "Create RMT sync manager for %u channel(s)",
+           CONFIG_TESLASYNTH_OUTPUT_COUNT);
+  rmt_sync_manager_config_t synchro_config = {
+      .tx_channel_array = channels,
+      .array_size = CONFIG_TESLASYNTH_OUTPUT_COUNT,
+  };
+  ESP_ERROR_CHECK(rmt_new_sync_manager(&synchro_config, &synchro));
+}
+#endif
 } // namespace
 
 void enable(void) {
@@ -93,6 +186,10 @@ void enable(void) {
   for (uint8_t i = 0; i < CONFIG_TESLASYNTH_OUTPUT_COUNT; ++i) {
     ESP_ERROR_CHECK(rmt_enable(channels[i]));
   }
+#if CONFIG_TESLASYNTH_OUTPUT_SYNC
+  if (synchro)
+    ESP_ERROR_CHECK(rmt_sync_reset(synchro));
+#endif
 }
 
 void disable(void) {
@@ -105,7 +202,7 @@ void disable(void) {
 void init(void) {
   ESP_LOGI(TAG, "Create %u RMT TX channel(s)", CONFIG_TESLASYNTH_OUTPUT_COUNT);
 
-  constexpr rmt_simple_encoder_config_t encoder_config = {
+  rmt_simple_encoder_config_t encoder_config = {
       .callback = callback,
       .arg = NULL,
       .min_chunk_size = 1,
@@ -115,8 +212,8 @@ void init(void) {
       .clk_src = RMT_CLK_SRC_DEFAULT, // select source clock
       .resolution_hz = RMT_BUZZER_RESOLUTION_HZ,
       .mem_block_symbols = 64,
-      .trans_queue_depth = 10, // set the maximum number of transactions that
-                               // can pend in the background
+      // set the maximum number of transactions that can pend in the background
+      .trans_queue_depth = trans_queue_depth,
       .flags =
           {
               .invert_out = false,
@@ -130,10 +227,20 @@ void init(void) {
   for (uint8_t i = 0; i < CONFIG_TESLASYNTH_OUTPUT_COUNT; ++i) {
     tx_chan_config.gpio_num = static_cast<gpio_num_t>(output_pins[i]);
     ESP_ERROR_CHECK(rmt_new_tx_channel(&tx_chan_config, &channels[i]));
+    encoder_config.arg = &encoder_states[i];
     ESP_ERROR_CHECK(rmt_new_simple_encoder(&encoder_config, &encoders[i]));
+    // Done transactions are only taken when a buffer is needed again
+    progress[i].done = xSemaphoreCreateCounting(2 * trans_queue_depth, 0);
+    assert(progress[i].done);
+    rmt_tx_event_callbacks_t callbacks = {.on_trans_done = on_done};
+    ESP_ERROR_CHECK(
+        rmt_tx_register_event_callbacks(channels[i], &callbacks, &progress[i]));
   }
 
   enable();
+#if CONFIG_TESLASYNTH_OUTPUT_SYNC
+  init_sync_manager();
+#endif
 }
 
 void pulse_write(const midisynth::Pulse *pulse, size_t len, uint8_t ch) {
@@ -151,7 +258,90 @@ void pulse_write(const midisynth::Pulse *pulse, size_t len, uint8_t ch) {
 
   if (len == 0)
     return;
-  ESP_ERROR_CHECK_WITHOUT_ABORT(rmt_transmit(channels[ch], encoders[ch], pulse,
-                                             len * sizeof(Pulse), &tx_config));
+  ESP_ERROR_CHECK_WITHOUT_ABORT(transmit(pulse, len, ch));
+}
+
+void pulse_write_all(const Pulse *const *pulses, const size_t *lens) {
+#if CONFIG_TESLASYNTH_OUTPUT_SYNC
+  bool empty = true;
+  for (uint8_t ch = 0; ch < CONFIG_TESLASYNTH_OUTPUT_COUNT; ch++)
+    empty &= lens[ch] == 0;
+  if (empty)
+    return;
+
+  bool failed = false;
+  for (uint8_t ch = 0; ch < CONFIG_TESLASYNTH_OUTPUT_COUNT; ch++) {
+    esp_err_t err = lens[ch] == 0 ? transmit(&idle_pulse, 1, ch)
+                                  : transmit(pulses[ch], lens[ch], ch);
+    failed |= ESP_ERROR_CHECK_WITHOUT_ABORT(err) != ESP_OK;
+  }
+  // A partially submitted batch would stall the channels that made it in
+  if (failed)
+    ESP_ERROR_CHECK_WITHOUT_ABORT(rmt_sync_reset(synchro));
+#else
+  for (uint8_t ch = 0; ch < CONFIG_TESLASYNTH_OUTPUT_COUNT; ch++)
+    pulse_write(pulses[ch], lens[ch], ch);
+#endif
+}
+
+uint32_t submitted(uint8_t ch) { return progress[ch].submitted; }
+
+void wait_done(uint8_t ch, uint32_t count) {
+  Progress &p = progress[ch];
+  while (static_cast<int32_t>(count - p.completed) > 0) {
+    if (xSemaphoreTake(p.done, pdMS_TO_TICKS(1000)) != pdTRUE) {
+      // Never happens while the channel is enabled, don't wait forever
+      ESP_LOGW(TAG, "Transactions of channel %u are not done", ch + 1);
+      p.completed = count;
+      return;
+    }
+    p.completed++;
+  }
 }
 } // namespace teslasynth::app::devices::rmt
+
+namespace teslasynth::app::devices::output {
+namespace {
+class RmtOutput final : public midisynth::PulseOutput {
+  static constexpr size_t history = 8;
+
+  const midisynth::Pulse *pulses_[CONFIG_TESLASYNTH_OUTPUT_COUNT] = {};
+  size_t lens_[CONFIG_TESLASYNTH_OUTPUT_COUNT] = {};
+  // Transactions submitted on each channel as of the last few batches
+  uint32_t submitted_[history][CONFIG_TESLASYNTH_OUTPUT_COUNT] = {};
+  uint32_t batches_ = 0;
+
+public:
+  void write(uint8_t ch, const midisynth::Pulse *pulses, size_t len) override {
+    pulses_[ch] = pulses;
+    lens_[ch] = len;
+  }
+
+  void commit() override {
+    rmt::pulse_write_all(pulses_, lens_);
+    batches_++;
+    for (uint8_t ch = 0; ch < CONFIG_TESLASYNTH_OUTPUT_COUNT; ch++) {
+      lens_[ch] = 0;
+      submitted_[batches_ % history][ch] = rmt::submitted(ch);
+    }
+  }
+
+  void wait_pending(size_t batches) override {
+    assert(batches < history);
+    if (batches_ <= batches)
+      return;
+    const auto &done = submitted_[(batches_ - batches) % history];
+    for (uint8_t ch = 0; ch < CONFIG_TESLASYNTH_OUTPUT_COUNT; ch++)
+      rmt::wait_done(ch, done[ch]);
+  }
+};
+} // namespace
+
+midisynth::PulseOutput &init(void) {
+  static RmtOutput output;
+  rmt::init();
+  return output;
+}
+} // namespace teslasynth::app::devices::output
+
+#endif
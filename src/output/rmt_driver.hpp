@@ -1,11 +1,29 @@
 #pragma once
 
 #include "midi_synth.hpp"
+#include "sdkconfig.h"
 #include <cstddef>
 #include <cstdint>
 
 namespace teslasynth::app::devices::rmt {
+void init(void);
 void pulse_write(const midisynth::Pulse *pulse, size_t len, uint8_t ch = 0);
+
+/**
+ * Submits one buffer per output as a single batch.
+ * When outputs are synchronized, all channels start at the same time.
+ *
+ * @param pulses Array of CONFIG_TESLASYNTH_OUTPUT_COUNT buffers
+ * @param lens Array of CONFIG_TESLASYNTH_OUTPUT_COUNT buffer lengths
+ */
+void pulse_write_all(const midisynth::Pulse *const *pulses, const size_t *lens);
+
+/// Number of transactions submitted on a channel so far
+uint32_t submitted(uint8_t ch);
+
+/// Waits until the first `count` transactions of a channel are done
+void wait_done(uint8_t ch, uint32_t count);
+
 void enable(void);
 void disable(void);
 } // namespace teslasynth::app::devices::rmt
@@ -3,9 +3,15 @@
 #include "nvs.h"
 #include "nvs_flash.h"
 #include "teslasynth.hpp"
+#include <cstdio>
 #include <dirent.h>
 
 static const char *TAG = "STORAGE";
+static const char *INSTRUMENTS_PATH = "/storage/instruments.bin";
+
+// Kept open, so loading an instrument is a seek and a read
+static FILE *instruments_file = nullptr;
+static teslasynth::midisynth::InstrumentBank stored_bank;
 
 static void initialize_nvs() {
   esp_err_t err = nvs_flash_init();
@@ -53,9 +59,35 @@ static void init_filesystem() {
   }
 }
 
+static void open_instruments() {
+  instruments_file = fopen(INSTRUMENTS_PATH, "rb");
+  if (instruments_file == nullptr) {
+    ESP_LOGI(TAG, "No instrument bank, using the built-in instruments");
+    return;
+  }
+
+  bool opened =
+      stored_bank.open([](uint32_t offset, uint8_t *data, size_t len) {
+        return fseek(instruments_file, offset, SEEK_SET) == 0 &&
+               fread(data, 1, len, instruments_file) == len;
+      });
+  if (!opened) {
+    ESP_LOGE(TAG, "%s isn't a valid instrument bank", INSTRUMENTS_PATH);
+    fclose(instruments_file);
+    instruments_file = nullptr;
+    return;
+  }
+  ESP_LOGI(TAG, "Instrument bank with %u instruments", stored_bank.size());
+}
+
 namespace teslasynth::app::devices::storage {
 void init() {
   initialize_nvs();
   init_filesystem();
+  open_instruments();
+}
+
+midisynth::InstrumentBank *instrument_bank() {
+  return instruments_file != nullptr ? &stored_bank : nullptr;
 }
 } // namespace teslasynth::app::devices::storage
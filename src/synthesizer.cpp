@@ -5,8 +5,9 @@
 #include "midi_core.hpp"
 #include "midi_parser.hpp"
 #include "midi_synth.hpp"
-#include "output/rmt_driver.hpp"
+#include "pulse_output.hpp"
 #include "portmacro.h"
+#include <array>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
@@ -19,17 +20,23 @@ static const char *TAG = "SYNTH";
 
 static PlaybackHandle playback;
 static StreamBufferHandle_t stream;
+static PulseOutput *pulse_output;
 
 static void input(void *) {
   MidiChannelMessage msg;
-  MidiParser parser([&](const MidiChannelMessage msg) {
-    auto now = Duration64::micros(esp_timer_get_time());
+  MidiParser parser(
+      [&](const MidiChannelMessage msg) {
+        auto now = Duration64::micros(esp_timer_get_time());
 #if CONFIG_TESLASYNTH_DEBUG
-    ESP_LOGI(TAG, "Received: %s at %s", std::string(msg).c_str(),
-             std::string(now).c_str());
+        ESP_LOGI(TAG, "Received: %s at %s", std::string(msg).c_str(),
+                 std::string(now).c_str());
 #endif
-    playback.handle(msg, now);
-  });
+        playback.handle(msg, now);
+      },
+      [&](MidiStatus status) {
+        if (status == MidiStatus::timing_clock)
+          playback.clock(Duration64::micros(esp_timer_get_time()));
+      });
   uint8_t buffer[256];
   while (true) {
     size_t read =
@@ -48,22 +55,34 @@ static void output(void *pvParams) {
   TickType_t lastTime = xTaskGetTickCount();
 
   int64_t processed = esp_timer_get_time();
-  PulseBuffer<CONFIG_TESLASYNTH_OUTPUT_COUNT, 64> buffer;
+  // Outputs read the buffers while they play, so chunks rotate through a
+  // few buffers, and a buffer is only written again once it is played.
+  std::array<PulseBuffer<CONFIG_TESLASYNTH_OUTPUT_COUNT, 64>, 4> buffers;
+  size_t chunk = 0;
 
   while (true) {
     vTaskDelayUntil(&lastTime, loopTime);
 
-    playback.acquire();
     auto now = esp_timer_get_time();
     auto left = now - processed;
-    auto budget = Duration16::micros(static_cast<uint16_t>(
-        std::min<int64_t>(left, std::numeric_limits<uint16_t>::max())));
-    playback.sample_all(budget, buffer);
+    RenderWindow<CONFIG_TESLASYNTH_OUTPUT_COUNT> window(
+        Duration32::micros(static_cast<uint32_t>(
+            std::min<int64_t>(left, std::numeric_limits<uint16_t>::max()))));
+
+    // Configuration changes are only picked up between windows
+    playback.acquire();
+    playback.adopt_config();
     playback.release();
 
-    for (uint8_t ch = 0; ch < CONFIG_TESLASYNTH_OUTPUT_COUNT; ch++) {
-      devices::rmt::pulse_write(&buffer.data(ch), buffer.data_size(ch), ch);
-    }
+    bool done;
+    do {
+      auto &buffer = buffers[chunk++ % buffers.size()];
+      pulse_output->wait_pending(buffers.size() - 1);
+      playback.acquire();
+      done = playback.sample_chunk(window, buffer);
+      playback.release();
+      pulse_output->write_all(buffer);
+    } while (!done);
 
     uint32_t took = esp_timer_get_time() - processed;
     processed = now;
@@ -83,15 +102,25 @@ static void output(void *pvParams) {
       ESP_LOGI(TAG,
                "Render stats, min: %u, max: %u, total: %u, avg: %u, ctr: %u",
                min_i, max_i, total, total / counter, counter);
+      for (uint8_t ch = 0; ch < CONFIG_TESLASYNTH_OUTPUT_COUNT; ch++) {
+        const auto &duty = playback.duty_stats(ch);
+        ESP_LOGI(TAG,
+                 "Duty stats[%u], pulses: %u, attenuated: %u, dropped: %u, "
+                 "attenuation: %.1f%%",
+                 ch + 1, duty.pulses, duty.attenuated, duty.dropped,
+                 duty.attenuation() * 100);
+      }
     }
 #endif
   }
 }
 
-void init(StreamBufferHandle_t sbuf, PlaybackHandle handle) {
+void init(StreamBufferHandle_t sbuf, PlaybackHandle handle,
+          PulseOutput &out) {
   ESP_LOGD(TAG, "init");
   playback = handle;
   stream = sbuf;
+  pulse_output = &out;
   xTaskCreatePinnedToCore(input, "Input", 8 * 1024, nullptr, 10, nullptr, 1);
   xTaskCreatePinnedToCore(output, "Output", 8 * 1024, nullptr, 10, nullptr, 1);
 }
@@ -2,6 +2,7 @@
 
 #include "application.hpp"
 #include "freertos/idf_additions.h"
+#include "pulse_output.hpp"
 
 namespace teslasynth::app {
 
@@ -9,11 +10,19 @@ namespace devices {
 
 namespace storage {
 void init();
-}
 
-namespace rmt {
-void init(void);
-}
+/**
+ * The instrument bank found in storage, nullptr if there is none
+ */
+midisynth::InstrumentBank *instrument_bank();
+} // namespace storage
+
+namespace output {
+/**
+ * Initializes the output backend selected in Kconfig
+ */
+midisynth::PulseOutput &init(void);
+} // namespace output
 
 namespace ble_midi {
 StreamBufferHandle_t init();
@@ -22,11 +31,12 @@ StreamBufferHandle_t init();
 } // namespace devices
 
 namespace synth {
-void init(StreamBufferHandle_t sbuf, PlaybackHandle handle);
+void init(StreamBufferHandle_t sbuf, PlaybackHandle handle,
+          midisynth::PulseOutput &output);
 }
 
 namespace gui {
-void init();
+void init(UIHandle handle);
 }
 
 namespace cli {
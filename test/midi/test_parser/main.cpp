@@ -349,6 +349,23 @@ void parser_does_not_clear_status_on_realtime_system_messages(void) {
   TEST_ASSERT_EQUAL(0, msgs.size());
 }
 
+void parser_passes_realtime_messages_between_data(void) {
+  Messages msgs;
+  std::vector<uint8_t> realtime;
+  MidiParser parser([&](const MidiChannelMessage &m) { msgs.push_back(m); },
+                    [&](MidiStatus status) { realtime.push_back(status); });
+
+  uint8_t input[]{0x90, 60, MidiStatus::timing_clock, 100, 62, 0xFE, 90};
+  parser.feed(input, sizeof(input));
+
+  TEST_ASSERT_EQUAL(2, realtime.size());
+  TEST_ASSERT_EQUAL(MidiStatus::timing_clock, realtime[0]);
+  TEST_ASSERT_EQUAL(0xFE, realtime[1]);
+  TEST_ASSERT_EQUAL(2, msgs.size());
+  assert_midi_message_equal(msgs[0], MidiChannelMessage::note_on(0, 60, 100));
+  assert_midi_message_equal(msgs[1], MidiChannelMessage::note_on(0, 62, 90));
+}
+
 extern "C" void app_main(void) {
   UNITY_BEGIN();
   RUN_TEST(parser_empty);
@@ -370,6 +387,7 @@ extern "C" void app_main(void) {
 
   RUN_TEST(parser_clears_status_on_non_realtime_system_messages);
   RUN_TEST(parser_does_not_clear_status_on_realtime_system_messages);
+  RUN_TEST(parser_passes_realtime_messages_between_data);
   UNITY_END();
 }
 
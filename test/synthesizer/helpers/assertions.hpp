@@ -22,20 +22,26 @@ inline void assert_level_not_equal(EnvelopeLevel a, EnvelopeLevel b, int line) {
   UNITY_TEST_ASSERT(a != b, line, __msg_for(a, b).c_str());
 }
 
-template <typename A, typename B>
-inline void assert_duration_equal(SimpleDuration<A> a, SimpleDuration<B> b,
-                                  int line) {
+template <typename A, uint32_t RA, typename B, uint32_t RB>
+inline void assert_duration_equal(SimpleDuration<A, RA> a,
+                                  SimpleDuration<B, RB> b, int line) {
   UNITY_TEST_ASSERT(a == b, line, __msg_for(a, b).c_str());
 }
-template <typename A, typename B>
-inline void assert_duration_equal(std::optional<SimpleDuration<A>> a,
-                                  SimpleDuration<B> b, int line) {
+template <typename A, uint32_t RA, typename B, uint32_t RB>
+inline void assert_duration_equal(std::optional<SimpleDuration<A, RA>> a,
+                                  SimpleDuration<B, RB> b, int line) {
   UNITY_TEST_ASSERT(a, line, "No duration!");
   UNITY_TEST_ASSERT(a == b, line, __msg_for(*a, b).c_str());
 }
-template <typename A, typename B>
-inline void assert_duration_not_equal(SimpleDuration<A> a, SimpleDuration<B> b,
-                                      int line) {
+template <typename A, uint32_t RA, typename B, uint32_t RB>
+inline void assert_duration_not_equal(SimpleDuration<A, RA> a,
+                                      SimpleDuration<B, RB> b, int line) {
+  UNITY_TEST_ASSERT(a != b, line, __msg_for(a, b).c_str());
+}
+inline void assert_duration_equal(Instant a, Instant b, int line) {
+  UNITY_TEST_ASSERT(a == b, line, __msg_for(a, b).c_str());
+}
+inline void assert_duration_not_equal(Instant a, Instant b, int line) {
   UNITY_TEST_ASSERT(a != b, line, __msg_for(a, b).c_str());
 }
 inline void assert_hertz_equal(Hertz a, Hertz b, int line) {
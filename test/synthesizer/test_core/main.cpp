@@ -1,4 +1,5 @@
 #include "synthesizer/helpers/assertions.hpp"
+#include <algorithm>
 #include <cmath>
 #include <core.hpp>
 #include <cstdint>
@@ -63,10 +64,10 @@ void test_duration32_constants() {
 
   TEST_ASSERT_TRUE_MESSAGE(max > Duration32::seconds(3600),
                            "Must be more than one hour");
-  TEST_ASSERT_TRUE_MESSAGE(max > Duration32::seconds(71 * 60) &&
-                               Duration32::seconds(71 * 60) >
-                                   Duration32::seconds(72 * 60),
+  TEST_ASSERT_TRUE_MESSAGE(max > Duration32::seconds(71 * 60),
                            "Must be more than 71 minutes");
+  // Longer than that saturates instead of wrapping
+  assert_duration_equal(Duration32::seconds(72 * 60), max);
   TEST_ASSERT_EQUAL(sizeof(uint32_t), sizeof(Duration32));
 
   TEST_ASSERT_TRUE_MESSAGE(Duration::max() > Duration32::max(),
@@ -106,6 +107,57 @@ void test_duration_minus(void) {
   TEST_ASSERT_TRUE(100_s - 1_us);
 }
 
+void test_duration_tick_rates(void) {
+  using Fine = SimpleDuration<uint32_t, 40'000'000>;
+  using Coarse = SimpleDuration<uint32_t, 10'000'000>;
+
+  TEST_ASSERT_EQUAL(40, Fine::micros(1).ticks());
+  TEST_ASSERT_EQUAL(10, Coarse::micros(1).ticks());
+  TEST_ASSERT_EQUAL(4, Fine(Coarse::ticks(1)).ticks());
+  TEST_ASSERT_EQUAL(1, Coarse(Fine::ticks(7)).ticks());
+  TEST_ASSERT_EQUAL(2, Fine::ticks(80).micros());
+
+  assert_duration_equal(Fine::micros(10), 10_us);
+  assert_duration_equal(Coarse::millis(1), Fine::micros(1000));
+  assert_duration_not_equal(Fine::ticks(1), Coarse::ticks(0));
+  TEST_ASSERT_TRUE(Fine::ticks(3) < Coarse::ticks(1));
+  TEST_ASSERT_TRUE(Fine::ticks(5) > Coarse::ticks(1));
+
+  auto sum = Fine::ticks(1) + Coarse::ticks(1);
+  TEST_ASSERT_EQUAL(40'000'000, decltype(sum)::rate);
+  TEST_ASSERT_EQUAL(5, sum.ticks());
+}
+
+void test_duration_conversions_saturate(void) {
+  using Fine16 = SimpleDuration<uint16_t, 40'000'000>;
+  using Coarse16 = SimpleDuration<uint16_t, 10'000'000>;
+
+  TEST_ASSERT_EQUAL(40 * 1600, Fine16(Micros16::micros(1600)).ticks());
+  TEST_ASSERT_EQUAL(UINT16_MAX, Fine16(Micros16::micros(1700)).ticks());
+  TEST_ASSERT_EQUAL(UINT16_MAX, Coarse16(Micros16::millis(10)).ticks());
+  TEST_ASSERT_EQUAL(UINT16_MAX, Fine16(Coarse16::max()).ticks());
+  TEST_ASSERT_EQUAL(1000, Micros16(Fine16::ticks(40000)).ticks());
+}
+
+template <uint32_t HZ> void assert_factories_saturate(void) {
+  using D16 = SimpleDuration<uint16_t, HZ>;
+  const uint32_t per_us = HZ / micros_rate;
+
+  TEST_ASSERT_EQUAL(std::min<uint32_t>(20000 * per_us, UINT16_MAX),
+                    D16::micros(20000).ticks());
+  TEST_ASSERT_EQUAL(std::min<uint32_t>(per_us * 1000 * 70, UINT16_MAX),
+                    D16::millis(70).ticks());
+  TEST_ASSERT_EQUAL(UINT16_MAX, D16::seconds(1).ticks());
+  TEST_ASSERT_EQUAL(UINT16_MAX, D16::micros(UINT16_MAX).ticks());
+  TEST_ASSERT_EQUAL(per_us, D16::micros(1).ticks());
+}
+
+void test_duration_factories_saturate(void) {
+  assert_factories_saturate<1'000'000>();
+  assert_factories_saturate<10'000'000>();
+  assert_factories_saturate<40'000'000>();
+}
+
 void test_hertz(void) {
   TEST_ASSERT_TRUE(0.5_hz < 1_hz);
   TEST_ASSERT_TRUE(2_mhz > 100_khz);
@@ -134,6 +186,30 @@ void test_hertz_arithmetic(void) {
   assert_hertz_equal(2_khz * 4, 8_khz);
 }
 
+void test_instant_wraparound(void) {
+  // 32 bits of microseconds wrap at about 71.6 minutes
+  const Duration wrap = Duration::ticks(1ull << 32);
+  const Instant last = Instant::ticks(UINT32_MAX), first = last + 1_us;
+
+  TEST_ASSERT_EQUAL(0, first.ticks());
+  TEST_ASSERT_TRUE(last < first);
+  TEST_ASSERT_TRUE(first > last);
+  TEST_ASSERT_TRUE(last + 10_ms > last);
+  TEST_ASSERT_TRUE(last <= first && first >= last);
+  TEST_ASSERT_TRUE(Instant(wrap) == Instant());
+
+  assert_duration_equal(*(first - last), 1_us);
+  assert_duration_equal(*((last + 10_ms) - last), 10_ms);
+  TEST_ASSERT_FALSE(last - first);
+
+  const Duration ref = *(wrap - 1_s);
+  assert_duration_equal(Instant(ref).extend(ref), ref);
+  assert_duration_equal((Instant(ref) + 2_s).extend(ref), wrap + 1_s);
+  assert_duration_equal(Instant(wrap + 1_s).extend(ref), wrap + 1_s);
+  assert_duration_equal(Instant(1_s).extend(2_s), 1_s);
+  assert_duration_equal(Instant(ref).extend(1_s), Duration::zero());
+}
+
 extern "C" void app_main(void) {
   UNITY_BEGIN();
   RUN_TEST(test_seconds);
@@ -144,8 +220,12 @@ extern "C" void app_main(void) {
   RUN_TEST(test_duration32_constants);
   RUN_TEST(test_duration_arithmetics);
   RUN_TEST(test_duration_minus);
+  RUN_TEST(test_duration_tick_rates);
+  RUN_TEST(test_duration_conversions_saturate);
+  RUN_TEST(test_duration_factories_saturate);
   RUN_TEST(test_hertz);
   RUN_TEST(test_hertz_arithmetic);
+  RUN_TEST(test_instant_wraparound);
   UNITY_END();
 }
 int main(int argc, char **argv) { app_main(); }
@@ -268,6 +268,47 @@ void test_envelope_const_value(void) {
   TEST_ASSERT_EQUAL(Envelope::Stage::Off, env.stage());
 }
 
+void test_curve_exp_follows_exponential(void) {
+  Curve curve =
+      Curve(EnvelopeLevel(0.1), EnvelopeLevel(0.9), 100_ms, CurveType::Exp);
+  const float tau = 100000 / 6.907755f;
+  for (uint32_t t = 250; t < 100000; t += 250) {
+    const float expected = 0.9f - 0.8f * expf(-(float)t / tau);
+    assert_level_equal(curve.update(250_us), EnvelopeLevel(expected));
+  }
+}
+
+void test_compiled_envelope_matches_adsr(void) {
+  for (auto adsr : {lin_adsr, exp_adsr, const_adsr}) {
+    const CompiledEnvelope compiled(adsr);
+    Envelope a(adsr), b(compiled);
+    for (int i = 0; i < 100; i++) {
+      const bool on = i < 60;
+      assert_level_equal(a.update(700_us, on), b.update(700_us, on));
+      TEST_ASSERT_EQUAL(a.stage(), b.stage());
+    }
+  }
+}
+
+void test_scaled_envelope_stretches_attack_and_release(void) {
+  const CompiledEnvelope compiled(lin_adsr);
+  Envelope env(compiled, 2, 0.5f);
+  assert_level_equal(env.update(10_ms, true), EnvelopeLevel(0.5));
+  TEST_ASSERT_EQUAL(Envelope::Stage::Attack, env.stage());
+  assert_level_equal(env.update(10_ms, true), EnvelopeLevel(1));
+  assert_level_equal(env.update(20_ms, true), EnvelopeLevel(0.5));
+  TEST_ASSERT_EQUAL(Envelope::Stage::Sustain, env.stage());
+  assert_level_equal(env.update(3_ms, false), EnvelopeLevel(0.4));
+  assert_level_equal(env.update(12_ms, false), EnvelopeLevel(0));
+  TEST_ASSERT_EQUAL(Envelope::Stage::Off, env.stage());
+
+  // Copies keep playing the same stages
+  Envelope copy = Envelope(compiled, 2, 0.5f);
+  Envelope owned(lin_adsr);
+  copy = owned;
+  assert_level_equal(copy.update(5_ms, true), EnvelopeLevel(0.5));
+}
+
 void test_envelope_comparison(void) {
   TEST_ASSERT_TRUE(lin_adsr == lin_adsr);
   TEST_ASSERT_FALSE(lin_adsr != lin_adsr);
@@ -298,6 +339,7 @@ extern "C" void app_main(void) {
   RUN_TEST(test_curve_lin_negative_small);
   RUN_TEST(test_curve_exp_positive);
   RUN_TEST(test_curve_exp_negative);
+  RUN_TEST(test_curve_exp_follows_exponential);
   RUN_TEST(test_curve_constant);
   RUN_TEST(test_curve_constant_zero);
 
@@ -306,6 +348,8 @@ extern "C" void app_main(void) {
   RUN_TEST(test_envelope_const_full);
   RUN_TEST(test_envelope_const_zero);
   RUN_TEST(test_envelope_const_value);
+  RUN_TEST(test_compiled_envelope_matches_adsr);
+  RUN_TEST(test_scaled_envelope_stretches_attack_and_release);
   RUN_TEST(test_envelope_comparison);
   UNITY_END();
 }
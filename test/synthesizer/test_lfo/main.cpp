@@ -8,33 +8,66 @@ using namespace teslasynth::synth;
 void test_flat(void) {
   Vibrato lfo;
 
-  assert_hertz_equal(lfo.offset(0_us), 0_hz);
-  assert_hertz_equal(lfo.offset(1_ms), 0_hz);
-  assert_hertz_equal(lfo.offset(3_ms), 0_hz);
-  assert_hertz_equal(lfo.offset(1_s), 0_hz);
+  assert_hertz_equal(lfo.offset(), 0_hz);
+  lfo.advance(1_ms);
+  assert_hertz_equal(lfo.offset(), 0_hz);
+  lfo.advance(2_ms);
+  assert_hertz_equal(lfo.offset(), 0_hz);
+  lfo.advance(1_s);
+  assert_hertz_equal(lfo.offset(), 0_hz);
 }
 
 void test_oscillation1(void) {
   Vibrato lfo{1_hz, 2_hz};
 
   for (int i = 0; i < 100; i++) {
-    auto start = Duration::seconds(i);
-    assert_hertz_equal(lfo.offset(start + 0_us), 0_hz);
-    assert_hertz_equal(lfo.offset(start + 250_ms), 2_hz);
-    assert_hertz_equal(lfo.offset(start + 500_ms), 0_hz);
-    assert_hertz_equal(lfo.offset(start + 750_ms), -2_hz);
-    assert_hertz_equal(lfo.offset(start + 1_s), 0_hz);
+    assert_hertz_equal(lfo.offset(), 0_hz);
+    lfo.advance(250_ms);
+    assert_hertz_equal(lfo.offset(), 2_hz);
+    lfo.advance(250_ms);
+    assert_hertz_equal(lfo.offset(), 0_hz);
+    lfo.advance(250_ms);
+    assert_hertz_equal(lfo.offset(), -2_hz);
+    lfo.advance(250_ms);
   }
 }
 
 void test_oscillation2(void) {
   Vibrato lfo{2_hz, 10_hz};
 
-  assert_hertz_equal(lfo.offset(0_us), 0_hz);
-  assert_hertz_equal(lfo.offset(125_ms), 10_hz);
-  assert_hertz_equal(lfo.offset(250_ms), 0_hz);
-  assert_hertz_equal(lfo.offset(375_ms), -10_hz);
-  assert_hertz_equal(lfo.offset(500_ms), 0_hz);
+  assert_hertz_equal(lfo.offset(), 0_hz);
+  lfo.advance(125_ms);
+  assert_hertz_equal(lfo.offset(), 10_hz);
+  lfo.advance(125_ms);
+  assert_hertz_equal(lfo.offset(), 0_hz);
+  lfo.advance(125_ms);
+  assert_hertz_equal(lfo.offset(), -10_hz);
+  lfo.advance(125_ms);
+  assert_hertz_equal(lfo.offset(), 0_hz);
+}
+
+void test_retune_is_continuous(void) {
+  Vibrato lfo{1_hz, 2_hz};
+  lfo.advance(100_ms);
+  const Hertz before = lfo.offset();
+  lfo.freq = 2_hz;
+  assert_hertz_equal(lfo.offset(), before);
+
+  // Then runs at the new frequency, a period is now half a second
+  lfo.advance(125_ms);
+  TEST_ASSERT_TRUE(lfo.offset() > before);
+  lfo.advance(375_ms);
+  assert_hertz_equal(lfo.offset(), before);
+}
+
+void test_phase_carries_over_long_runs(void) {
+  // Longer than the 32-bit timeline wraps at any tick rate
+  Vibrato lfo{1_hz, 2_hz};
+  for (int i = 0; i < 5000; i++)
+    lfo.advance(1_s);
+  assert_hertz_equal(lfo.offset(), 0_hz);
+  lfo.advance(250_ms);
+  assert_hertz_equal(lfo.offset(), 2_hz);
 }
 
 void test_comparision(void) {
@@ -52,12 +85,52 @@ void test_comparision(void) {
   TEST_ASSERT_TRUE(lfo2 != lfo3);
 }
 
+float gain(uint32_t g) { return g / float(Lfo::unity_gain); }
+
+void test_tremolo_off(void) {
+  Lfo lfo;
+  lfo.start(Tremolo::none(), 2_hz);
+  TEST_ASSERT_TRUE(lfo.is_off());
+  TEST_ASSERT_EQUAL(Lfo::unity_gain, lfo.next(100_ms));
+  TEST_ASSERT_EQUAL(Lfo::unity_gain, lfo.next(100_ms));
+}
+
+void test_tremolo_swings_by_depth(void) {
+  Lfo lfo;
+  lfo.start({.freq = 2_hz, .depth = EnvelopeLevel(0.5)}, 2_hz);
+  TEST_ASSERT_FALSE(lfo.is_off());
+  // Starts at full volume, at the bottom of the wave a quarter second in
+  TEST_ASSERT_EQUAL(Lfo::unity_gain, lfo.next(125_ms));
+  TEST_ASSERT_FLOAT_WITHIN(0.02, 0.75, gain(lfo.next(125_ms)));
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 0.5, gain(lfo.next(125_ms)));
+  TEST_ASSERT_FLOAT_WITHIN(0.02, 0.75, gain(lfo.next(125_ms)));
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 1, gain(lfo.next(125_ms)));
+}
+
+void test_tremolo_synced_to_tempo(void) {
+  // A cycle every two beats, at 120 BPM a second
+  Lfo lfo;
+  lfo.start({.depth = EnvelopeLevel(1), .beats = 2}, 2_hz);
+  lfo.next(500_ms);
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 0, gain(lfo.next(500_ms)));
+
+  // Twice as fast, half a cycle on from the bottom is the top
+  lfo.retune({.depth = EnvelopeLevel(1), .beats = 2}, 4_hz);
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 1, gain(lfo.next(250_ms)));
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 0, gain(lfo.next(250_ms)));
+}
+
 extern "C" void app_main(void) {
   UNITY_BEGIN();
   RUN_TEST(test_flat);
   RUN_TEST(test_oscillation1);
   RUN_TEST(test_oscillation2);
+  RUN_TEST(test_retune_is_continuous);
+  RUN_TEST(test_phase_carries_over_long_runs);
   RUN_TEST(test_comparision);
+  RUN_TEST(test_tremolo_off);
+  RUN_TEST(test_tremolo_swings_by_depth);
+  RUN_TEST(test_tremolo_synced_to_tempo);
   UNITY_END();
 }
 
@@ -29,13 +29,13 @@ void test_empty(void) {
   TEST_ASSERT_FALSE(note.is_released());
   TEST_ASSERT_TRUE(note.frequency().is_zero());
 
-  TEST_ASSERT_TRUE(note.current().start.is_zero());
+  TEST_ASSERT_TRUE(note.current().start == Instant());
   TEST_ASSERT_TRUE(note.current().volume.is_zero());
   TEST_ASSERT_TRUE(note.current().period.is_zero());
 
   TEST_ASSERT_FALSE(note.next());
 
-  TEST_ASSERT_TRUE(note.current().start.is_zero());
+  TEST_ASSERT_TRUE(note.current().start == Instant());
   TEST_ASSERT_TRUE(note.current().volume.is_zero());
   TEST_ASSERT_TRUE(note.current().period.is_zero());
 }
@@ -311,20 +311,130 @@ void test_note_vibrato(void) {
   note.start(mnote1, 0_us, Envelope(EnvelopeLevel(1)), vib, tuning);
   assert_duration_equal(note.now(), 10_ms);
   for (int i = 0; i < 5000; i++) {
-    auto start = note.current().start;
-    auto freq = 100_hz + vib.offset(start);
+    auto freq = 100_hz + vib.offset();
     assert_level_equal(note.current().volume, EnvelopeLevel::max());
     assert_duration_equal(note.current().period, freq.period());
+    vib.advance(freq.period());
 
     note.next();
   }
 }
 
+void test_note_tremolo(void) {
+  const Instrument instrument{
+      .envelope = ADSR::constant(EnvelopeLevel(0.8)),
+      .vibrato = Vibrato::none(),
+      .tremolo = {.freq = 1_hz, .depth = EnvelopeLevel(0.5)},
+  };
+  note.start(mnote1, 0_us, instrument, tuning);
+  // A pulse every 10ms, the bottom of the wave is 50 pulses in
+  assert_level_equal(note.current().volume, EnvelopeLevel(0.8));
+  for (int i = 0; i < 50; i++) {
+    const EnvelopeLevel before = note.current().volume;
+    note.next();
+    TEST_ASSERT_TRUE(note.current().volume < before);
+  }
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 0.4, note.current().volume);
+  for (int i = 0; i < 50; i++)
+    note.next();
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 0.8, note.current().volume);
+}
+
 void test_off(void) {
   note.off();
   TEST_ASSERT_FALSE(note.is_active());
 }
 
+void test_note_across_wraparound(void) {
+  // Starts 25ms before the 32 bit timeline wraps, at about 71.6 minutes
+  const Instant start = Instant::ticks(UINT32_MAX) + 1_us - 25_ms;
+  note.start(mnote1, start, envelope, tuning);
+
+  Instant previous = note.current().start;
+  for (int i = 1; i < 6; i++) {
+    TEST_ASSERT_TRUE(note.next());
+    assert_duration_equal(note.current().start, start + 10_ms * i);
+    TEST_ASSERT_TRUE(note.current().start > previous);
+    assert_duration_equal(*(note.current().start - previous), 10_ms);
+    previous = note.current().start;
+  }
+  TEST_ASSERT_TRUE(note.current().start.ticks() < start.ticks());
+
+  note.release(start + 45_ms);
+  TEST_ASSERT_TRUE(note.next());
+  TEST_ASSERT_TRUE(note.is_released());
+  assert_duration_equal(note.current().start, start + 60_ms);
+}
+
+void test_bend_applies_from_the_next_pulse(void) {
+  // An octave up halves the period
+  note.bend(Note::bend_unity / 2);
+  assert_duration_equal(note.current().period, 10000_us);
+  note.next();
+  assert_duration_equal(note.current().period, 5000_us);
+  assert_duration_equal(note.current().start, 10100_us);
+  note.next();
+  assert_duration_equal(note.current().start, 15100_us);
+
+  note.bend(Note::bend_unity);
+  note.next();
+  note.next();
+  assert_duration_equal(note.current().period, 10000_us);
+}
+
+void test_note_bend_adds_to_channel_bend(void) {
+  note.bend(Note::bend_unity / 2);
+  note.note_bend(Note::bend_unity / 2);
+  note.next();
+  assert_duration_equal(note.current().period, 2500_us);
+
+  note.bend(Note::bend_unity);
+  note.next();
+  assert_duration_equal(note.current().period, 5000_us);
+  note.note_bend(Note::bend_unity);
+  note.next();
+  assert_duration_equal(note.current().period, 10000_us);
+}
+
+void test_glide_ramps_the_period(void) {
+  // An octave up in 40ms, the period goes from 10ms down to 5ms
+  note.glide(tuning, 40_ms);
+  note.legato(mnote2, tuning);
+  assert_hertz_equal(note.frequency(), mnote2.frequency(tuning));
+  assert_hertz_equal(note.pitch(), tuning);
+  assert_duration_equal(note.current().period, 10000_us);
+  note.next();
+  assert_duration_equal(note.current().period, 10000_us);
+  assert_hertz_equal(note.pitch(), Hertz(200 / 1.75f));
+  note.next();
+  assert_duration_equal(note.current().period, 8750_us);
+
+  Duration32 elapsed = 18750_us;
+  Duration32 last = note.current().period;
+  while (elapsed < 40_ms) {
+    note.next();
+    TEST_ASSERT_TRUE(note.current().period < last);
+    last = note.current().period;
+    elapsed += last;
+  }
+  note.next();
+  assert_duration_equal(note.current().period, 5000_us);
+  assert_hertz_equal(note.pitch(), note.frequency());
+}
+
+void test_legato_keeps_the_envelope(void) {
+  Note note;
+  note.start(mnote1, 0_us, Envelope(ADSR{100_ms, 0_us, EnvelopeLevel(1), 0_us,
+                                          CurveType::Lin}),
+             tuning);
+  note.next();
+  const EnvelopeLevel level = note.current().volume;
+  note.legato(mnote2, tuning);
+  note.next();
+  TEST_ASSERT_TRUE(level < note.current().volume);
+  assert_duration_equal(note.current().period, 5000_us);
+}
+
 extern "C" void app_main(void) {
   UNITY_BEGIN();
   RUN_TEST(test_empty);
@@ -341,7 +451,13 @@ extern "C" void app_main(void) {
   RUN_TEST(test_note_envelope2);
   RUN_TEST(test_note_envelope_constant);
   RUN_TEST(test_note_vibrato);
+  RUN_TEST(test_note_tremolo);
   RUN_TEST(test_off);
+  RUN_TEST(test_note_across_wraparound);
+  RUN_TEST(test_bend_applies_from_the_next_pulse);
+  RUN_TEST(test_note_bend_adds_to_channel_bend);
+  RUN_TEST(test_glide_ramps_the_period);
+  RUN_TEST(test_legato_keeps_the_envelope);
   UNITY_END();
 }
 
@@ -201,17 +201,290 @@ void test_adjust_size(void) {
   TEST_ASSERT_EQUAL(2, voice.active());
   TEST_ASSERT_EQUAL(3, voice.size());
   voice.adjust_size(2);
-  TEST_ASSERT_EQUAL(0, voice.active());
+  TEST_ASSERT_EQUAL(2, voice.active());
   TEST_ASSERT_EQUAL(2, voice.size());
-  Note &note = voice.next();
-  TEST_ASSERT_FALSE(note.is_active());
+  TEST_ASSERT_TRUE(voice.next().is_active());
 
+  voice.off();
   assert_note(voice, mnotef(0), 200_ms);
   TEST_ASSERT_EQUAL(1, voice.active());
   voice.adjust_size(2);
   TEST_ASSERT_EQUAL(1, voice.active());
 }
 
+void test_adjust_size_keeps_as_many_notes_as_fit(void) {
+  Voice<4> voice;
+  for (uint8_t i = 0; i < 4; i++)
+    voice.start(mnotef(i), 100_ms * (i + 1), instrument, tuning);
+  voice.start(mnotef(1), 200_ms, instrument, tuning).off();
+  TEST_ASSERT_EQUAL(3, voice.active());
+
+  voice.adjust_size(2);
+  TEST_ASSERT_EQUAL(2, voice.active());
+  voice.adjust_size(4);
+  TEST_ASSERT_EQUAL(2, voice.active());
+
+  // Moved notes are still found by their number
+  voice.release(mnotef(2), 1_s);
+  voice.release(mnotef(0), 1_s);
+  for (auto i = 0; i < 10000 && voice.active() > 0; i++)
+    voice.next().next();
+  TEST_ASSERT_EQUAL(0, voice.active());
+}
+
+void test_next_across_wraparound(void) {
+  Voice<> voice;
+  const Instant wrap = Instant::ticks(UINT32_MAX) + 1_us;
+
+  Note &early = voice.start(mnotef(0), wrap - 1_ms, instrument, tuning);
+  Note &late = voice.start(mnotef(1), wrap + 1_ms, instrument, tuning);
+
+  TEST_ASSERT_EQUAL(&early, &voice.next());
+  early.next();
+  TEST_ASSERT_EQUAL(&late, &voice.next());
+}
+
+void test_sustain_defers_release(void) {
+  Voice<> voice(3);
+  Note &a = voice.start(mnotef(0), 0_us, instrument, tuning);
+  Note &b = voice.start(mnotef(1), 0_us, instrument, tuning);
+  voice.sustain(true, 10_us);
+  voice.release(mnotef(0), 20_us);
+  voice.start({static_cast<uint8_t>(69 + 1), 0}, 30_us, instrument, tuning);
+  TEST_ASSERT_FALSE(a.is_released());
+  TEST_ASSERT_FALSE(b.is_released());
+
+  voice.sustain(false, 40_us);
+  TEST_ASSERT_TRUE(a.is_released());
+  TEST_ASSERT_TRUE(b.is_released());
+  TEST_ASSERT_EQUAL(2, voice.active());
+}
+
+void test_sustain_holds_only_its_channels(void) {
+  Voice<> voice(3);
+  Note &a = voice.start({60, 63}, 0_us, instrument, tuning, {}, 0);
+  Note &b = voice.start({62, 63}, 0_us, instrument, tuning, {}, 1);
+  voice.sustain(true, 10_us, 1 << 0);
+  voice.release(60, 20_us, 0);
+  voice.release(62, 20_us, 1);
+  TEST_ASSERT_FALSE(a.is_released());
+  TEST_ASSERT_TRUE(b.is_released());
+
+  voice.sustain(false, 30_us, 1 << 1);
+  TEST_ASSERT_FALSE(a.is_released());
+  voice.sustain(false, 40_us, 1 << 0);
+  TEST_ASSERT_TRUE(a.is_released());
+}
+
+void test_sustained_note_restarted_is_kept(void) {
+  Voice<> voice(2);
+  Note &a = voice.start(mnotef(0), 0_us, instrument, tuning);
+  voice.sustain(true, 0_us);
+  voice.release(mnotef(0), 10_us);
+  voice.start(mnotef(0), 20_us, instrument, tuning);
+  voice.sustain(false, 30_us);
+  TEST_ASSERT_FALSE(a.is_released());
+
+  voice.release(mnotef(0), 40_us);
+  TEST_ASSERT_TRUE(a.is_released());
+}
+
+void test_sostenuto_holds_notes_down_when_pressed(void) {
+  Voice<> voice(3);
+  Note &a = voice.start(mnotef(0), 0_us, instrument, tuning);
+  voice.sostenuto(true, 10_us);
+  Note &b = voice.start(mnotef(1), 20_us, instrument, tuning);
+
+  voice.release(mnotef(0), 30_us);
+  voice.release(mnotef(1), 30_us);
+  TEST_ASSERT_FALSE(a.is_released());
+  TEST_ASSERT_TRUE(b.is_released());
+
+  voice.sostenuto(false, 40_us);
+  TEST_ASSERT_TRUE(a.is_released());
+}
+
+void test_repeated_sostenuto_keeps_deferred_notes(void) {
+  Voice<> voice(3);
+  Note &a = voice.start(mnotef(0), 0_us, instrument, tuning);
+  voice.sostenuto(true, 10_us);
+  voice.release(mnotef(0), 20_us);
+  Note &b = voice.start(mnotef(1), 30_us, instrument, tuning);
+
+  // Controllers send CC66 >= 64 again while the pedal stays down
+  voice.sostenuto(true, 40_us);
+  voice.release(mnotef(1), 50_us);
+  TEST_ASSERT_FALSE(a.is_released());
+  TEST_ASSERT_TRUE(b.is_released());
+
+  voice.sostenuto(false, 60_us);
+  TEST_ASSERT_TRUE(a.is_released());
+}
+
+void test_pedals_hold_until_both_are_up(void) {
+  Voice<> voice(2);
+  Note &a = voice.start(mnotef(0), 0_us, instrument, tuning);
+  voice.sostenuto(true, 0_us);
+  voice.sustain(true, 0_us);
+  voice.release(mnotef(0), 10_us);
+
+  voice.sustain(false, 20_us);
+  TEST_ASSERT_FALSE(a.is_released());
+  voice.sustain(true, 30_us);
+  voice.sostenuto(false, 40_us);
+  TEST_ASSERT_FALSE(a.is_released());
+  voice.sustain(false, 50_us);
+  TEST_ASSERT_TRUE(a.is_released());
+}
+
+void test_off_forgets_held_notes(void) {
+  Voice<> voice(2);
+  voice.start(mnotef(0), 0_us, instrument, tuning);
+  voice.sostenuto(true, 0_us);
+  voice.release(mnotef(0), 10_us);
+  voice.off();
+
+  Note &b = voice.start(mnotef(1), 20_us, instrument, tuning);
+  voice.release(mnotef(1), 30_us);
+  TEST_ASSERT_TRUE(b.is_released());
+}
+
+void test_pressure_raises_note_volume(void) {
+  Voice<> voice(4);
+  Note &a = voice.start({69, 63}, 0_us, instrument, tuning);
+  Note &b = voice.start({70, 63}, 0_us, instrument, tuning);
+  const EnvelopeLevel velocity = a.max_volume();
+
+  voice.pressure(69, EnvelopeLevel(0.5f));
+  assert_level_equal(a.max_volume(), EnvelopeLevel(velocity * 1.5f));
+  assert_level_equal(b.max_volume(), velocity);
+  a.next();
+  assert_level_equal(a.current().volume, EnvelopeLevel(velocity * 1.5f));
+
+  // Pressure scales the velocity, new notes start with the channel's
+  voice.pressure(EnvelopeLevel(0.25f));
+  assert_level_equal(a.max_volume(), EnvelopeLevel(velocity * 1.25f));
+  Note &c = voice.start({71, 63}, 0_us, instrument, tuning, {}, 0,
+                        {.pressure = EnvelopeLevel(0.25f)});
+  assert_level_equal(c.max_volume(), EnvelopeLevel(velocity * 1.25f));
+
+  // Loud notes saturate at full volume
+  Note &d = voice.start({72, 127}, 0_us, instrument, tuning);
+  voice.pressure(72, EnvelopeLevel::max());
+  assert_level_equal(d.max_volume(), EnvelopeLevel::max());
+}
+
+void test_same_number_on_two_channels_plays_two_notes(void) {
+  Voice<> voice(4);
+  Note &a = voice.start({60, 63}, 0_us, instrument, tuning, {}, 2);
+  Note &b = voice.start({60, 63}, 10_us, instrument, tuning, {}, 3);
+  TEST_ASSERT_NOT_EQUAL(&a, &b);
+  TEST_ASSERT_EQUAL(2, voice.active());
+  const EnvelopeLevel velocity = a.max_volume();
+
+  voice.pressure(60, EnvelopeLevel::max(), 2);
+  assert_level_equal(a.max_volume(), EnvelopeLevel(velocity * 2));
+  assert_level_equal(b.max_volume(), velocity);
+
+  // Still found after its channel started another note
+  Note &c = voice.start({62, 63}, 20_us, instrument, tuning, {}, 2);
+  voice.release(60, 30_us, 3);
+  TEST_ASSERT_TRUE(b.is_released());
+  TEST_ASSERT_FALSE(a.is_released());
+  voice.release(60, 40_us, 2);
+  TEST_ASSERT_TRUE(a.is_released());
+  TEST_ASSERT_FALSE(c.is_released());
+}
+
+void test_stolen_slot_is_not_found_by_old_number(void) {
+  Voice<> voice(1);
+  voice.start(mnotef(0), 0_us, instrument, tuning);
+  Note &b = voice.start(mnotef(1), 10_us, instrument, tuning);
+  voice.release(mnotef(0), 20_us);
+  TEST_ASSERT_FALSE(b.is_released());
+  voice.release(mnotef(1), 20_us);
+  TEST_ASSERT_TRUE(b.is_released());
+}
+
+void test_mono_plays_the_key_with_priority(void) {
+  Voice<> voice;
+  voice.mode(VoiceMode::Last);
+  Note &a = voice.start(mnotef(0), 0_us, instrument, tuning);
+  Note &b = voice.start(mnotef(2), 10_us, instrument, tuning);
+  TEST_ASSERT_TRUE(&a == &b);
+  TEST_ASSERT_EQUAL(1, voice.active());
+  assert_hertz_equal(b.frequency(), mnotef(2).frequency(tuning));
+  // Legato, the note isn't started again
+  assert_duration_equal(b.current().start, 0_us);
+
+  // Back to the key still held
+  voice.release(mnotef(2), 20_us);
+  TEST_ASSERT_FALSE(b.is_released());
+  assert_hertz_equal(b.frequency(), mnotef(0).frequency(tuning));
+  voice.release(mnotef(0), 30_us);
+  TEST_ASSERT_TRUE(b.is_released());
+
+  voice.mode(VoiceMode::High);
+  voice.start(mnotef(5), 40_us, instrument, tuning);
+  Note &c = voice.start(mnotef(3), 50_us, instrument, tuning);
+  TEST_ASSERT_FALSE(c.is_released());
+  assert_hertz_equal(c.frequency(), mnotef(5).frequency(tuning));
+  voice.release(mnotef(3), 60_us);
+  assert_hertz_equal(c.frequency(), mnotef(5).frequency(tuning));
+  voice.start(mnotef(3), 70_us, instrument, tuning);
+  voice.release(mnotef(5), 80_us);
+  TEST_ASSERT_FALSE(c.is_released());
+  assert_hertz_equal(c.frequency(), mnotef(3).frequency(tuning));
+
+  voice.mode(VoiceMode::Low);
+  voice.start(mnotef(7), 90_us, instrument, tuning);
+  voice.start(mnotef(1), 90_us, instrument, tuning);
+  assert_hertz_equal(c.frequency(), mnotef(1).frequency(tuning));
+}
+
+void test_mode_change_turns_off_every_slot(void) {
+  Voice<> voice(4);
+  voice.start(mnotef(0), 0_us, instrument, tuning);
+  voice.start(mnotef(1), 0_us, instrument, tuning);
+  voice.start(mnotef(2), 0_us, instrument, tuning);
+  voice.mode(VoiceMode::Last);
+  TEST_ASSERT_EQUAL(0, voice.active());
+
+  voice.start(mnotef(3), 10_us, instrument, tuning);
+  voice.mode(VoiceMode::Poly);
+  TEST_ASSERT_EQUAL(0, voice.active());
+  Note &a = voice.start(mnotef(3), 20_us, instrument, tuning);
+  voice.release(mnotef(3), 30_us);
+  TEST_ASSERT_TRUE(a.is_released());
+}
+
+void test_portamento_glides_from_the_latest_note(void) {
+  Voice<> voice;
+  voice.start({69, 127}, 0_us, instrument, tuning);
+  voice.portamento(true);
+  voice.portamento_time(10_ms);
+  // An octave up, the first pulse still has the period of the previous note
+  Note &b = voice.start({81, 127}, 0_us, instrument, tuning);
+  assert_duration_equal(b.current().period, 10000_us);
+  b.next();
+  assert_duration_equal(b.current().period, 5000_us);
+
+  voice.portamento(false);
+  Note &c = voice.start({57, 127}, 0_us, instrument, tuning);
+  assert_duration_equal(c.current().period, 20000_us);
+}
+
+void test_velocity_curve_of_new_notes(void) {
+  Voice<> voice(2);
+  Note &a = voice.start({69, 64}, 0_us, instrument, tuning);
+  assert_level_equal(a.max_volume(), VelocityTable::standard()[64]);
+
+  voice.velocity_curve({.type = VelocityCurveType::Fixed, .fixed = 127});
+  assert_level_equal(a.max_volume(), VelocityTable::standard()[64]);
+  Note &b = voice.start({70, 1}, 0_us, instrument, tuning);
+  assert_level_equal(b.max_volume(), EnvelopeLevel::max());
+}
+
 extern "C" void app_main(void) {
   UNITY_BEGIN();
   RUN_TEST(test_empty);
@@ -227,7 +500,23 @@ extern "C" void app_main(void) {
   RUN_TEST(test_off);
   RUN_TEST(test_should_return_the_note_with_least_time2);
   RUN_TEST(test_adjust_size);
+  RUN_TEST(test_adjust_size_keeps_as_many_notes_as_fit);
 
+  RUN_TEST(test_next_across_wraparound);
+  RUN_TEST(test_sustain_defers_release);
+  RUN_TEST(test_sustain_holds_only_its_channels);
+  RUN_TEST(test_sustained_note_restarted_is_kept);
+  RUN_TEST(test_sostenuto_holds_notes_down_when_pressed);
+  RUN_TEST(test_repeated_sostenuto_keeps_deferred_notes);
+  RUN_TEST(test_pedals_hold_until_both_are_up);
+  RUN_TEST(test_off_forgets_held_notes);
+  RUN_TEST(test_pressure_raises_note_volume);
+  RUN_TEST(test_same_number_on_two_channels_plays_two_notes);
+  RUN_TEST(test_stolen_slot_is_not_found_by_old_number);
+  RUN_TEST(test_mono_plays_the_key_with_priority);
+  RUN_TEST(test_mode_change_turns_off_every_slot);
+  RUN_TEST(test_portamento_glides_from_the_latest_note);
+  RUN_TEST(test_velocity_curve_of_new_notes);
   UNITY_END();
 }
 int main(int argc, char **argv) { app_main(); }
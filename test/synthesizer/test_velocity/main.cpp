@@ -0,0 +1,72 @@
+#include "envelope.hpp"
+#include "synthesizer/helpers/assertions.hpp"
+#include "velocity.hpp"
+#include <unity.h>
+
+using namespace teslasynth::synth;
+
+void test_log_is_the_standard_response(void) {
+  const VelocityTable &table = VelocityTable::standard();
+  for (uint8_t v = 0; v < 128; v++)
+    assert_level_equal(table[v], EnvelopeLevel::logscale(v * 2 + 1));
+  assert_level_equal(table[127], EnvelopeLevel::max());
+}
+
+void test_curves_rise_to_full_level(void) {
+  for (auto type : {VelocityCurveType::Linear, VelocityCurveType::Exp}) {
+    const VelocityTable table(VelocityCurve{.type = type});
+    assert_level_equal(table[0], EnvelopeLevel::zero());
+    assert_level_equal(table[127], EnvelopeLevel::max());
+    for (uint8_t v = 1; v < 128; v++)
+      TEST_ASSERT_TRUE(table[v - 1] < table[v]);
+  }
+  const VelocityTable linear(VelocityCurve{.type = VelocityCurveType::Linear});
+  const VelocityTable exp(VelocityCurve{.type = VelocityCurveType::Exp});
+  assert_level_equal(linear[64], EnvelopeLevel(64 / 127.f));
+  TEST_ASSERT_TRUE(exp[64] < linear[64]);
+  TEST_ASSERT_TRUE(linear[64] < VelocityTable::standard()[64]);
+}
+
+void test_fixed_ignores_velocity(void) {
+  const VelocityTable table(
+      VelocityCurve{.type = VelocityCurveType::Fixed, .fixed = 100});
+  for (uint8_t v = 0; v < 128; v++)
+    assert_level_equal(table[v], EnvelopeLevel(100 / 127.f));
+}
+
+void test_user_curve_goes_through_its_points(void) {
+  const VelocityTable table(VelocityCurve{
+      .type = VelocityCurveType::User,
+      .points = {{{100, 127}, {20, 40}, {60, 40}, {80, 127}}},
+  });
+  // Flat before the first point and after the last
+  assert_level_equal(table[0], EnvelopeLevel(40 / 127.f));
+  assert_level_equal(table[20], EnvelopeLevel(40 / 127.f));
+  assert_level_equal(table[60], EnvelopeLevel(40 / 127.f));
+  assert_level_equal(table[70], EnvelopeLevel(83.5f / 127));
+  assert_level_equal(table[80], EnvelopeLevel::max());
+  assert_level_equal(table[127], EnvelopeLevel::max());
+}
+
+void test_levels_on_demand_match_the_tables(void) {
+  for (auto type : {VelocityCurveType::Log, VelocityCurveType::Linear,
+                    VelocityCurveType::Exp, VelocityCurveType::Fixed,
+                    VelocityCurveType::User}) {
+    const VelocityCurve curve{.type = type, .fixed = 90};
+    const VelocityTable table(curve);
+    for (uint8_t v = 0; v < 128; v++)
+      assert_level_equal(velocity_level(curve, v), table[v]);
+  }
+}
+
+extern "C" void app_main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_log_is_the_standard_response);
+  RUN_TEST(test_curves_rise_to_full_level);
+  RUN_TEST(test_fixed_ignores_velocity);
+  RUN_TEST(test_user_curve_goes_through_its_points);
+  RUN_TEST(test_levels_on_demand_match_the_tables);
+  UNITY_END();
+}
+
+int main(int argc, char **argv) { app_main(); }
@@ -0,0 +1,230 @@
+#include "config_codec.hpp"
+#include "core.hpp"
+#include "midi_synth.hpp"
+#include "synthesizer/helpers/assertions.hpp"
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <unity.h>
+
+using namespace teslasynth::midisynth;
+using namespace teslasynth::midisynth::codec;
+
+template <std::uint8_t OUTPUTS>
+void assert_fields_equal(const Fields<OUTPUTS> &a, const Fields<OUTPUTS> &b) {
+  for (size_t i = 0; i < a.size(); i++) {
+    TEST_ASSERT_EQUAL(a[i].section, b[i].section);
+    TEST_ASSERT_EQUAL(a[i].tag, b[i].tag);
+    TEST_ASSERT_EQUAL(a[i].value, b[i].value);
+  }
+}
+
+template <std::uint8_t OUTPUTS>
+Configuration<OUTPUTS> decode_all(const Fields<OUTPUTS> &fields) {
+  Configuration<OUTPUTS> config;
+  for (auto &field : fields)
+    TEST_ASSERT_TRUE(decode(field, config));
+  return config;
+}
+
+void test_defaults_round_trip(void) {
+  Configuration<2> config;
+  auto fields = encode(config);
+  assert_fields_equal<2>(fields, encode(decode_all<2>(fields)));
+}
+
+void test_round_trip(void) {
+  Configuration<2> config(SynthConfig{.a440 = 432_hz,
+                                      .instrument = 3,
+                                      .power_duty = DutyCycle(40),
+                                      .max_concurrent = 1,
+                                      .max_stagger = 150_us});
+  config.channel(1) = Config{.max_on_time = 42_us,
+                             .notes = 2,
+                             .max_duty = DutyCycle(12.5),
+                             .thermal_time_constant = Millis16::millis(700),
+                             .heat_model = HeatModel::Linear,
+                             .duty_mode = DutyMode::LookAhead,
+                             .voice_mode = VoiceMode::High,
+                             .velocity = {.type = VelocityCurveType::User,
+                                          .fixed = 90,
+                                          .points = {{{0, 10},
+                                                      {30, 60},
+                                                      {90, 100},
+                                                      {127, 120}}}}};
+  config.route(9, 1) = {.enabled = true, .transpose = -12, .velocity = 150};
+  config.route(0, 0).enabled = false;
+
+  auto decoded = decode_all<2>(encode(config));
+  assert_hertz_equal(decoded.synth().a440, 432_hz);
+  TEST_ASSERT_EQUAL(3, *decoded.synth().instrument);
+  TEST_ASSERT_EQUAL(80, decoded.synth().power_duty.value());
+  TEST_ASSERT_EQUAL(1, decoded.synth().max_concurrent);
+  assert_duration_equal(decoded.synth().max_stagger, 150_us);
+  TEST_ASSERT_FALSE(decoded.channel(0).instrument.has_value());
+  assert_duration_equal(decoded.channel(1).max_on_time, 42_us);
+  TEST_ASSERT_EQUAL(2, decoded.channel(1).notes);
+  TEST_ASSERT_EQUAL(25, decoded.channel(1).max_duty.value());
+  TEST_ASSERT_EQUAL(700, decoded.channel(1).thermal_time_constant.ticks());
+  TEST_ASSERT_TRUE(decoded.channel(1).heat_model == HeatModel::Linear);
+  TEST_ASSERT_TRUE(decoded.channel(1).duty_mode == DutyMode::LookAhead);
+  TEST_ASSERT_TRUE(decoded.channel(1).voice_mode == VoiceMode::High);
+  TEST_ASSERT_TRUE(decoded.channel(0).voice_mode == VoiceMode::Poly);
+  TEST_ASSERT_TRUE(decoded.channel(1).velocity == config.channel(1).velocity);
+  TEST_ASSERT_TRUE(decoded.channel(0).velocity == VelocityCurve{});
+  TEST_ASSERT_TRUE(decoded.route(9, 1) == config.route(9, 1));
+  TEST_ASSERT_FALSE(decoded.route(0, 0).enabled);
+  TEST_ASSERT_TRUE(decoded.route(1, 1).enabled);
+}
+
+void test_unknown_fields_are_skipped(void) {
+  Configuration<1> config;
+  const auto before = encode(config);
+  TEST_ASSERT_FALSE(decode(Field{0, 200, 1}, config));
+  TEST_ASSERT_FALSE(decode(Field{1, 0, 1}, config));
+  TEST_ASSERT_FALSE(decode(Field{2, 1, 1}, config));
+  assert_fields_equal<1>(before, encode(config));
+}
+
+void test_invalid_values_are_rejected(void) {
+  Configuration<1> config;
+  const auto before = encode(config);
+  const uint8_t ch = 1;
+  TEST_ASSERT_FALSE(decode(Field{ch, uint8_t(ChannelTag::Notes), 0}, config));
+  TEST_ASSERT_FALSE(decode(
+      Field{ch, uint8_t(ChannelTag::Notes), Config::max_notes + 1u}, config));
+  TEST_ASSERT_FALSE(
+      decode(Field{ch, uint8_t(ChannelTag::MaxOnTime), 70000}, config));
+  TEST_ASSERT_FALSE(
+      decode(Field{ch, uint8_t(ChannelTag::MaxDuty), 201}, config));
+  TEST_ASSERT_FALSE(
+      decode(Field{ch, uint8_t(ChannelTag::DutyMode), 3}, config));
+  TEST_ASSERT_FALSE(
+      decode(Field{ch, uint8_t(ChannelTag::VoiceMode), 4}, config));
+  TEST_ASSERT_FALSE(
+      decode(Field{ch, uint8_t(ChannelTag::VelocityCurve), 5}, config));
+  TEST_ASSERT_FALSE(decode(
+      Field{ch, uint8_t(ChannelTag::VelocityCurve), 128u << 8}, config));
+  TEST_ASSERT_FALSE(decode(
+      Field{ch, uint8_t(ChannelTag::VelocityPointsHigh), 128u << 24}, config));
+  TEST_ASSERT_FALSE(
+      decode(Field{ch, uint8_t(ChannelTag::Instrument), 256}, config));
+  const uint8_t route = uint8_t(ChannelTag::Route) + 3;
+  TEST_ASSERT_FALSE(decode(Field{ch, route, 2}, config));
+  TEST_ASSERT_FALSE(decode(Field{ch, route, 201 << 16}, config));
+  TEST_ASSERT_FALSE(decode(Field{ch, route, 1u << 24}, config));
+  const uint8_t tuning = uint8_t(SynthTag::Tuning);
+  TEST_ASSERT_FALSE(
+      decode(Field{0, tuning, codec::detail::from_float(NAN)}, config));
+  TEST_ASSERT_FALSE(
+      decode(Field{0, tuning, codec::detail::from_float(-1)}, config));
+  assert_fields_equal<1>(before, encode(config));
+}
+
+struct Random {
+  uint32_t state = 0x12345678;
+  uint32_t next() {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+  }
+  // Mostly small values, where the interesting boundaries are
+  uint32_t value() {
+    switch (next() % 4) {
+    case 0:
+      return next() % 8;
+    case 1:
+      return next() % 300;
+    case 2:
+      return UINT32_MAX - next() % 4;
+    default:
+      return next();
+    }
+  }
+};
+
+void test_fuzz_decoder(void) {
+  Random random;
+  Configuration<3> config;
+  for (auto i = 0; i < 100000; i++) {
+    Field field{static_cast<uint8_t>(random.next() % 6),
+                static_cast<uint8_t>(random.next() % 34), random.value()};
+    decode(field, config);
+
+    // Whatever was accepted must survive another round trip
+    auto fields = encode(config);
+    Configuration<3> copy;
+    for (auto &f : fields)
+      TEST_ASSERT_TRUE(decode(f, copy));
+    auto again = encode(copy);
+    for (size_t j = 0; j < fields.size(); j++)
+      TEST_ASSERT_TRUE(fields[j] == again[j]);
+
+    const float a440 = config.synth().a440;
+    TEST_ASSERT_TRUE(std::isfinite(a440) && a440 > 0);
+    for (uint8_t ch = 0; ch < 3; ch++) {
+      const Config &c = config.channel(ch);
+      TEST_ASSERT_TRUE(c.notes >= 1 && c.notes <= Config::max_notes);
+      TEST_ASSERT_TRUE(c.max_duty.value() <= DutyCycle::max().value());
+      TEST_ASSERT_TRUE(c.duty_mode <= DutyMode::LookAhead);
+      TEST_ASSERT_TRUE(c.voice_mode <= VoiceMode::Low);
+      TEST_ASSERT_TRUE(c.velocity.type <= VelocityCurveType::User);
+      TEST_ASSERT_TRUE(c.velocity.fixed <= 127);
+      TEST_ASSERT_TRUE(c.heat_model <= HeatModel::Squared);
+    }
+  }
+}
+
+void test_decodes_version_1_blobs(void) {
+  // Two outputs as the struct was laid out by format version 1
+  std::vector<uint8_t> blob(28, 0);
+  const float a440 = 432;
+  std::memcpy(&blob[0], &a440, sizeof(a440));
+  blob[4] = 2, blob[5] = 1; // instrument
+  const uint8_t channels[2][10] = {
+      {50, 0, 0x2c, 0x01, 0x10, 0x27, 3, 20, 0, 0},
+      {0xe8, 0x03, 100, 0, 0x88, 0x13, 0, 200, 5, 1},
+  };
+  std::memcpy(&blob[8], channels, sizeof(channels));
+
+  auto config = legacy::decode<2>(blob.data(), blob.size());
+  TEST_ASSERT_TRUE(config.has_value());
+  assert_hertz_equal(config->synth().a440, 432_hz);
+  TEST_ASSERT_EQUAL(2, *config->synth().instrument);
+
+  const Config &first = config->channel(0);
+  assert_duration_equal(first.max_on_time, 50_us);
+  assert_duration_equal(first.min_deadtime, 300_us);
+  assert_duration_equal(first.duty_window, 10_ms);
+  TEST_ASSERT_EQUAL(3, first.notes);
+  TEST_ASSERT_EQUAL(20, first.max_duty.value());
+  TEST_ASSERT_FALSE(first.instrument.has_value());
+
+  // Zero notes is out of range and keeps the default
+  const Config &second = config->channel(1);
+  assert_duration_equal(second.max_on_time, 1_ms);
+  assert_duration_equal(second.min_deadtime, 100_us);
+  assert_duration_equal(second.duty_window, 5_ms);
+  TEST_ASSERT_EQUAL(Config::max_notes, second.notes);
+  TEST_ASSERT_TRUE(second.max_duty.is_max());
+  TEST_ASSERT_EQUAL(5, *second.instrument);
+  // Settings added later keep their defaults
+  TEST_ASSERT_TRUE(second.velocity == VelocityCurve{});
+
+  TEST_ASSERT_FALSE(legacy::decode<2>(blob.data(), blob.size() - 4));
+  TEST_ASSERT_FALSE(legacy::decode<1>(blob.data(), blob.size()));
+}
+
+extern "C" void app_main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_defaults_round_trip);
+  RUN_TEST(test_round_trip);
+  RUN_TEST(test_unknown_fields_are_skipped);
+  RUN_TEST(test_invalid_values_are_rejected);
+  RUN_TEST(test_fuzz_decoder);
+  RUN_TEST(test_decodes_version_1_blobs);
+  UNITY_END();
+}
+int main(int argc, char **argv) { app_main(); }
@@ -0,0 +1,111 @@
+#include "core.hpp"
+#include "double_buffer.hpp"
+#include "midi_synth.hpp"
+#include "synthesizer/helpers/assertions.hpp"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <unity.h>
+
+using namespace teslasynth::midisynth;
+
+void test_nothing_to_consume_initially(void) {
+  DoubleBuffer<int> buffer(42);
+  int out = 0;
+  TEST_ASSERT_FALSE(buffer.consume(out));
+  TEST_ASSERT_EQUAL(0, out);
+  TEST_ASSERT_EQUAL(0, buffer.snapshot(out));
+  TEST_ASSERT_EQUAL(42, out);
+}
+
+void test_consumes_published_value_once(void) {
+  DoubleBuffer<int> buffer;
+  int out = 0;
+  buffer.publish(1);
+  TEST_ASSERT_TRUE(buffer.consume(out));
+  TEST_ASSERT_EQUAL(1, out);
+  TEST_ASSERT_FALSE(buffer.consume(out));
+}
+
+void test_consumes_the_last_of_many(void) {
+  DoubleBuffer<int> buffer;
+  int out = 0;
+  for (int i = 1; i <= 5; i++)
+    buffer.publish(i);
+  TEST_ASSERT_EQUAL(5, buffer.version());
+  TEST_ASSERT_TRUE(buffer.consume(out));
+  TEST_ASSERT_EQUAL(5, out);
+}
+
+void test_snapshots_dont_consume(void) {
+  DoubleBuffer<int> buffer;
+  int out = 0;
+  buffer.publish(1);
+  buffer.publish(2);
+  TEST_ASSERT_EQUAL(2, buffer.snapshot(out));
+  TEST_ASSERT_EQUAL(2, out);
+  TEST_ASSERT_EQUAL(2, buffer.version());
+
+  out = 0;
+  TEST_ASSERT_TRUE(buffer.consume(out));
+  TEST_ASSERT_EQUAL(2, out);
+  buffer.publish(3);
+  TEST_ASSERT_EQUAL(3, buffer.version());
+  TEST_ASSERT_TRUE(buffer.consume(out));
+  TEST_ASSERT_EQUAL(3, out);
+}
+
+void test_hands_over_configuration(void) {
+  Configuration<2> config;
+  DoubleBuffer<Configuration<2>> buffer(config);
+  config.channel(1).max_on_time = 42_us;
+  config.synth().a440 = 432_hz;
+  buffer.publish(config);
+
+  Configuration<2> live;
+  TEST_ASSERT_TRUE(buffer.consume(live));
+  assert_duration_equal(live.channel(1).max_on_time, 42_us);
+  assert_hertz_equal(live.synth().a440, 432_hz);
+}
+
+void test_readers_never_see_torn_values(void) {
+  // Every value is a run of the same number, a torn copy mixes two
+  typedef std::array<uint32_t, 4096> Value;
+  DoubleBuffer<Value> buffer;
+  std::atomic<bool> done{false};
+  std::thread writer([&] {
+    Value value;
+    for (uint32_t i = 1; i <= 20000; i++) {
+      value.fill(i);
+      buffer.publish(value);
+    }
+    done = true;
+  });
+
+  uint32_t torn = 0, last = 0;
+  Value out;
+  while (!done) {
+    const uint32_t version = buffer.snapshot(out);
+    for (auto v : out)
+      torn += v != out[0];
+    torn += out[0] != version || version < last;
+    last = version;
+  }
+  writer.join();
+  TEST_ASSERT_EQUAL(0, torn);
+  TEST_ASSERT_EQUAL(20000, buffer.snapshot(out));
+  TEST_ASSERT_EQUAL(20000, out[4095]);
+}
+
+extern "C" void app_main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_nothing_to_consume_initially);
+  RUN_TEST(test_consumes_published_value_once);
+  RUN_TEST(test_consumes_the_last_of_many);
+  RUN_TEST(test_snapshots_dont_consume);
+  RUN_TEST(test_hands_over_configuration);
+  RUN_TEST(test_readers_never_see_torn_values);
+  UNITY_END();
+}
+int main(int argc, char **argv) { app_main(); }
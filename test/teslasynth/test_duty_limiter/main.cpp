@@ -3,7 +3,9 @@
 #include "midi_synth.hpp"
 #include "notes.hpp"
 #include "synthesizer/helpers/assertions.hpp"
+#include <algorithm>
 #include <cstdint>
+#include <utility>
 #include <unity.h>
 
 using namespace teslasynth::midisynth;
@@ -58,6 +60,58 @@ void test_replenish_cant_exceed_window_limit(void) {
   assert_duration_equal(limiter.budget(), 1_ms);
 }
 
+void test_scale_to_remaining_budget(void) {
+  DutyLimiter limiter(DutyCycle(10), 10_ms, DutyMode::Scale);
+  assert_duration_equal(limiter.grant(600_us), 600_us);
+  assert_duration_equal(limiter.grant(600_us), 400_us);
+  assert_duration_equal(limiter.grant(600_us), 0_us);
+  assert_duration_equal(limiter.budget(), 0_us);
+
+  TEST_ASSERT_EQUAL(3, limiter.stats().pulses);
+  TEST_ASSERT_EQUAL(1, limiter.stats().attenuated);
+  TEST_ASSERT_EQUAL(1, limiter.stats().dropped);
+  assert_duration_equal(limiter.stats().requested, 1800_us);
+  assert_duration_equal(limiter.stats().granted, 1_ms);
+}
+
+void test_drop_counts_dropped_pulses(void) {
+  DutyLimiter limiter(DutyCycle(10), 10_ms);
+  assert_duration_equal(limiter.grant(600_us), 600_us);
+  assert_duration_equal(limiter.grant(600_us), 0_us);
+  assert_duration_equal(limiter.budget(), 400_us);
+
+  TEST_ASSERT_EQUAL(0, limiter.stats().attenuated);
+  TEST_ASSERT_EQUAL(1, limiter.stats().dropped);
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 0.5, limiter.stats().attenuation());
+}
+
+// Plays a pulse train over budget, and returns the shortest and longest
+// pulses once the budget has run out
+std::pair<Duration16, Duration16> play_over_budget(DutyMode mode) {
+  DutyLimiter limiter(DutyCycle(10), 10_ms, mode);
+  Duration16 shortest = Duration16::max(), longest = Duration16::zero();
+  for (auto i = 0; i < 200; i++) {
+    Duration16 on = limiter.grant(200_us);
+    limiter.replenish(*(Duration16(1_ms) - on));
+    if (i >= 100) {
+      shortest = std::min(shortest, on);
+      longest = std::max(longest, on);
+    }
+  }
+  return {shortest, longest};
+}
+
+void test_look_ahead_spreads_budget_evenly(void) {
+  auto dropping = play_over_budget(DutyMode::Drop);
+  assert_duration_equal(dropping.first, 0_us);
+  assert_duration_equal(dropping.second, 200_us);
+
+  // Nothing is dropped, every pulse gets about the steady share of the duty
+  auto spread = play_over_budget(DutyMode::LookAhead);
+  TEST_ASSERT_TRUE(spread.first >= 75_us);
+  TEST_ASSERT_TRUE(spread.second <= 100_us);
+}
+
 extern "C" void app_main(void) {
   UNITY_BEGIN();
   RUN_TEST(test_no_limit);
@@ -65,6 +119,9 @@ extern "C" void app_main(void) {
   RUN_TEST(test_limit_by_duty_and_window);
   RUN_TEST(test_replenish);
   RUN_TEST(test_replenish_cant_exceed_window_limit);
+  RUN_TEST(test_scale_to_remaining_budget);
+  RUN_TEST(test_drop_counts_dropped_pulses);
+  RUN_TEST(test_look_ahead_spreads_budget_evenly);
   UNITY_END();
 }
 
@@ -0,0 +1,76 @@
+// The timeline at the finest tick rate, where 32 bits wrap in under 2 minutes.
+// The rate is set for the whole build by the native-40mhz environment.
+#include "core.hpp"
+#include "midi_synth.hpp"
+#include "synthesizer/helpers/assertions.hpp"
+#include <cstdint>
+#include <unity.h>
+
+using namespace teslasynth::midisynth;
+
+void test_tick_rate(void) {
+  TEST_ASSERT_EQUAL(40'000'000, tick_rate);
+  TEST_ASSERT_EQUAL(40, Duration32(1_us).ticks());
+}
+
+void test_instant_wraparound(void) {
+  // 32 bits of 25ns ticks wrap at about 107 seconds
+  const Duration wrap = Duration::ticks(1ull << 32);
+  const Duration before = *(wrap - 1_s);
+  const Instant last = Instant(before);
+
+  TEST_ASSERT_TRUE(Instant(wrap) == Instant());
+  TEST_ASSERT_TRUE(last + 2_s > last);
+  TEST_ASSERT_TRUE(Instant(wrap + 1_s) > last);
+  assert_duration_equal(*(Instant(wrap + 1_s) - last), 2_s);
+  assert_duration_equal((last + 2_s).extend(before), wrap + 1_s);
+
+  // Over several wraps, instants a window apart stay ordered
+  for (uint64_t s = 0; s < 1000; s += 7) {
+    const Instant at = Duration::seconds(s);
+    TEST_ASSERT_TRUE(at < at + 10_ms);
+    assert_duration_equal(*((at + 10_ms) - at), 10_ms);
+    assert_duration_equal(at.extend(Duration::seconds(s) + 10_ms),
+                          Duration::seconds(s));
+  }
+}
+
+void test_quiet_outputs_are_not_busy_after_a_wrap(void) {
+  PowerArbiter<2> arbiter(SynthConfig{.max_concurrent = 1});
+  TEST_ASSERT_TRUE(arbiter.can_use(0, Instant(), 100_us));
+  TEST_ASSERT_FALSE(arbiter.can_use(1, Instant(50_us), 100_us));
+
+  // More than half the timeline later, output 0 has long been off
+  const Instant later = Duration::seconds(60);
+  TEST_ASSERT_TRUE(arbiter.busy_until(1, later) == later);
+  TEST_ASSERT_TRUE(arbiter.can_use(1, later, 100_us));
+  TEST_ASSERT_FALSE(arbiter.can_use(0, later + 50_us, 100_us));
+}
+
+void test_duty_limiter_keeps_sub_microsecond_on_times(void) {
+  DutyLimiter limiter(DutyCycle(10), 10_ms, DutyMode::Scale);
+  const Duration16 on = Duration16::ticks(4010); // 100.25us
+  for (int i = 0; i < 9; i++)
+    TEST_ASSERT_EQUAL(on.ticks(), limiter.grant(on).ticks());
+  TEST_ASSERT_EQUAL(40000 - 9 * 4010, limiter.budget().ticks());
+  TEST_ASSERT_EQUAL(40000 - 9 * 4010, limiter.grant(on).ticks());
+  TEST_ASSERT_TRUE(limiter.budget().is_zero());
+
+  // A window of off-time at 10% duty refills it
+  for (int i = 0; i < 9; i++)
+    limiter.replenish(Duration16::ticks(40000));
+  TEST_ASSERT_TRUE(limiter.budget().is_zero());
+  limiter.replenish(Duration16::ticks(40000));
+  TEST_ASSERT_EQUAL(40000, limiter.budget().ticks());
+}
+
+extern "C" void app_main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_tick_rate);
+  RUN_TEST(test_instant_wraparound);
+  RUN_TEST(test_quiet_outputs_are_not_busy_after_a_wrap);
+  RUN_TEST(test_duty_limiter_keeps_sub_microsecond_on_times);
+  UNITY_END();
+}
+
+int main(int argc, char **argv) { app_main(); }
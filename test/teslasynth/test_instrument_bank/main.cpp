@@ -0,0 +1,146 @@
+#include "core.hpp"
+#include "envelope.hpp"
+#include "instrument_bank.hpp"
+#include "instruments.hpp"
+#include "synthesizer/helpers/assertions.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <unity.h>
+#include <vector>
+
+using namespace teslasynth::midisynth;
+
+Instrument instrument(int i) {
+  return {.envelope = {Duration32::micros(1000 + i), 5_ms,
+                       EnvelopeLevel(i % 10 * 0.1), 20_ms, CurveType::Lin},
+          .vibrato = {Hertz(i % 7), 1_hz},
+          .tremolo = {Hertz(i % 5), EnvelopeLevel(0.5), float(i % 3)}};
+}
+
+struct MemoryBank {
+  std::vector<uint8_t> data;
+
+  MemoryBank(size_t count, size_t record_size = bank::record_size) {
+    auto header = bank::encode_header(count);
+    bank::detail::put16(&header[6], record_size);
+    data.insert(data.end(), header.begin(), header.end());
+    for (size_t i = 0; i < count; i++) {
+      auto record = bank::encode(instrument(i), "patch");
+      const size_t size = std::min(record_size, record.size());
+      data.insert(data.end(), record.begin(), record.begin() + size);
+      data.resize(data.size() + record_size - size, 0xff);
+    }
+  }
+
+  InstrumentBank::Reader reader() {
+    return [this](uint32_t offset, uint8_t *out, size_t len) {
+      if (offset + len > data.size())
+        return false;
+      std::memcpy(out, data.data() + offset, len);
+      return true;
+    };
+  }
+};
+
+void test_record_round_trip(void) {
+  const Instrument a = instrument(3);
+  auto record = bank::encode(a, "lead");
+  TEST_ASSERT_EQUAL_STRING("lead", reinterpret_cast<const char *>(&record[0]));
+  auto b = bank::decode(record.data());
+  TEST_ASSERT_TRUE(b.has_value());
+  assert_instrument_equal(*b, a);
+}
+
+void test_invalid_records_are_rejected(void) {
+  auto record = bank::encode(instrument(1));
+  record[32] = 3;
+  TEST_ASSERT_FALSE(bank::decode(record.data()).has_value());
+
+  record = bank::encode(instrument(1));
+  bank::detail::putf(&record[28], NAN);
+  TEST_ASSERT_FALSE(bank::decode(record.data()).has_value());
+
+  record = bank::encode(instrument(1));
+  bank::detail::putf(&record[48], 1.5);
+  TEST_ASSERT_FALSE(bank::decode(record.data()).has_value());
+
+  record = bank::encode(instrument(1));
+  bank::detail::putf(&record[52], -1);
+  TEST_ASSERT_FALSE(bank::decode(record.data()).has_value());
+}
+
+void test_rejects_invalid_headers(void) {
+  InstrumentBank instruments;
+  MemoryBank memory(4);
+  memory.data[0] = 'X';
+  TEST_ASSERT_FALSE(instruments.open(memory.reader()));
+  TEST_ASSERT_EQUAL(0, instruments.size());
+  TEST_ASSERT_FALSE(instruments.read(0).has_value());
+
+  MemoryBank short_records(4, bank::min_record_size - 4);
+  TEST_ASSERT_FALSE(instruments.open(short_records.reader()));
+
+  MemoryBank empty(0);
+  empty.data.resize(8);
+  TEST_ASSERT_FALSE(instruments.open(empty.reader()));
+}
+
+void test_loads_instruments_by_number(void) {
+  MemoryBank memory(300);
+  InstrumentBank instruments;
+  TEST_ASSERT_TRUE(instruments.open(memory.reader()));
+  TEST_ASSERT_EQUAL(300, instruments.size());
+
+  for (auto n : {0, 299, 150}) {
+    const auto loaded = instruments.read(n);
+    TEST_ASSERT_TRUE(loaded.has_value());
+    assert_instrument_equal(*loaded, instrument(n));
+  }
+  TEST_ASSERT_FALSE(instruments.read(300).has_value());
+}
+
+void test_skips_unknown_record_tails(void) {
+  MemoryBank memory(10, bank::record_size + 12);
+  InstrumentBank instruments;
+  TEST_ASSERT_TRUE(instruments.open(memory.reader()));
+  for (int n = 0; n < 10; n++)
+    assert_instrument_equal(*instruments.read(n), instrument(n));
+}
+
+void test_loads_version_1_records(void) {
+  MemoryBank memory(10, bank::min_record_size);
+  bank::detail::put16(&memory.data[4], 1);
+  InstrumentBank instruments;
+  TEST_ASSERT_TRUE(instruments.open(memory.reader()));
+  for (int n = 0; n < 10; n++) {
+    Instrument expected = instrument(n);
+    expected.tremolo = Tremolo::none();
+    assert_instrument_equal(*instruments.read(n), expected);
+  }
+}
+
+void test_unreadable_records_are_missing(void) {
+  MemoryBank memory(10);
+  InstrumentBank instruments;
+  instruments.open(memory.reader());
+  memory.data.resize(bank::header_size + 5 * bank::record_size);
+
+  TEST_ASSERT_TRUE(instruments.read(4).has_value());
+  TEST_ASSERT_FALSE(instruments.read(5).has_value());
+  TEST_ASSERT_FALSE(instruments.read(5).has_value());
+  TEST_ASSERT_EQUAL(3, instruments.loads());
+}
+
+extern "C" void app_main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_record_round_trip);
+  RUN_TEST(test_invalid_records_are_rejected);
+  RUN_TEST(test_rejects_invalid_headers);
+  RUN_TEST(test_loads_instruments_by_number);
+  RUN_TEST(test_skips_unknown_record_tails);
+  RUN_TEST(test_loads_version_1_records);
+  RUN_TEST(test_unreadable_records_are_missing);
+  UNITY_END();
+}
+int main(int argc, char **argv) { app_main(); }
@@ -8,7 +8,9 @@
 #include "synthesizer/helpers/assertions.hpp"
 #include "unity_internals.h"
 #include <cstdint>
+#include <cstring>
 #include <unity.h>
+#include <utility>
 #include <vector>
 
 using namespace teslasynth::midisynth;
@@ -25,14 +27,19 @@ class FakeNotes {
 public:
   struct Started {
     MidiNote mnote;
-    Duration time;
+    Instant time;
     Instrument instrument;
+    const Instrument *playing;
     Hertz tuning;
+    NoteExpression expression;
+    uint8_t channel;
+    ChannelControllers controllers;
   };
 
   struct Released {
     uint8_t mnote;
-    Duration time;
+    Instant time;
+    uint8_t channel;
   };
 
   struct Off {};
@@ -42,24 +49,116 @@ private:
   std::vector<Released> released_;
   std::vector<Off> offs_;
   std::vector<uint8_t> adjusts_;
+  std::vector<uint32_t> bends_;
+  std::vector<bool> sustains_, sostenutos_;
+  std::vector<std::pair<float, float>> vibratos_;
+  std::vector<VoiceMode> modes_;
+  std::vector<bool> portamentos_;
+  std::vector<Duration32> glides_;
+  std::vector<VelocityCurve> velocities_;
+  std::vector<float> tempos_;
+  std::vector<std::pair<uint8_t, EnvelopeLevel>> pressures_;
+  std::vector<std::pair<uint8_t, uint32_t>> note_bends_;
+  std::vector<std::pair<uint8_t, float>> timbres_;
+  // MIDI channel of every pressure, bend and timbre of a single note
+  std::vector<uint8_t> note_channels_;
+  std::vector<float> gains_;
+  // Channels of every bend, pedal and channel pressure
+  std::vector<uint16_t> channels_;
 
 public:
-  Note &start(const MidiNote &mnote, Duration time,
-              const Instrument &instrument, Hertz tuning) {
-    started_.push_back({mnote, time, instrument, tuning});
+  Note &start(const MidiNote &mnote, Instant time,
+              const Instrument &instrument, Hertz tuning,
+              const NoteExpression &expression = {}, uint8_t channel = 0,
+              const ChannelControllers &controllers = {}) {
+    started_.push_back({mnote, time, instrument, &instrument, tuning,
+                        expression, channel, controllers});
     return note;
   }
-  void release(uint8_t number, Duration time) {
-    released_.push_back({number, time});
+  void release(uint8_t number, Instant time, uint8_t channel = 0) {
+    released_.push_back({number, time, channel});
   }
   void off() { offs_.push_back({}); }
 
   void adjust_size(uint8_t size) { adjusts_.push_back(size); }
+  void bend(uint32_t multiplier, uint16_t channels = UINT16_MAX) {
+    bends_.push_back(multiplier);
+    channels_.push_back(channels);
+  }
+  void sustain(bool down, Instant, uint16_t channels = UINT16_MAX) {
+    sustains_.push_back(down);
+    channels_.push_back(channels);
+  }
+  void sostenuto(bool down, Instant, uint16_t channels = UINT16_MAX) {
+    sostenutos_.push_back(down);
+    channels_.push_back(channels);
+  }
+  void pressure(uint8_t number, EnvelopeLevel level, uint8_t channel = 0) {
+    pressures_.push_back({number, level});
+    note_channels_.push_back(channel);
+  }
+  void pressure(EnvelopeLevel level, uint16_t channels = UINT16_MAX) {
+    pressures_.push_back({128, level});
+    channels_.push_back(channels);
+  }
+  void note_bend(uint8_t number, uint32_t multiplier, uint8_t channel = 0) {
+    note_bends_.push_back({number, multiplier});
+    note_channels_.push_back(channel);
+  }
+  void timbre(uint8_t number, float depth, uint8_t channel = 0) {
+    timbres_.push_back({number, depth});
+    note_channels_.push_back(channel);
+  }
+  void modulate_vibrato(float rate, float depth,
+                        uint16_t channels = UINT16_MAX) {
+    vibratos_.push_back({rate, depth});
+  }
+  void modulate_gain(float gain, uint16_t channels = UINT16_MAX) {
+    gains_.push_back(gain);
+  }
+  void mode(VoiceMode mode) { modes_.push_back(mode); }
+  void portamento(bool on) { portamentos_.push_back(on); }
+  void portamento_time(Duration32 time) { glides_.push_back(time); }
+  void velocity_curve(const VelocityCurve &curve) {
+    velocities_.push_back(curve);
+  }
+  void tempo(float bpm) { tempos_.push_back(bpm); }
+  // Notes are never over, every started one keeps its instrument
+  bool plays(const Instrument *instrument) const {
+    for (auto &s : started_)
+      if (s.playing == instrument)
+        return true;
+    return false;
+  }
 
   const std::vector<Started> started() const { return started_; }
   const std::vector<Released> released() const { return released_; }
   const std::vector<Off> turned_off() const { return offs_; }
   const std::vector<uint8_t> adjusted() const { return adjusts_; }
+  const std::vector<uint32_t> bends() const { return bends_; }
+  const std::vector<bool> sustains() const { return sustains_; }
+  const std::vector<bool> sostenutos() const { return sostenutos_; }
+  // Channel pressure is recorded with note number 128
+  const std::vector<std::pair<uint8_t, EnvelopeLevel>> pressures() const {
+    return pressures_;
+  }
+  const std::vector<std::pair<uint8_t, uint32_t>> note_bends() const {
+    return note_bends_;
+  }
+  const std::vector<std::pair<uint8_t, float>> timbres() const {
+    return timbres_;
+  }
+  const std::vector<uint8_t> note_channels() const { return note_channels_; }
+  const std::vector<float> gains() const { return gains_; }
+  const std::vector<uint16_t> channels() const { return channels_; }
+  const std::vector<std::pair<float, float>> vibratos() const {
+    return vibratos_;
+  }
+  const std::vector<VoiceMode> modes() const { return modes_; }
+  const std::vector<bool> portamentos() const { return portamentos_; }
+  const std::vector<Duration32> glides() const { return glides_; }
+  const std::vector<VelocityCurve> velocities() const { return velocities_; }
+  const std::vector<float> tempos() const { return tempos_; }
 };
 
 void test_note_pulse_empty(void) {
@@ -192,6 +291,284 @@ void test_non_existing_instrument_number_falls_back_to_default(void) {
   assert_instrument_equal(tsynth.instrument(0), default_instrument());
 }
 
+// Reads what a message needs from the bank first, as the playback does
+template <class T>
+void handle_reading(T &tsynth, MidiChannelMessage msg, Duration time) {
+  while (auto n = tsynth.missing(msg))
+    tsynth.provide(*n, tsynth.read(*n));
+  tsynth.handle(msg, time);
+}
+
+void test_should_load_instruments_from_bank(void) {
+  std::vector<uint8_t> file;
+  const auto header = bank::encode_header(200);
+  file.insert(file.end(), header.begin(), header.end());
+  for (auto i = 0; i < 200; i++) {
+    const auto record = bank::encode(instrument(i % 10));
+    file.insert(file.end(), record.begin(), record.end());
+  }
+  InstrumentBank instruments;
+  TEST_ASSERT_TRUE(
+      instruments.open([&](uint32_t offset, uint8_t *data, size_t len) {
+        std::memcpy(data, file.data() + offset, len);
+        return true;
+      }));
+
+  Teslasynth<1, FakeNotes> tsynth;
+  tsynth.use_instruments(instruments);
+  auto &voice = tsynth.voice();
+  TEST_ASSERT_EQUAL(200, tsynth.instruments_size());
+
+  handle_reading(tsynth, MidiChannelMessage::program_change(0, 7), 10_ms);
+  TEST_ASSERT_EQUAL(1, instruments.loads());
+  handle_reading(tsynth, MidiChannelMessage::note_on(0, 69, 127), 0_ms);
+  TEST_ASSERT_EQUAL(1, instruments.loads());
+  assert_instrument_equal(voice.started().back().instrument, instrument(7));
+
+  handle_reading(tsynth,
+                 MidiChannelMessage::control_change(
+                     0, ControlChange::BANK_SELECT_MSB, 1),
+                 0_ms);
+  handle_reading(tsynth, MidiChannelMessage::program_change(0, 3), 10_ms);
+  TEST_ASSERT_EQUAL(131, tsynth.instrument_number(0));
+  handle_reading(tsynth, MidiChannelMessage::note_on(0, 70, 127), 0_ms);
+  assert_instrument_equal(voice.started().back().instrument, instrument(1));
+
+  handle_reading(tsynth, MidiChannelMessage::program_change(0, 100), 10_ms);
+  TEST_ASSERT_EQUAL(200, tsynth.instrument_number(0));
+  handle_reading(tsynth, MidiChannelMessage::note_on(0, 71, 127), 0_ms);
+  TEST_ASSERT_TRUE(voice.started().back().instrument == default_instrument());
+}
+
+void test_bank_is_read_before_messages_are_handled(void) {
+  std::vector<uint8_t> file;
+  const auto header = bank::encode_header(20);
+  file.insert(file.end(), header.begin(), header.end());
+  for (auto i = 0; i < 20; i++) {
+    const auto record = bank::encode(instrument(i % 10));
+    file.insert(file.end(), record.begin(), record.end());
+  }
+  InstrumentBank instruments;
+  TEST_ASSERT_TRUE(
+      instruments.open([&](uint32_t offset, uint8_t *data, size_t len) {
+        if (offset >= bank::header_size + 9 * bank::record_size)
+          return false;
+        std::memcpy(data, file.data() + offset, len);
+        return true;
+      }));
+
+  Teslasynth<1, FakeNotes> tsynth;
+  tsynth.use_instruments(instruments);
+  auto &voice = tsynth.voice();
+
+  // Handling never reads, the note waits for the instrument to be provided
+  const auto change = MidiChannelMessage::program_change(0, 7);
+  TEST_ASSERT_EQUAL(7, *tsynth.missing(change));
+  tsynth.handle(change, 0_ms);
+  TEST_ASSERT_EQUAL(0, instruments.loads());
+  const auto on = MidiChannelMessage::note_on(0, 69, 127);
+  TEST_ASSERT_EQUAL(7, *tsynth.missing(on));
+  handle_reading(tsynth, on, 0_ms);
+  TEST_ASSERT_EQUAL(1, instruments.loads());
+  assert_instrument_equal(voice.started().back().instrument, instrument(7));
+  TEST_ASSERT_FALSE(tsynth.missing(on).has_value());
+
+  // Configured instruments are read when a note needs them
+  Configuration<1> config;
+  config.synth().instrument = 5;
+  tsynth.reload_config(config);
+  TEST_ASSERT_EQUAL(5, *tsynth.missing(on));
+  handle_reading(tsynth, MidiChannelMessage::note_on(0, 70, 127), 0_ms);
+  TEST_ASSERT_EQUAL(2, instruments.loads());
+  assert_instrument_equal(voice.started().back().instrument, instrument(5));
+
+  // A record that can't be read plays the default, and is read once
+  config.synth().instrument = 12;
+  tsynth.reload_config(config);
+  handle_reading(tsynth, MidiChannelMessage::note_on(0, 71, 127), 0_ms);
+  handle_reading(tsynth, MidiChannelMessage::note_on(0, 72, 127), 0_ms);
+  TEST_ASSERT_EQUAL(3, instruments.loads());
+  TEST_ASSERT_TRUE(voice.started().back().instrument == default_instrument());
+}
+
+void test_should_play_a_program_per_channel(void) {
+  constexpr auto N = 10;
+  std::array<Instrument, N> instruments;
+  for (auto i = 0; i < N; i++) {
+    instruments[i] = instrument(i);
+  }
+  Configuration<1> config;
+  config.route(1, 0).enabled = true;
+  Teslasynth<1, FakeNotes> tsynth(config);
+  tsynth.use_instruments(instruments);
+  auto &voice = tsynth.voice();
+
+  tsynth.handle(MidiChannelMessage::program_change(0, 4), 0_ms);
+  tsynth.handle(MidiChannelMessage::program_change(1, 6), 0_ms);
+  tsynth.handle(MidiChannelMessage::note_on(0, 60, 127), 0_ms);
+  assert_instrument_equal(voice.started().back().instrument, instrument(4));
+  tsynth.handle(MidiChannelMessage::note_on(1, 64, 127), 0_ms);
+  assert_instrument_equal(voice.started().back().instrument, instrument(6));
+  TEST_ASSERT_EQUAL(2, voice.started().size());
+  TEST_ASSERT_EQUAL(4, tsynth.instrument_number(0, 0));
+  TEST_ASSERT_EQUAL(6, tsynth.instrument_number(0, 1));
+
+  // Unrouted channels keep their program for when they are routed
+  tsynth.handle(MidiChannelMessage::program_change(2, 8), 0_ms);
+  TEST_ASSERT_EQUAL(8, tsynth.instrument_number(0, 2));
+  TEST_ASSERT_EQUAL(2, voice.started().size());
+}
+
+void test_bank_instruments_outlive_their_notes(void) {
+  std::vector<uint8_t> file;
+  const auto header = bank::encode_header(100);
+  file.insert(file.end(), header.begin(), header.end());
+  for (auto i = 0; i < 100; i++) {
+    const auto record = bank::encode(instrument(i % 10));
+    file.insert(file.end(), record.begin(), record.end());
+  }
+  InstrumentBank instruments;
+  TEST_ASSERT_TRUE(
+      instruments.open([&](uint32_t offset, uint8_t *data, size_t len) {
+        std::memcpy(data, file.data() + offset, len);
+        return true;
+      }));
+
+  Teslasynth<1, FakeNotes> tsynth;
+  tsynth.use_instruments(instruments);
+  auto &voice = tsynth.voice();
+  handle_reading(tsynth, MidiChannelMessage::program_change(0, 7), 0_ms);
+  handle_reading(tsynth, MidiChannelMessage::note_on(0, 69, 127), 0_ms);
+  const Instrument *playing = voice.started().back().playing;
+
+  // Many more programs than the bank caches, on every part
+  for (auto i = 0; i < 100; i++)
+    handle_reading(tsynth, MidiChannelMessage::program_change(i % 16, i), 0_ms);
+  assert_instrument_equal(*playing, instrument(7));
+  TEST_ASSERT_EQUAL(99, tsynth.instrument_number(0, 3));
+  assert_instrument_equal(tsynth.instrument(0, 3), instrument(9));
+}
+
+void test_bank_keeps_the_instruments_used_last(void) {
+  std::vector<uint8_t> file;
+  const auto header = bank::encode_header(100);
+  file.insert(file.end(), header.begin(), header.end());
+  for (auto i = 0; i < 100; i++) {
+    const auto record = bank::encode(instrument(i % 10));
+    file.insert(file.end(), record.begin(), record.end());
+  }
+  InstrumentBank instruments;
+  TEST_ASSERT_TRUE(
+      instruments.open([&](uint32_t offset, uint8_t *data, size_t len) {
+        std::memcpy(data, file.data() + offset, len);
+        return true;
+      }));
+
+  Teslasynth<1, FakeNotes> tsynth;
+  tsynth.use_instruments(instruments);
+  auto &voice = tsynth.voice();
+
+  // Parts without notes give their instrument up, and read it again
+  for (auto i = 0; i < 8; i++)
+    handle_reading(tsynth, MidiChannelMessage::program_change(i, i + 1), 0_ms);
+  TEST_ASSERT_EQUAL(8, instruments.loads());
+  handle_reading(tsynth, MidiChannelMessage::note_on(0, 60, 127), 0_ms);
+  TEST_ASSERT_EQUAL(9, instruments.loads());
+  assert_instrument_equal(voice.started().back().instrument, instrument(1));
+  const Instrument *playing = voice.started().back().playing;
+
+  // Once every instrument it keeps is playing, the default plays instead
+  for (auto i = 0; i < 8; i++) {
+    handle_reading(tsynth, MidiChannelMessage::program_change(0, 20 + i),
+                   0_ms);
+    handle_reading(tsynth, MidiChannelMessage::note_on(0, 61 + i, 127), 0_ms);
+  }
+  TEST_ASSERT_TRUE(voice.started().back().instrument == default_instrument());
+  assert_instrument_equal(*playing, instrument(1));
+}
+
+void test_should_switch_mono_mode_and_portamento(void) {
+  Configuration<1> config;
+  config.channel(0).voice_mode = VoiceMode::High;
+  Teslasynth<1, FakeNotes> tsynth(config);
+  auto &voice = tsynth.voice();
+  TEST_ASSERT_TRUE(voice.modes().back() == VoiceMode::High);
+
+  tsynth.handle(MidiChannelMessage::control_change(
+                    0, ControlChange::POLY_MODE_ON, 0),
+                0_ms);
+  TEST_ASSERT_TRUE(voice.modes().back() == VoiceMode::Poly);
+  TEST_ASSERT_EQUAL(1, voice.turned_off().size());
+  // Mono mode keeps the configured priority
+  tsynth.handle(MidiChannelMessage::control_change(
+                    0, ControlChange::MONO_MODE_ON, 1),
+                0_ms);
+  TEST_ASSERT_TRUE(voice.modes().back() == VoiceMode::High);
+
+  // The mode switched to outlives a reload, with the new priority
+  config.channel(0).voice_mode = VoiceMode::Low;
+  tsynth.reload_config(config);
+  TEST_ASSERT_TRUE(voice.modes().back() == VoiceMode::Low);
+  tsynth.handle(MidiChannelMessage::control_change(
+                    0, ControlChange::POLY_MODE_ON, 0),
+                0_ms);
+  tsynth.reload_config(config);
+  TEST_ASSERT_TRUE(voice.modes().back() == VoiceMode::Poly);
+
+  tsynth.handle(MidiChannelMessage::control_change(
+                    0, ControlChange::PORTAMENTO_SWITCH, 127),
+                0_ms);
+  TEST_ASSERT_TRUE(voice.portamentos().back());
+  tsynth.handle(MidiChannelMessage::control_change(
+                    0, ControlChange::PORTAMENTO_TIME_MSB, 64),
+                0_ms);
+  assert_duration_equal(voice.glides().back(), 1024_ms);
+  tsynth.handle(MidiChannelMessage::control_change(
+                    0, ControlChange::RESET_ALL_CONTROLLERS, 0),
+                0_ms);
+  TEST_ASSERT_FALSE(voice.portamentos().back());
+}
+
+void test_should_apply_velocity_curve_of_each_output(void) {
+  Configuration<2> config;
+  config.channel(1).velocity = {.type = VelocityCurveType::Fixed,
+                                .fixed = 64};
+  Teslasynth<2, FakeNotes> tsynth(config);
+  TEST_ASSERT_TRUE(tsynth.voice(0).velocities().back() == VelocityCurve{});
+  TEST_ASSERT_TRUE(tsynth.voice(1).velocities().back() ==
+                   config.channel(1).velocity);
+
+  config.channel(0).velocity.type = VelocityCurveType::Linear;
+  tsynth.reload_config(config);
+  TEST_ASSERT_TRUE(tsynth.voice(0).velocities().back().type ==
+                   VelocityCurveType::Linear);
+}
+
+void test_should_follow_tempo_of_midi_clock(void) {
+  Teslasynth<2, FakeNotes> tsynth;
+  TEST_ASSERT_EQUAL_FLOAT(120, tsynth.tempo());
+
+  // 24 clocks per beat, half a second per beat
+  Duration time = 1_s;
+  for (int i = 0; i < 24; i++, time += Duration::micros(20833))
+    tsynth.clock(time);
+  TEST_ASSERT_TRUE(tsynth.voice(0).tempos().empty());
+  tsynth.clock(1_s + 500_ms);
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 120, tsynth.tempo());
+  for (uint8_t i = 0; i < 2; i++)
+    TEST_ASSERT_FLOAT_WITHIN(0.01, 120, tsynth.voice(i).tempos().back());
+
+  for (int i = 1; i <= 24; i++)
+    tsynth.clock(1_s + Duration::micros(500000 + 25000 * i));
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 100, tsynth.tempo());
+
+  // Clocks stopped, the next beat is measured from the first clock after
+  tsynth.clock(10_s);
+  for (int i = 1; i <= 24; i++)
+    tsynth.clock(10_s + Duration::micros(i * 10000));
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 250, tsynth.tempo());
+}
+
 void test_should_turnoff_when_needed(void) {
   const std::vector<ControlChange> cc_event_types{
       ControlChange::ALL_SOUND_OFF,
@@ -256,6 +633,328 @@ void test_reload_config_should_adjust_note_sizes(void) {
   TEST_ASSERT_EQUAL(2, voice.adjusted().back());
 }
 
+void test_reload_config_should_keep_playing(void) {
+  Teslasynth<1, FakeNotes> tsynth;
+  auto &track = tsynth.track();
+  auto &voice = tsynth.voice();
+  tsynth.note_on(0, 69, 127, 1_s);
+  TEST_ASSERT_TRUE(track.is_playing());
+
+  Configuration<> config;
+  config.channel(0).notes = 2;
+  config.channel(0).max_on_time = 50_us;
+  tsynth.reload_config(config);
+
+  TEST_ASSERT_TRUE(track.is_playing());
+  TEST_ASSERT_EQUAL(0, voice.turned_off().size());
+  TEST_ASSERT_EQUAL(2, voice.adjusted().back());
+  assert_duration_equal(tsynth.configuration().channel(0).max_on_time, 50_us);
+}
+
+void test_should_bend_notes(void) {
+  Teslasynth<1, FakeNotes> tsynth;
+  auto &voice = tsynth.voice();
+  tsynth.handle(MidiChannelMessage::pitch_bend(0, 0), 0_ms);
+  TEST_ASSERT_EQUAL(Note::bend_unity, voice.bends().back());
+
+  // Two semitones up by default
+  tsynth.handle(MidiChannelMessage::pitch_bend(0, 8191), 0_ms);
+  TEST_ASSERT_EQUAL(58387, voice.bends().back());
+  tsynth.handle(MidiChannelMessage::pitch_bend(0, -8192), 0_ms);
+  TEST_ASSERT_EQUAL(73562, voice.bends().back());
+  TEST_ASSERT_EQUAL(3, voice.bends().size());
+
+  // Other channels are left alone
+  tsynth.handle(MidiChannelMessage::pitch_bend(1, 100), 0_ms);
+  TEST_ASSERT_EQUAL(3, voice.bends().size());
+}
+
+void test_should_set_bend_range_with_rpn(void) {
+  Teslasynth<1, FakeNotes> tsynth;
+  auto &voice = tsynth.voice();
+  auto cc = [&](ControlChange number, uint8_t value) {
+    tsynth.handle(MidiChannelMessage::control_change(0, number, value), 0_ms);
+  };
+  tsynth.handle(MidiChannelMessage::pitch_bend(0, -8192), 0_ms);
+
+  // Data entry without a selected parameter is ignored
+  cc(ControlChange::DATA_ENTRY_MSB, 12);
+  TEST_ASSERT_EQUAL(PitchBend::default_range, tsynth.pitch_bend(0).range());
+
+  cc(ControlChange::RPN_MSB, 0);
+  cc(ControlChange::RPN_LSB, 0);
+  cc(ControlChange::DATA_ENTRY_MSB, 12);
+  TEST_ASSERT_EQUAL(1200, tsynth.pitch_bend(0).range());
+  TEST_ASSERT_EQUAL(2 * Note::bend_unity, voice.bends().back());
+  cc(ControlChange::DATA_ENTRY_LSB, 50);
+  TEST_ASSERT_EQUAL(1250, tsynth.pitch_bend(0).range());
+
+  cc(ControlChange::NRPN_MSB, 0);
+  cc(ControlChange::DATA_ENTRY_MSB, 1);
+  TEST_ASSERT_EQUAL(1250, tsynth.pitch_bend(0).range());
+
+  cc(ControlChange::RESET_ALL_CONTROLLERS, 0);
+  TEST_ASSERT_EQUAL(0, tsynth.pitch_bend(0).value());
+  TEST_ASSERT_EQUAL(Note::bend_unity, voice.bends().back());
+}
+
+void test_should_handle_pedals(void) {
+  Teslasynth<1, FakeNotes> tsynth;
+  auto &voice = tsynth.voice();
+  auto cc = [&](ControlChange number, uint8_t value) {
+    tsynth.handle(MidiChannelMessage::control_change(0, number, value), 0_ms);
+  };
+  cc(ControlChange::DAMPER_PEDAL, 127);
+  cc(ControlChange::DAMPER_PEDAL, 10);
+  cc(ControlChange::SOSTENUTO_SWITCH, 64);
+  TEST_ASSERT_FALSE(tsynth.track().is_playing());
+  TEST_ASSERT_EQUAL(2, voice.sustains().size());
+  TEST_ASSERT_TRUE(voice.sustains()[0]);
+  TEST_ASSERT_FALSE(voice.sustains()[1]);
+  TEST_ASSERT_EQUAL(1, voice.sostenutos().size());
+  TEST_ASSERT_TRUE(voice.sostenutos()[0]);
+
+  cc(ControlChange::RESET_ALL_CONTROLLERS, 0);
+  TEST_ASSERT_FALSE(voice.sustains().back());
+  TEST_ASSERT_FALSE(voice.sostenutos().back());
+}
+
+void test_should_modulate_vibrato_once_per_window(void) {
+  Teslasynth<1, FakeNotes> tsynth;
+  auto &voice = tsynth.voice();
+  const size_t before = voice.vibratos().size();
+  tsynth.handle(
+      MidiChannelMessage::control_change(0, ControlChange::MODULATION_MSB, 127),
+      0_ms);
+  TEST_ASSERT_EQUAL(before, voice.vibratos().size());
+
+  for (auto i = 0; i < 50; i++)
+    tsynth.modulate();
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 1, voice.vibratos().back().first);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 4, voice.vibratos().back().second);
+
+  // Nothing left to apply once settled
+  const size_t settled = voice.vibratos().size();
+  tsynth.modulate();
+  TEST_ASSERT_EQUAL(settled, voice.vibratos().size());
+}
+
+void test_should_scale_envelope_of_new_notes(void) {
+  Teslasynth<1, FakeNotes> tsynth;
+  auto &voice = tsynth.voice();
+  tsynth.handle(
+      MidiChannelMessage::control_change(0, ControlChange::ATTACK_TIME, 96),
+      0_ms);
+  tsynth.handle(
+      MidiChannelMessage::control_change(0, ControlChange::RELEASE_TIME, 32),
+      0_ms);
+  for (auto i = 0; i < 50; i++)
+    tsynth.modulate();
+
+  // Notes play the instrument itself, the voice scales their envelopes
+  tsynth.handle(MidiChannelMessage::note_on(0, 69, 127), 0_ms);
+  const auto &started = voice.started().back();
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 2, started.controllers.attack);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 0.5f, started.controllers.release);
+  TEST_ASSERT_TRUE(started.playing == &default_instrument());
+}
+
+void test_should_apply_aftertouch(void) {
+  Teslasynth<1, FakeNotes> tsynth;
+  auto &voice = tsynth.voice();
+  tsynth.handle(MidiChannelMessage::after_touch(0, 69, 127), 0_ms);
+  TEST_ASSERT_EQUAL(1, voice.pressures().size());
+  TEST_ASSERT_EQUAL(69, voice.pressures().back().first);
+  assert_level_equal(voice.pressures().back().second, EnvelopeLevel::max());
+
+  tsynth.handle(MidiChannelMessage::after_touch_channel(0, 63), 0_ms);
+  TEST_ASSERT_EQUAL(128, voice.pressures().back().first);
+  assert_level_equal(voice.pressures().back().second, EnvelopeLevel(7.f / 8));
+
+  tsynth.handle(MidiChannelMessage::after_touch_channel(1, 63), 0_ms);
+  TEST_ASSERT_EQUAL(2, voice.pressures().size());
+
+  tsynth.handle(MidiChannelMessage::control_change(
+                    0, ControlChange::RESET_ALL_CONTROLLERS, 0),
+                0_ms);
+  TEST_ASSERT_TRUE(voice.pressures().back().second.is_zero());
+}
+
+void test_should_configure_mpe_zone_with_rpn_6(void) {
+  Teslasynth<2, FakeNotes> tsynth;
+  auto cc = [&](uint8_t ch, ControlChange number, uint8_t value) {
+    tsynth.handle(MidiChannelMessage::control_change(ch, number, value),
+                  0_ms);
+  };
+  cc(0, ControlChange::RPN_LSB, 6);
+  cc(0, ControlChange::RPN_MSB, 0);
+  cc(0, ControlChange::DATA_ENTRY_MSB, 3);
+  TEST_ASSERT_EQUAL(3, tsynth.mpe().members(Mpe::Lower));
+  // Data entry of the configuration message isn't a bend range
+  TEST_ASSERT_EQUAL(PitchBend::default_range, tsynth.pitch_bend(0).range());
+
+  cc(15, ControlChange::RPN_LSB, 6);
+  cc(15, ControlChange::RPN_MSB, 0);
+  cc(15, ControlChange::DATA_ENTRY_MSB, 2);
+  TEST_ASSERT_EQUAL(2, tsynth.mpe().members(Mpe::Upper));
+
+  // Upper zone plays on the last output
+  tsynth.handle(MidiChannelMessage::note_on(14, 60, 100), 0_ms);
+  TEST_ASSERT_EQUAL(0, tsynth.voice(0).started().size());
+  TEST_ASSERT_EQUAL(1, tsynth.voice(1).started().size());
+}
+
+void test_should_apply_mpe_expression_per_note(void) {
+  Teslasynth<1, FakeNotes> tsynth;
+  auto &voice = tsynth.voice();
+  tsynth.mpe().configure(Mpe::Lower, 15);
+
+  // Expression sent before the note applies from its start
+  tsynth.handle(MidiChannelMessage::pitch_bend(2, 8191), 0_ms);
+  tsynth.handle(MidiChannelMessage::note_on(2, 60, 100), 0_ms);
+  tsynth.handle(MidiChannelMessage::note_on(3, 64, 100), 0_ms);
+  TEST_ASSERT_EQUAL(2, voice.started().size());
+  const NoteExpression first = voice.started()[0].expression;
+  const NoteExpression second = voice.started()[1].expression;
+  TEST_ASSERT_TRUE(first.bend < Note::bend_unity / 15);
+  TEST_ASSERT_EQUAL(Note::bend_unity, second.bend);
+  TEST_ASSERT_TRUE(second.pressure->is_zero());
+  TEST_ASSERT_EQUAL_FLOAT(1, second.timbre);
+
+  tsynth.handle(MidiChannelMessage::pitch_bend(3, -8192), 0_ms);
+  TEST_ASSERT_EQUAL(64, voice.note_bends().back().first);
+  TEST_ASSERT_EQUAL(Note::bend_unity * 16, voice.note_bends().back().second);
+  tsynth.handle(MidiChannelMessage::after_touch_channel(2, 127), 0_ms);
+  TEST_ASSERT_EQUAL(60, voice.pressures().back().first);
+  tsynth.handle(MidiChannelMessage::control_change(
+                    3, ControlChange::BRIGHTNESS, 96),
+                0_ms);
+  TEST_ASSERT_EQUAL(64, voice.timbres().back().first);
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 2, voice.timbres().back().second);
+
+  // The master channel still bends the whole zone
+  tsynth.handle(MidiChannelMessage::pitch_bend(0, 0), 0_ms);
+  TEST_ASSERT_EQUAL(Note::bend_unity, voice.bends().back());
+
+  tsynth.handle(MidiChannelMessage::note_off(2, 60, 0), 0_ms);
+  TEST_ASSERT_EQUAL(60, voice.released().back().mnote);
+  TEST_ASSERT_EQUAL(2, voice.released().back().channel);
+}
+
+void test_mpe_members_on_the_same_note_stay_apart(void) {
+  Teslasynth<1, FakeNotes> tsynth;
+  auto &voice = tsynth.voice();
+  tsynth.mpe().configure(Mpe::Lower, 15);
+
+  tsynth.handle(MidiChannelMessage::note_on(2, 60, 100), 0_ms);
+  tsynth.handle(MidiChannelMessage::note_on(3, 60, 100), 0_ms);
+  TEST_ASSERT_EQUAL(2, voice.started()[0].channel);
+  TEST_ASSERT_EQUAL(3, voice.started()[1].channel);
+
+  // Expression finds the note by its member channel, not the note number
+  tsynth.handle(MidiChannelMessage::pitch_bend(2, 0), 0_ms);
+  tsynth.handle(MidiChannelMessage::after_touch_channel(3, 127), 0_ms);
+  tsynth.handle(MidiChannelMessage::control_change(
+                    2, ControlChange::BRIGHTNESS, 96),
+                0_ms);
+  TEST_ASSERT_EQUAL(3, voice.note_channels().size());
+  TEST_ASSERT_EQUAL(2, voice.note_channels()[0]);
+  TEST_ASSERT_EQUAL(3, voice.note_channels()[1]);
+  TEST_ASSERT_EQUAL(2, voice.note_channels()[2]);
+
+  tsynth.handle(MidiChannelMessage::note_off(3, 60, 0), 0_ms);
+  TEST_ASSERT_EQUAL(3, voice.released().back().channel);
+}
+
+void test_should_route_midi_channels_to_outputs(void) {
+  Configuration<2> config;
+  config.route(0, 0).enabled = false;
+  config.route(9, 0) = {.enabled = true, .transpose = 12};
+  config.route(9, 1) = {.enabled = true, .transpose = -3, .velocity = 50};
+  Teslasynth<2, FakeNotes> tsynth(config);
+  auto &out0 = tsynth.voice(0);
+  auto &out1 = tsynth.voice(1);
+
+  tsynth.handle(MidiChannelMessage::note_on(0, 60, 100), 0_ms);
+  TEST_ASSERT_EQUAL(0, out0.started().size());
+
+  tsynth.handle(MidiChannelMessage::note_on(9, 60, 100), 0_ms);
+  TEST_ASSERT_EQUAL(1, out0.started().size());
+  TEST_ASSERT_EQUAL(72, out0.started().back().mnote.number);
+  TEST_ASSERT_EQUAL(100, out0.started().back().mnote.velocity);
+  TEST_ASSERT_EQUAL(1, out1.started().size());
+  TEST_ASSERT_EQUAL(57, out1.started().back().mnote.number);
+  TEST_ASSERT_EQUAL(50, out1.started().back().mnote.velocity);
+
+  // Scaled velocities never turn into a note off
+  tsynth.handle(MidiChannelMessage::note_on(9, 61, 1), 0_ms);
+  TEST_ASSERT_EQUAL(1, out1.started().back().mnote.velocity);
+
+  tsynth.handle(MidiChannelMessage::note_off(9, 60, 0), 0_ms);
+  TEST_ASSERT_EQUAL(72, out0.released().back().mnote);
+  TEST_ASSERT_EQUAL(57, out1.released().back().mnote);
+
+  // Notes transposed out of range are dropped
+  tsynth.handle(MidiChannelMessage::note_on(9, 120, 100), 0_ms);
+  TEST_ASSERT_EQUAL(2, out0.started().size());
+  TEST_ASSERT_EQUAL(3, out1.started().size());
+
+  // Channel messages reach every output of the channel
+  tsynth.handle(MidiChannelMessage::pitch_bend(9, 8191), 0_ms);
+  TEST_ASSERT_EQUAL(58387, out0.bends().back());
+  TEST_ASSERT_EQUAL(58387, out1.bends().back());
+}
+
+void test_parts_on_one_output_keep_their_controllers(void) {
+  Configuration<1> config;
+  config.route(1, 0).enabled = true;
+  Teslasynth<1, FakeNotes> tsynth(config);
+  auto &voice = tsynth.voice();
+  auto cc = [&](uint8_t part, ControlChange number, uint8_t value) {
+    tsynth.handle(MidiChannelMessage::control_change(part, number, value),
+                  0_ms);
+  };
+
+  // Interleaved parameter numbers of two parts don't mix
+  cc(0, ControlChange::RPN_MSB, 0);
+  cc(1, ControlChange::RPN_MSB, 127);
+  cc(0, ControlChange::RPN_LSB, 0);
+  cc(1, ControlChange::RPN_LSB, 127);
+  cc(0, ControlChange::DATA_ENTRY_MSB, 12);
+  cc(1, ControlChange::DATA_ENTRY_MSB, 24);
+  TEST_ASSERT_EQUAL(1200, tsynth.pitch_bend(0).range());
+  TEST_ASSERT_EQUAL(PitchBend::default_range, tsynth.pitch_bend(1).range());
+
+  // Bend and pedals only reach the notes of their own part
+  tsynth.handle(MidiChannelMessage::pitch_bend(1, 8191), 0_ms);
+  TEST_ASSERT_EQUAL(58387, voice.bends().back());
+  TEST_ASSERT_EQUAL(1 << 1, voice.channels().back());
+  cc(0, ControlChange::DAMPER_PEDAL, 127);
+  TEST_ASSERT_TRUE(voice.sustains().back());
+  TEST_ASSERT_EQUAL(1 << 0, voice.channels().back());
+  TEST_ASSERT_EQUAL(0, tsynth.pitch_bend(0).value());
+
+  // Notes start with the controllers of their part
+  tsynth.handle(MidiChannelMessage::note_on(1, 60, 100), 0_ms);
+  TEST_ASSERT_EQUAL(1, voice.started().back().channel);
+  TEST_ASSERT_EQUAL(58387, voice.started().back().controllers.bend);
+  tsynth.handle(MidiChannelMessage::note_on(0, 60, 100), 0_ms);
+  TEST_ASSERT_EQUAL(Note::bend_unity,
+                    voice.started().back().controllers.bend);
+}
+
+void test_unrouted_channels_still_stop_everything(void) {
+  Teslasynth<1, FakeNotes> tsynth;
+  tsynth.handle(MidiChannelMessage::note_on(0, 60, 100), 0_ms);
+  tsynth.handle(MidiChannelMessage::note_on(5, 60, 100), 0_ms);
+  TEST_ASSERT_EQUAL(1, tsynth.voice().started().size());
+  tsynth.handle(MidiChannelMessage::control_change(
+                    5, ControlChange::ALL_NOTES_OFF, 0),
+                0_ms);
+  TEST_ASSERT_FALSE(tsynth.track().is_playing());
+  TEST_ASSERT_EQUAL(1, tsynth.voice().turned_off().size());
+}
+
 extern "C" void app_main(void) {
   UNITY_BEGIN();
   RUN_TEST(test_note_pulse_empty);
@@ -267,11 +966,32 @@ extern "C" void app_main(void) {
   RUN_TEST(test_should_ignore_instrument_change_when_config_has_instrument);
   RUN_TEST(test_config_instrument_overrides_runtime_instrument);
   RUN_TEST(test_non_existing_instrument_number_falls_back_to_default);
+  RUN_TEST(test_should_load_instruments_from_bank);
+  RUN_TEST(test_bank_is_read_before_messages_are_handled);
+  RUN_TEST(test_should_play_a_program_per_channel);
+  RUN_TEST(test_bank_instruments_outlive_their_notes);
+  RUN_TEST(test_bank_keeps_the_instruments_used_last);
+  RUN_TEST(test_should_switch_mono_mode_and_portamento);
+  RUN_TEST(test_should_apply_velocity_curve_of_each_output);
+  RUN_TEST(test_should_follow_tempo_of_midi_clock);
   RUN_TEST(test_should_turnoff_when_needed);
   RUN_TEST(test_should_start_playing_the_first_note_on_message);
   RUN_TEST(test_should_ignore_off_messages_when_not_playing);
   RUN_TEST(test_should_adjust_note_sizes);
   RUN_TEST(test_reload_config_should_adjust_note_sizes);
+  RUN_TEST(test_reload_config_should_keep_playing);
+  RUN_TEST(test_should_bend_notes);
+  RUN_TEST(test_should_set_bend_range_with_rpn);
+  RUN_TEST(test_should_handle_pedals);
+  RUN_TEST(test_should_modulate_vibrato_once_per_window);
+  RUN_TEST(test_should_scale_envelope_of_new_notes);
+  RUN_TEST(test_should_apply_aftertouch);
+  RUN_TEST(test_should_configure_mpe_zone_with_rpn_6);
+  RUN_TEST(test_should_apply_mpe_expression_per_note);
+  RUN_TEST(test_mpe_members_on_the_same_note_stay_apart);
+  RUN_TEST(test_should_route_midi_channels_to_outputs);
+  RUN_TEST(test_parts_on_one_output_keep_their_controllers);
+  RUN_TEST(test_unrouted_channels_still_stop_everything);
 
   UNITY_END();
 }
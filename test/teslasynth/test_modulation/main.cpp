@@ -0,0 +1,96 @@
+#include "midi_core.hpp"
+#include "modulation.hpp"
+#include <cstdint>
+#include <unity.h>
+
+using namespace teslasynth::midisynth;
+
+static void settle(ModulationMatrix &mod) {
+  for (auto i = 0; i < 100 && mod.smooth(); i++)
+    ;
+}
+
+void test_defaults_leave_targets_unchanged(void) {
+  ModulationMatrix mod;
+  for (auto value : mod.values())
+    TEST_ASSERT_EQUAL_FLOAT(1, value);
+  TEST_ASSERT_FALSE(mod.smooth());
+}
+
+void test_should_smooth_towards_controller(void) {
+  ModulationMatrix mod;
+  TEST_ASSERT_TRUE(mod.control_change(ControlChange::CHANNEL_VOLUME_MSB, 64));
+  TEST_ASSERT_TRUE(mod.smooth());
+  const float first = mod.value(ModTarget::Gain);
+  TEST_ASSERT_TRUE(first < 1);
+  TEST_ASSERT_TRUE(first > 64 / 127.f);
+
+  settle(mod);
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 64 / 127.f, mod.value(ModTarget::Gain));
+  TEST_ASSERT_FALSE(mod.smooth());
+}
+
+void test_curves(void) {
+  ModulationMatrix mod;
+  mod.control_change(ControlChange::ATTACK_TIME, 127);
+  mod.control_change(ControlChange::RELEASE_TIME, 0);
+  mod.control_change(ControlChange::MODULATION_MSB, 127);
+  settle(mod);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 3.91f, mod.value(ModTarget::Attack));
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 0.25f, mod.value(ModTarget::Release));
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 4, mod.value(ModTarget::VibratoDepth));
+}
+
+void test_routes_to_the_same_target_multiply(void) {
+  ModulationMatrix mod;
+  mod.control_change(ControlChange::MODULATION_MSB, 127);
+  mod.control_change(ControlChange::VIBRATO_DEPTH, 32);
+  settle(mod);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 2, mod.value(ModTarget::VibratoDepth));
+}
+
+void test_unrouted_controllers_are_ignored(void) {
+  ModulationMatrix mod;
+  TEST_ASSERT_FALSE(mod.control_change(ControlChange::PAN_MSB, 0));
+  TEST_ASSERT_FALSE(mod.smooth());
+}
+
+void test_reset(void) {
+  ModulationMatrix mod;
+  mod.control_change(ControlChange::CHANNEL_VOLUME_MSB, 0);
+  settle(mod);
+  TEST_ASSERT_EQUAL_FLOAT(0, mod.value(ModTarget::Gain));
+  mod.reset();
+  settle(mod);
+  TEST_ASSERT_EQUAL_FLOAT(1, mod.value(ModTarget::Gain));
+}
+
+void test_custom_routes(void) {
+  ModulationMatrix mod;
+  mod.clear();
+  TEST_ASSERT_FALSE(mod.control_change(ControlChange::CHANNEL_VOLUME_MSB, 0));
+  TEST_ASSERT_TRUE(mod.route(
+      {ControlChange::EXPRESSION_MSB, ModTarget::Gain, ModCurve::Level}));
+  mod.control_change(ControlChange::EXPRESSION_MSB, 0);
+  settle(mod);
+  TEST_ASSERT_EQUAL_FLOAT(0, mod.value(ModTarget::Gain));
+
+  const ModRoute route{ControlChange::GENERAL_PURPOSE_1, ModTarget::Gain,
+                       ModCurve::Level};
+  for (size_t i = 1; i < ModulationMatrix::max_routes; i++)
+    TEST_ASSERT_TRUE(mod.route(route));
+  TEST_ASSERT_FALSE(mod.route(route));
+}
+
+extern "C" void app_main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_defaults_leave_targets_unchanged);
+  RUN_TEST(test_should_smooth_towards_controller);
+  RUN_TEST(test_curves);
+  RUN_TEST(test_routes_to_the_same_target_multiply);
+  RUN_TEST(test_unrouted_controllers_are_ignored);
+  RUN_TEST(test_reset);
+  RUN_TEST(test_custom_routes);
+  UNITY_END();
+}
+int main(int argc, char **argv) { app_main(); }
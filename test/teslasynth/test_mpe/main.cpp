@@ -0,0 +1,83 @@
+#include "midi_core.hpp"
+#include "mpe.hpp"
+#include <cstdint>
+#include <unity.h>
+
+using namespace teslasynth::midisynth;
+
+void test_disabled_by_default(void) {
+  Mpe mpe;
+  TEST_ASSERT_FALSE(mpe.is_enabled());
+  for (uint8_t ch = 0; ch < Mpe::channels; ch++)
+    TEST_ASSERT_TRUE(mpe.channel(ch).role == Mpe::Role::None);
+}
+
+void test_lower_zone(void) {
+  Mpe mpe;
+  mpe.configure(Mpe::Lower, 3);
+  TEST_ASSERT_TRUE(mpe.is_enabled());
+  TEST_ASSERT_TRUE(mpe.channel(0).role == Mpe::Role::Master);
+  for (uint8_t ch = 1; ch <= 3; ch++) {
+    TEST_ASSERT_TRUE(mpe.channel(ch).role == Mpe::Role::Member);
+    TEST_ASSERT_EQUAL(Mpe::member_range, mpe.channel(ch).bend.range());
+  }
+  TEST_ASSERT_TRUE(mpe.channel(4).role == Mpe::Role::None);
+}
+
+void test_upper_zone(void) {
+  Mpe mpe;
+  mpe.output(Mpe::Upper, 2);
+  mpe.configure(Mpe::Upper, 2);
+  TEST_ASSERT_TRUE(mpe.channel(15).role == Mpe::Role::Master);
+  TEST_ASSERT_TRUE(mpe.channel(14).role == Mpe::Role::Member);
+  TEST_ASSERT_TRUE(mpe.channel(13).role == Mpe::Role::Member);
+  TEST_ASSERT_TRUE(mpe.channel(12).role == Mpe::Role::None);
+  TEST_ASSERT_EQUAL(2, mpe.channel(13).output);
+  TEST_ASSERT_TRUE(mpe.channel(13).zone == Mpe::Upper);
+}
+
+void test_zones_give_up_shared_channels(void) {
+  Mpe mpe;
+  mpe.configure(Mpe::Upper, 10);
+  mpe.configure(Mpe::Lower, 8);
+  TEST_ASSERT_EQUAL(6, mpe.members(Mpe::Upper));
+  TEST_ASSERT_TRUE(mpe.channel(9).role == Mpe::Role::Member);
+  TEST_ASSERT_TRUE(mpe.channel(9).zone == Mpe::Upper);
+  TEST_ASSERT_TRUE(mpe.channel(8).zone == Mpe::Lower);
+
+  mpe.configure(Mpe::Lower, 15);
+  TEST_ASSERT_EQUAL(0, mpe.members(Mpe::Upper));
+  TEST_ASSERT_TRUE(mpe.channel(15).role == Mpe::Role::Member);
+
+  mpe.configure(Mpe::Lower, 0);
+  TEST_ASSERT_FALSE(mpe.is_enabled());
+}
+
+void test_configuration_message(void) {
+  Mpe mpe;
+  TEST_ASSERT_FALSE(mpe.control_change(0, ControlChange::RPN_LSB, 6));
+  TEST_ASSERT_FALSE(mpe.control_change(0, ControlChange::RPN_MSB, 0));
+  TEST_ASSERT_TRUE(mpe.control_change(0, ControlChange::DATA_ENTRY_MSB, 5));
+  TEST_ASSERT_EQUAL(5, mpe.members(Mpe::Lower));
+
+  // Only master channels can configure zones
+  TEST_ASSERT_FALSE(mpe.control_change(3, ControlChange::RPN_LSB, 6));
+  TEST_ASSERT_FALSE(mpe.control_change(3, ControlChange::RPN_MSB, 0));
+  TEST_ASSERT_FALSE(mpe.control_change(3, ControlChange::DATA_ENTRY_MSB, 1));
+  TEST_ASSERT_EQUAL(5, mpe.members(Mpe::Lower));
+
+  TEST_ASSERT_FALSE(mpe.control_change(0, ControlChange::NRPN_MSB, 0));
+  TEST_ASSERT_FALSE(mpe.control_change(0, ControlChange::DATA_ENTRY_MSB, 1));
+  TEST_ASSERT_EQUAL(5, mpe.members(Mpe::Lower));
+}
+
+extern "C" void app_main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_disabled_by_default);
+  RUN_TEST(test_lower_zone);
+  RUN_TEST(test_upper_zone);
+  RUN_TEST(test_zones_give_up_shared_channels);
+  RUN_TEST(test_configuration_message);
+  UNITY_END();
+}
+int main(int argc, char **argv) { app_main(); }
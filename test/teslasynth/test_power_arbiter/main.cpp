@@ -0,0 +1,136 @@
+#include "core.hpp"
+#include "midi_synth.hpp"
+#include "synthesizer/helpers/assertions.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <unity.h>
+
+using namespace teslasynth::midisynth;
+
+constexpr SynthConfig power_config(uint8_t concurrent = 0) {
+  return {
+      .power_duty = DutyCycle(25),
+      .power_window = 10_ms,
+      .max_concurrent = concurrent,
+  };
+}
+
+struct Usage {
+  Duration on, total;
+  float duty() const { return on.ticks() / static_cast<float>(total.ticks()); }
+};
+
+// Plays a pulse train on each busy channel, idle ones only get silence
+template <uint8_t OUTPUTS>
+std::array<Usage, OUTPUTS> play(PowerArbiter<OUTPUTS> &arbiter,
+                                std::array<bool, OUTPUTS> busy,
+                                Duration32 length) {
+  std::array<Usage, OUTPUTS> usage{};
+  Instant now;
+  while (usage[0].total < length) {
+    for (uint8_t ch = 0; ch < OUTPUTS; ch++) {
+      Duration16 on = busy[ch] ? Duration16(100_us) : Duration16::zero();
+      if (arbiter.can_use(ch, now, on))
+        usage[ch].on += on;
+      usage[ch].total += 200_us;
+      arbiter.replenish(ch, 200_us);
+    }
+    now += 200_us;
+  }
+  return usage;
+}
+
+void test_unlimited_by_default(void) {
+  PowerArbiter<2> arbiter;
+  TEST_ASSERT_FALSE(arbiter.is_limited());
+  TEST_ASSERT_FALSE(PowerArbiter<2>(SynthConfig{}).is_limited());
+  auto usage = play(arbiter, {true, true}, Duration32::seconds(1));
+  TEST_ASSERT_EQUAL_FLOAT(0.5, usage[0].duty());
+  TEST_ASSERT_EQUAL_FLOAT(0.5, usage[1].duty());
+}
+
+void test_shares_budget_fairly(void) {
+  PowerArbiter<2> arbiter(power_config());
+  TEST_ASSERT_TRUE(arbiter.is_limited());
+  auto usage = play(arbiter, {true, true}, Duration32::seconds(1));
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 0.25, usage[0].duty());
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 0.25, usage[1].duty());
+  TEST_ASSERT_TRUE(arbiter.denied(0) > 0);
+  TEST_ASSERT_TRUE(arbiter.denied(1) > 0);
+}
+
+void test_idle_outputs_leave_budget_to_others(void) {
+  PowerArbiter<2> arbiter(power_config());
+  auto usage = play(arbiter, {true, false}, Duration32::seconds(1));
+  // Combined duty is half a coil at full duty, all of it goes to output 0
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 0.5, usage[0].duty());
+  TEST_ASSERT_EQUAL(0, arbiter.denied(1));
+}
+
+void test_limits_concurrent_outputs(void) {
+  PowerArbiter<3> arbiter(SynthConfig{.max_concurrent = 2});
+  TEST_ASSERT_FALSE(arbiter.is_limited());
+
+  const Instant t = 10_ms;
+  TEST_ASSERT_TRUE(arbiter.can_use(0, t, 100_us));
+  TEST_ASSERT_TRUE(arbiter.can_use(1, t + 50_us, 100_us));
+  TEST_ASSERT_FALSE(arbiter.can_use(2, t + 60_us, 100_us));
+  TEST_ASSERT_EQUAL(1, arbiter.denied(2));
+  // Output 0 is off by then
+  TEST_ASSERT_TRUE(arbiter.can_use(2, t + 100_us, 100_us));
+  TEST_ASSERT_TRUE(arbiter.can_use(0, t + 200_us, Duration16::zero()));
+}
+
+void test_concurrency_is_fair_across_channels(void) {
+  Teslasynth<2> tsynth(Configuration<2>(SynthConfig{
+      .a440 = 100_hz,
+      .max_concurrent = 1,
+  }));
+  PulseBuffer<2, 64> buffer;
+  tsynth.note_on(0, 69, 127, 0_ms);
+  tsynth.note_on(1, 69, 127, 0_ms);
+
+  Duration on0, on1;
+  for (auto i = 0; i < 100; i++) {
+    tsynth.sample_all(10_ms, buffer);
+    for (auto j = 0; j < buffer.data_size(0); j++)
+      on0 += buffer.at(0, j).on;
+    for (auto j = 0; j < buffer.data_size(1); j++)
+      on1 += buffer.at(1, j).on;
+  }
+  // Notes are in phase, only one of the outputs can play at a time
+  assert_duration_equal(on0 + on1, 100_us * 100);
+  assert_duration_equal(on0, on1);
+}
+
+void test_denied_long_pulses_keep_their_silence(void) {
+  // The pulse and its deadtime together don't fit in 16 bits
+  constexpr Config config{.max_on_time = 40_ms,
+                          .min_deadtime = 40_ms,
+                          .duty_window = 60_ms,
+                          .max_duty = DutyCycle(100)};
+  Teslasynth<2> tsynth(Configuration<2>(
+      SynthConfig{.a440 = 10_hz, .max_concurrent = 1}, {config, config}));
+  tsynth.note_on(0, 69, 127, 0_ms);
+  tsynth.note_on(1, 69, 127, 0_ms);
+
+  const Pulse played = tsynth.sample(0, Duration16::max());
+  TEST_ASSERT_FALSE(played.is_zero());
+  const Pulse denied = tsynth.sample(1, Duration16::max());
+  TEST_ASSERT_TRUE(denied.is_zero());
+  TEST_ASSERT_EQUAL(
+      std::min<uint32_t>(played.length().ticks(), Duration16::max().ticks()),
+      denied.off.ticks());
+}
+
+extern "C" void app_main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_unlimited_by_default);
+  RUN_TEST(test_shares_budget_fairly);
+  RUN_TEST(test_idle_outputs_leave_budget_to_others);
+  RUN_TEST(test_limits_concurrent_outputs);
+  RUN_TEST(test_concurrency_is_fair_across_channels);
+  RUN_TEST(test_denied_long_pulses_keep_their_silence);
+  UNITY_END();
+}
+int main(int argc, char **argv) { app_main(); }
@@ -0,0 +1,89 @@
+#include "core.hpp"
+#include "midi_synth.hpp"
+#include "pulse_output.hpp"
+#include "synthesizer/helpers/assertions.hpp"
+#include <cstdint>
+#include <unity.h>
+
+using namespace teslasynth::midisynth;
+
+constexpr Pulse pulse(uint16_t on, uint16_t off) {
+  return {.on = Duration16::micros(on), .off = Duration16::micros(off)};
+}
+
+void test_empty(void) {
+  RecordingOutput<2> output;
+  TEST_ASSERT_EQUAL(0, output.batches());
+  TEST_ASSERT_EQUAL(0, output.pulses(0).size());
+  TEST_ASSERT_EQUAL(0, output.stats(1).transactions);
+}
+
+void test_records_writes_per_channel(void) {
+  RecordingOutput<2> output;
+  const Pulse pulses[] = {pulse(10, 90), pulse(0, 100), pulse(20, 80)};
+  output.write(0, pulses, 3);
+  output.write(1, pulses, 1);
+  output.commit();
+
+  TEST_ASSERT_EQUAL(1, output.batches());
+  TEST_ASSERT_EQUAL(3, output.pulses(0).size());
+  TEST_ASSERT_EQUAL(1, output.pulses(1).size());
+  TEST_ASSERT_EQUAL(1, output.stats(0).transactions);
+  TEST_ASSERT_EQUAL(3, output.stats(0).pulses);
+  assert_duration_equal(output.stats(0).on, 30_us);
+  assert_duration_equal(output.stats(0).total, 300_us);
+  assert_duration_equal(output.stats(1).on, 10_us);
+}
+
+void test_empty_writes_are_not_transactions(void) {
+  RecordingOutput<1> output;
+  output.write(0, nullptr, 0);
+  output.commit();
+  TEST_ASSERT_EQUAL(1, output.batches());
+  TEST_ASSERT_EQUAL(0, output.stats(0).transactions);
+}
+
+void test_write_all_from_synth(void) {
+  Teslasynth<2> tsynth;
+  RecordingOutput<2> output;
+  PulseBuffer<2, 64> buffer;
+
+  tsynth.note_on(0, 69, 127, Duration::zero());
+  tsynth.note_on(1, 81, 127, Duration::zero());
+  for (auto i = 0; i < 10; i++) {
+    tsynth.sample_all(10_ms, buffer);
+    output.write_all(buffer);
+  }
+
+  TEST_ASSERT_EQUAL(10, output.batches());
+  for (uint8_t ch = 0; ch < 2; ch++) {
+    TEST_ASSERT_EQUAL(10, output.stats(ch).transactions);
+    TEST_ASSERT_TRUE(output.stats(ch).total >= 100_ms);
+    TEST_ASSERT_FALSE(output.stats(ch).on.is_zero());
+  }
+  // One octave higher, twice as many pulses
+  TEST_ASSERT_TRUE(output.stats(1).pulses > output.stats(0).pulses);
+}
+
+void test_clear(void) {
+  RecordingOutput<1> output;
+  const Pulse pulses[] = {pulse(10, 90)};
+  output.write(0, pulses, 1);
+  output.commit();
+  output.clear();
+  TEST_ASSERT_EQUAL(0, output.batches());
+  TEST_ASSERT_EQUAL(0, output.pulses().size());
+  assert_duration_equal(output.stats().total, 0_us);
+}
+
+extern "C" void app_main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_empty);
+  RUN_TEST(test_records_writes_per_channel);
+  RUN_TEST(test_empty_writes_are_not_transactions);
+  RUN_TEST(test_write_all_from_synth);
+  RUN_TEST(test_clear);
+  UNITY_END();
+}
+
+int main(int argc, char **argv) { app_main(); }
@@ -8,6 +8,7 @@
 #include "unity_internals.h"
 #include <cstdint>
 #include <unity.h>
+#include <vector>
 
 using namespace teslasynth::midisynth;
 
@@ -79,7 +80,7 @@ void test_should_sequence_empty_when_no_notes_are_playing(void) {
   }
 
   // Now there is no note playing
-  Duration time = track.played_time(0);
+  Instant time = track.played_time(0);
   for (auto i = 0; i < 64; i++) {
     auto step = Duration16::millis(i);
     auto pulse = tsynth.sample(0, step);
@@ -278,13 +279,227 @@ void test_must_not_exceed_duty_limit(void) {
   auto overall = PulseBufferOverview::from(buffer, 0);
   assert_duration_equal(overall.on, 100_us * 10);
   assert_duration_equal(overall.total(), 10_ms);
-  TEST_ASSERT_EQUAL(40, buffer.data_size(0));
+  TEST_ASSERT_EQUAL(20, buffer.data_size(0));
 
   tsynth.sample_all(10_ms, buffer);
   overall = PulseBufferOverview::from(buffer, 0);
   assert_duration_equal(overall.on, 100_us * 10);
   assert_duration_equal(overall.total(), 10_ms);
+  TEST_ASSERT_EQUAL(21, buffer.data_size(0));
+}
+
+void test_should_attenuate_instead_of_dropping_over_duty_limit(void) {
+  Configuration<> conf(
+      SynthConfig{.a440 = 2_khz},
+      {Config{.max_duty = DutyCycle(10), .duty_mode = DutyMode::LookAhead}});
+  Teslasynth<> tsynth(conf);
+  PulseBuffer<1, 64> buffer;
+
+  tsynth.note_on(0, 69, 127, 0_ms);
+  Duration on, total;
+  for (auto i = 0; i < 10; i++) {
+    tsynth.sample_all(10_ms, buffer);
+    auto overall = PulseBufferOverview::from(buffer, 0);
+    on += overall.on;
+    total += overall.total();
+  }
+  TEST_ASSERT_TRUE(on.ticks() <= total.ticks() / 10);
+  TEST_ASSERT_EQUAL(0, tsynth.duty_stats(0).dropped);
+  TEST_ASSERT_TRUE(tsynth.duty_stats(0).attenuated > 0);
+  TEST_ASSERT_TRUE(tsynth.duty_stats(0).attenuation() > 0.5);
+}
+
+void test_should_merge_silences(void) {
+  Configuration<> conf(SynthConfig{.a440 = 2_khz},
+                       {Config{.max_duty = DutyCycle(10)}});
+  Teslasynth<> tsynth(conf);
+  PulseBuffer<1, 64> buffer;
+
+  tsynth.note_on(0, 69, 127, 0_ms);
+  tsynth.note_off(0, 69, 10_ms);
+
+  // Limited pulses are silent, each run of them is a single idle pulse
+  tsynth.sample_all(10_ms, buffer);
+  for (auto i = 1; i < buffer.data_size(0); i++)
+    TEST_ASSERT_FALSE(buffer.at(0, i - 1).is_zero() &&
+                      buffer.at(0, i).is_zero());
+
+  tsynth.sample_all(50_ms, buffer);
+  TEST_ASSERT_EQUAL(1, buffer.data_size(0));
+  assert_duration_equal(buffer.at(0, 0).on, 0_us);
+  assert_duration_equal(buffer.at(0, 0).off, 50_ms);
+}
+
+void test_pulse_merge(void) {
+  Pulse idle{0_us, 10_ms};
+  TEST_ASSERT_TRUE(idle.merge({0_us, 5_ms}));
+  assert_duration_equal(idle.off, 15_ms);
+  TEST_ASSERT_FALSE(idle.merge({100_us, 100_us}));
+  TEST_ASSERT_FALSE(idle.merge({0_us, Duration16::max()}));
+  assert_duration_equal(idle.off, 15_ms);
+
+  Pulse pulse{100_us, 100_us};
+  TEST_ASSERT_FALSE(pulse.merge({0_us, 5_ms}));
+  assert_duration_equal(pulse.off, 100_us);
+}
+
+void test_should_render_window_in_chunks(void) {
+  Teslasynth<2> tsynth(SynthConfig{.a440 = 2_khz});
+  Teslasynth<2> reference(SynthConfig{.a440 = 2_khz});
+  PulseBuffer<2, 8> buffer;
+  PulseBuffer<2, 128> whole;
+
+  for (auto *synth : {&tsynth, &reference}) {
+    synth->note_on(0, 69, 127, 0_ms);
+    synth->note_on(1, 57, 127, 0_ms);
+  }
+  reference.sample_all(20_ms, whole);
+  auto expected0 = PulseBufferOverview::from(whole, 0);
+  auto expected1 = PulseBufferOverview::from(whole, 1);
+
+  RenderWindow<2> window(20_ms);
+  Duration on0, total0, on1, total1;
+  int chunks = 0;
+  bool done;
+  do {
+    done = tsynth.sample_chunk(window, buffer);
+    chunks++;
+    if (!done) {
+      TEST_ASSERT_TRUE(buffer.data_size(0) > 0);
+      TEST_ASSERT_TRUE(buffer.data_size(1) > 0);
+    }
+    auto ch0 = PulseBufferOverview::from(buffer, 0);
+    auto ch1 = PulseBufferOverview::from(buffer, 1);
+    on0 += ch0.on;
+    total0 += ch0.total();
+    on1 += ch1.on;
+    total1 += ch1.total();
+  } while (!done);
+
+  TEST_ASSERT_TRUE(chunks > 1);
+  assert_duration_equal(on0, expected0.on);
+  assert_duration_equal(total0, expected0.total());
+  assert_duration_equal(on1, expected1.on);
+  assert_duration_equal(total1, expected1.total());
+  assert_duration_equal(tsynth.track().played_time(0),
+                        reference.track().played_time(0));
+  assert_duration_equal(tsynth.track().played_time(1),
+                        reference.track().played_time(1));
+}
+
+void test_should_render_windows_longer_than_a_pulse(void) {
+  Teslasynth<> tsynth(sconf);
+  PulseBuffer<1, 64> buffer;
+
+  tsynth.note_on(0, 69, 127, 0_ms);
+  tsynth.sample_all(Duration32::millis(100), buffer);
+  auto overall = PulseBufferOverview::from(buffer, 0);
+  assert_duration_equal(overall.total(), Duration32::millis(100));
+  assert_duration_equal(overall.on, 100_us * 10);
+}
+
+void test_should_play_across_wraparound(void) {
+  Teslasynth<> tsynth(sconf);
+  auto &track = tsynth.track();
+  // 32 bits of microseconds wrap at about 71.6 minutes
+  const Duration wrap = Duration::ticks(1ull << 32);
+
+  tsynth.note_on(0, 69, 127, 0_ms);
+  tsynth.note_off(0, 69, 1_ms);
+
+  Duration played = Duration::zero();
+  while (played < *(wrap - 100_ms))
+    played += tsynth.sample(0, Duration16::max()).length();
+
+  tsynth.note_on(0, 69, 127, *(wrap - 30_ms));
+  int pulses = 0;
+  Duration last;
+  while (played < wrap + 70_ms) {
+    Pulse pulse = tsynth.sample(0, 10_ms);
+    if (!pulse.is_zero()) {
+      if (pulses++ > 0)
+        assert_duration_equal(*(played - last), 10_ms);
+      last = played;
+    }
+    played += pulse.length();
+    assert_duration_equal(track.played_time(0).extend(wrap), played);
+  }
+  TEST_ASSERT_EQUAL(10, pulses);
+  assert_duration_equal(last, wrap + 60_ms);
+}
+
+void test_must_respect_thermal_limit(void) {
+  Configuration<> conf(SynthConfig{.a440 = 2_khz},
+                       {Config{.thermal_time_constant = Millis16::millis(100),
+                               .thermal_duty = DutyCycle(10),
+                               .heat_model = HeatModel::Linear}});
+  Teslasynth<> tsynth(conf);
+  PulseBuffer<1, 64> buffer;
+
+  tsynth.note_on(0, 69, 127, 0_ms);
+  for (auto i = 0; i < 100; i++)
+    tsynth.sample_all(10_ms, buffer);
+
+  Duration on, total;
+  for (auto i = 0; i < 100; i++) {
+    tsynth.sample_all(10_ms, buffer);
+    auto overall = PulseBufferOverview::from(buffer, 0);
+    on += overall.on;
+    total += overall.total();
+  }
+  // Attenuated instead of dropped, all pulses are still there
   TEST_ASSERT_EQUAL(40, buffer.data_size(0));
+  TEST_ASSERT_TRUE(on.ticks() <= total.ticks() / 10);
+  TEST_ASSERT_TRUE(on.ticks() > total.ticks() / 20);
+}
+
+struct Firing {
+  uint64_t start, end;
+};
+
+// Plays two coincident notes on two outputs and collects when each fires
+std::array<std::vector<Firing>, 2> play_coincident(Micros16 stagger) {
+  Teslasynth<2> tsynth(SynthConfig{.a440 = 100_hz, .max_stagger = stagger});
+  PulseBuffer<2, 64> buffer;
+  std::array<std::vector<Firing>, 2> firings;
+  std::array<uint64_t, 2> now{};
+  tsynth.note_on(0, 69, 127, 0_ms);
+  tsynth.note_on(1, 69, 127, 0_ms);
+  for (auto i = 0; i < 100; i++) {
+    tsynth.sample_all(10_ms, buffer);
+    for (uint8_t ch = 0; ch < 2; ch++)
+      for (auto j = 0; j < buffer.data_size(ch); j++) {
+        const Pulse &p = buffer.at(ch, j);
+        if (!p.on.is_zero())
+          firings[ch].push_back({now[ch], now[ch] + p.on.ticks()});
+        now[ch] += p.length().ticks();
+      }
+  }
+  return firings;
+}
+
+void test_should_stagger_coincident_pulses(void) {
+  const Duration32 max = Duration32::micros(150);
+  auto firings = play_coincident(150_us);
+
+  TEST_ASSERT_EQUAL(firings[0].size(), firings[1].size());
+  TEST_ASSERT_TRUE(firings[0].size() >= 99);
+  for (size_t i = 0; i < firings[0].size(); i++) {
+    const Firing &a = firings[0][i], &b = firings[1][i];
+    TEST_ASSERT_TRUE(a.end <= b.start || b.end <= a.start);
+    TEST_ASSERT_TRUE(b.start - a.start <= max.ticks());
+  }
+}
+
+void test_should_not_stagger_beyond_max_shift(void) {
+  auto staggered = play_coincident(50_us), plain = play_coincident(0_us);
+
+  // The overlap is longer than allowed, pulses are left where they were
+  TEST_ASSERT_EQUAL(plain[1].size(), staggered[1].size());
+  for (size_t i = 0; i < plain[1].size(); i++) {
+    TEST_ASSERT_EQUAL(plain[1][i].start, staggered[1][i].start);
+    TEST_ASSERT_EQUAL(plain[0][i].start, plain[1][i].start);
+  }
 }
 
 extern "C" void app_main(void) {
@@ -300,6 +515,15 @@ extern "C" void app_main(void) {
   RUN_TEST(test_should_sequence_polyphonic_out_of_phase_multichannel_note_off);
   RUN_TEST(test_must_not_be_limited_when_no_duty_limit);
   RUN_TEST(test_must_not_exceed_duty_limit);
+  RUN_TEST(test_should_attenuate_instead_of_dropping_over_duty_limit);
+  RUN_TEST(test_should_merge_silences);
+  RUN_TEST(test_pulse_merge);
+  RUN_TEST(test_should_render_window_in_chunks);
+  RUN_TEST(test_should_render_windows_longer_than_a_pulse);
+  RUN_TEST(test_should_play_across_wraparound);
+  RUN_TEST(test_must_respect_thermal_limit);
+  RUN_TEST(test_should_stagger_coincident_pulses);
+  RUN_TEST(test_should_not_stagger_beyond_max_shift);
   UNITY_END();
 }
 int main(int argc, char **argv) { app_main(); }
@@ -0,0 +1,105 @@
+#include "core.hpp"
+#include "midi_synth.hpp"
+#include "synthesizer/helpers/assertions.hpp"
+#include <cstdint>
+#include <unity.h>
+
+using namespace teslasynth::midisynth;
+
+constexpr Config thermal_config(HeatModel model = HeatModel::Linear) {
+  return {
+      .max_on_time = 100_us,
+      .thermal_time_constant = Millis16::millis(100),
+      .thermal_duty = DutyCycle(20),
+      .heat_model = model,
+  };
+}
+
+// Plays pulses of the given on/off for a while, returns the average duty
+float play(ThermalLimiter &limiter, Duration16 on, Duration16 off,
+           Duration32 length) {
+  Duration total, used;
+  while (total < length) {
+    Duration16 granted = limiter.grant(on);
+    TEST_ASSERT_TRUE(granted <= on);
+    used += granted;
+    total += Duration32(on) + off;
+    limiter.cool(Duration32(on) + off);
+  }
+  return used.ticks() / static_cast<float>(total.ticks());
+}
+
+void test_disabled_by_default(void) {
+  ThermalLimiter limiter;
+  TEST_ASSERT_FALSE(limiter.is_enabled());
+  TEST_ASSERT_FALSE(ThermalLimiter(Config{}).is_enabled());
+  for (auto i = 0; i < 1000; i++) {
+    assert_duration_equal(limiter.grant(10_ms), 10_ms);
+    limiter.cool(10_ms);
+  }
+  TEST_ASSERT_EQUAL_FLOAT(0, limiter.load());
+}
+
+void test_no_attenuation_below_rating(void) {
+  ThermalLimiter limiter(thermal_config());
+  TEST_ASSERT_TRUE(limiter.is_enabled());
+  float duty = play(limiter, 100_us, 900_us, Duration32::seconds(2));
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 0.1, duty);
+  TEST_ASSERT_TRUE(limiter.load() < 0.75);
+}
+
+void test_attenuates_gracefully_above_rating(void) {
+  ThermalLimiter limiter(thermal_config());
+  Duration16 previous = 100_us;
+  bool attenuated = false;
+  for (auto i = 0; i < 5000; i++) {
+    Duration16 granted = limiter.grant(100_us);
+    // On-time is scaled down gradually instead of being dropped
+    TEST_ASSERT_TRUE(granted > Duration16::zero());
+    attenuated |= granted < 100_us;
+    TEST_ASSERT_TRUE(*(previous - granted) <= 10_us);
+    previous = granted;
+    limiter.cool(200_us);
+  }
+  TEST_ASSERT_TRUE(attenuated);
+  TEST_ASSERT_TRUE(limiter.load() <= 1);
+
+  float duty = play(limiter, 100_us, 100_us, Duration32::seconds(1));
+  TEST_ASSERT_TRUE(duty <= 0.2);
+  TEST_ASSERT_TRUE(duty > 0.1);
+}
+
+void test_squared_heat_model(void) {
+  ThermalLimiter linear(thermal_config(HeatModel::Linear)),
+      squared(thermal_config(HeatModel::Squared));
+
+  linear.grant(50_us);
+  squared.grant(50_us);
+  TEST_ASSERT_FLOAT_WITHIN(1e-4, linear.load() / 2, squared.load());
+
+  // Short pulses heat less, so more of them fit in the same rating
+  float duty = play(squared, 50_us, 150_us, Duration32::seconds(2));
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 0.25, duty);
+}
+
+void test_cools_down(void) {
+  ThermalLimiter limiter(thermal_config());
+  play(limiter, 100_us, 100_us, Duration32::seconds(1));
+  TEST_ASSERT_TRUE(limiter.load() > 0.75);
+
+  for (auto i = 0; i < 10; i++)
+    limiter.cool(50_ms);
+  TEST_ASSERT_TRUE(limiter.load() < 0.01);
+  assert_duration_equal(limiter.grant(100_us), 100_us);
+}
+
+extern "C" void app_main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_disabled_by_default);
+  RUN_TEST(test_no_attenuation_below_rating);
+  RUN_TEST(test_attenuates_gracefully_above_rating);
+  RUN_TEST(test_squared_heat_model);
+  RUN_TEST(test_cools_down);
+  UNITY_END();
+}
+int main(int argc, char **argv) { app_main(); }